@@ -11,6 +11,7 @@
 
 #include "cpu_eflags.h"
 #include "cpu_alu.h"
+#include "cpu_instruction.h"
 
 #include "type_defs.h"
 #include "mem_tracking.h"
@@ -23,14 +24,37 @@
 
 #define X86_CPU_MAX_INSTRUCTION_SIZE 15
 
+/*CODE KEY; cpu mode and cs default size. keys decoded code and selects the execution loop*/
+#define X86_CODE_KEY(mode, default_size) (((mode) << 1) | (default_size))
+#define X86_CODE_KEY_REAL16 X86_CODE_KEY(CPU_REAL_MODE, 0)
+#define X86_CODE_KEY_PROT32 X86_CODE_KEY(CPU_PROTECTED_MODE, 1)
+
 typedef enum _X86_CPU_ERROR {
 	X86_CPU_ERROR_SUCCESS = 0,
 	X86_CPU_ERROR_FATAL,
 	X86_CPU_ERROR_HLT,
 	X86_CPU_ERROR_UD,
 	X86_CPU_ERROR_DECODED,
+	X86_CPU_ERROR_BREAKPOINT,
+	X86_CPU_ERROR_IO,
 } X86_CPU_ERROR;
 
+/*RUN EXIT REASON*/
+typedef enum _X86_CPU_EXIT_REASON {
+	X86_CPU_EXIT_COUNT = 0, // executed max_instructions
+	X86_CPU_EXIT_HLT,
+	X86_CPU_EXIT_UD,
+	X86_CPU_EXIT_FATAL,
+	X86_CPU_EXIT_BREAKPOINT,
+	X86_CPU_EXIT_IO,
+} X86_CPU_EXIT_REASON;
+
+/*RUN STOP MASK; HLT, UD and FATAL always stop a run*/
+#define X86_CPU_STOP_BREAKPOINT 0x01 // stop before executing a breakpoint address
+#define X86_CPU_STOP_IO 0x02 // stop after an in / out instruction
+
+#define X86_CPU_BREAKPOINT_COUNT 128
+
 /*32bit GENERAL REGISTER*/
 enum {
 	REG_EAX = 0,
@@ -100,11 +124,13 @@ typedef X86_REG32 X86_CONTROL_REGISTER;
 
 /*DESCRIPTORS*/
 typedef struct _X86_SEGMENT_DESCRIPTOR {
-	uint32_t base;
-	uint16_t limit;
+	uint32_t base; // linear address of offset 0
+	uint32_t limit; // last offset of the segment; the granularity bit is applied
+	uint32_t mask; // offset bits an access keeps; 0xFFFF in real mode
 	uint8_t access;
 	uint8_t flags;
 	uint8_t default_size;
+	uint8_t flat; // protected mode, base 0 and a 4GB limit; offsets are linear addresses
 } X86_SEGMENT_DESCRIPTOR;
 typedef struct _X86_GLOBAL_DESCRIPTOR {
 	uint32_t base; // linear base address
@@ -122,25 +148,360 @@ typedef struct _X86_MEMORY {
 	uint32_t rom_end;
 	uint32_t rom_size;
 	BYTE* rom;
+	uint32_t rom_image_size; // size of the image mirrored across the rom window; 0 if the window is one buffer
+	intptr_t rom_section; // host section the mirrors share
 
 	uint32_t ram_base;
 	uint32_t ram_end;
 	uint32_t ram_size;
 	BYTE* ram;
+
+	BYTE* open_read; // zero page that pointers to memory not backed by the host point at
 } X86_MEMORY;
 
+typedef struct _PREFIX_BYTE_STRUCT {
+	BYTE segment_override;
+	BYTE byte_66 : 1;
+	BYTE byte_67 : 1;
+	BYTE byte_f3 : 1;
+	BYTE byte_f2 : 1;
+	BYTE byte_0f : 1;
+} PREFIX_BYTE_STRUCT;
+
+/*DECODED INSTRUCTION*/
+typedef struct _X86_CPU X86_CPU;
+typedef struct _X86_INSTRUCTION X86_INSTRUCTION;
+typedef struct _ADDRESSING_MODE_FIELD_STRUCT ADDRESSING_MODE_FIELD_STRUCT;
+
+typedef int (*X86_INSTRUCTION_HANDLER)(X86_CPU* cpu, X86_INSTRUCTION* instr);
+typedef int (*X86_JIT_BLOCK)(X86_CPU* cpu);
+typedef int (*X86_ADDRESSING_HANDLER)(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state);
+
+#define X86_INSTRUCTION_BRANCH 0x01 // instruction ends a basic block
+
+struct _X86_INSTRUCTION {
+	X86_INSTRUCTION_HANDLER handler; // executes the instruction
+	X86_ADDRESSING_HANDLER addressing; // resolves the mod r/m operand, if any
+	PREFIX_BYTE_STRUCT prefix;
+	X86_OPCODE opcode;
+	X86_MOD_RM mode;
+	BYTE sib;
+	BYTE reg; // register operand encoded in the opcode
+	BYTE operand_size;
+	BYTE address_size;
+	BYTE src_size; // source operand size (movzx, movsx)
+	BYTE length; // instruction length in bytes
+	BYTE flags; // X86_INSTRUCTION_BRANCH
+	BYTE segment; // segment of the memory operand; the default of the addressing mode or the override
+	uint16_t stats; // X86_STATS_INDEX of the opcode map entry
+	uint16_t selector; // far pointer selector
+	uint32_t disp; // displacement
+	uint32_t imm; // immediate, relative offset or far pointer offset
+};
+
+/*DECODE CACHE*/
+typedef struct _X86_DECODE_CACHE_ENTRY {
+	uint32_t address; // linear address of the instruction
+	uint32_t generation; // entry is valid when this matches the cache generation
+	uint8_t key; // cpu mode and cs default size the instruction was decoded in
+	uint8_t* ptr; // host pointer to the instruction bytes
+	X86_INSTRUCTION instr;
+} X86_DECODE_CACHE_ENTRY;
+#define X86_BLOCK_MAX_INSTRUCTIONS 32
+#define X86_BLOCK_POLL 0x01 // block branches to its own start and only writes registers and flags
+
+typedef struct _X86_BLOCK {
+	uint32_t address; // linear address of the first instruction
+	uint32_t generation; // block is valid when this matches the cache generation
+	uint8_t key; // cpu mode and cs default size the block was decoded in
+	uint8_t count; // number of instructions in the block
+	uint8_t flags; // X86_BLOCK_POLL
+	uint8_t* ptr; // host pointer to the first instruction
+	uint32_t hits; // times the block was interpreted
+	uint32_t runs; // times the translated block ran since its instructions were last added to the stats
+	X86_JIT_BLOCK native; // translated block, if any
+	struct _X86_BLOCK* link[2]; // successor blocks
+	X86_INSTRUCTION instr[X86_BLOCK_MAX_INSTRUCTIONS];
+} X86_BLOCK;
+typedef struct _X86_DECODE_CACHE {
+	X86_DECODE_CACHE_ENTRY* entries;
+	X86_BLOCK* blocks;
+	uint8_t* code_pages; // bitmap of pages that hold decoded instructions
+	uint32_t generation;
+} X86_DECODE_CACHE;
+
+/*TLB*/
+#define X86_TLB_SIZE 256 // entries per table; must be a power of 2
+#define X86_TLB_PAGE_SHIFT 12 // 4KB pages
+
+typedef struct _X86_TLB_ENTRY {
+	uint32_t tag; // linear address of the page; X86_TLB_INVALID when empty
+	uintptr_t addend; // host pointer = addend + linear address
+} X86_TLB_ENTRY;
+typedef struct _X86_TLB {
+	X86_TLB_ENTRY read[X86_TLB_SIZE];
+	X86_TLB_ENTRY write[X86_TLB_SIZE]; // never holds a page with decoded code
+	X86_TLB_ENTRY fetch[X86_TLB_SIZE];
+} X86_TLB;
+
+/* the code page eip is on, as cs offsets; instruction bytes in it are fetched without a lookup */
+typedef struct _X86_FETCH_WINDOW {
+	uintptr_t addend; // host pointer = addend + offset
+	uint32_t start; // first offset in the window
+	uint32_t size; // bytes in the window; 0 when empty
+} X86_FETCH_WINDOW;
+
+/*BUS*/
+#define X86_BUS_REGION_MAX 64
+#define X86_BUS_PAGE_SHIFT 12 // 4KB pages; regions start and end on a page
+#define X86_BUS_PAGE_COUNT (1 << (32 - X86_BUS_PAGE_SHIFT))
+
+typedef enum _X86_BUS_REGION_TYPE {
+	X86_BUS_UNMAPPED,
+	X86_BUS_RAM,
+	X86_BUS_ROM,
+	X86_BUS_MMIO,
+	X86_BUS_MIRROR,
+} X86_BUS_REGION_TYPE;
+
+typedef uint32_t (*X86_BUS_READ_HANDLER)(void* device, uint32_t offset, uint32_t size);
+typedef void (*X86_BUS_WRITE_HANDLER)(void* device, uint32_t offset, uint32_t size, uint32_t value);
+
+typedef struct _X86_BUS_REGION {
+	X86_BUS_REGION_TYPE type;
+	uint32_t attributes; // X86_BUS_READ, X86_BUS_WRITE, X86_BUS_EXECUTE
+	uint32_t base; // physical address of the first byte
+	uint32_t end; // physical address of the last byte
+	BYTE* host; // host memory at base; ram and rom
+	uint32_t target; // physical address the mirror starts at
+	uint32_t target_size; // bytes the mirror repeats
+	X86_BUS_READ_HANDLER read; // mmio
+	X86_BUS_WRITE_HANDLER write; // mmio
+	void* device; // passed to read and write
+	int split; // a later region covers some of its pages
+	int mapped; // the region's pages are in the page table
+} X86_BUS_REGION;
+
+typedef struct _X86_BUS {
+	X86_BUS_REGION regions[X86_BUS_REGION_MAX]; // regions[0] is the unmapped space
+	uint32_t region_count;
+	uint8_t* pages; // region index of each physical page
+} X86_BUS;
+
+/*IO*/
+#define X86_IO_DEVICE_MAX 64
+#define X86_IO_PORT_COUNT 0x10000
+
+typedef uint32_t (*X86_IO_READ_HANDLER)(void* device, uint16_t port);
+typedef void (*X86_IO_WRITE_HANDLER)(void* device, uint16_t port, uint32_t value);
+
+typedef struct _X86_IO_DEVICE {
+	X86_IO_READ_HANDLER read[3]; // byte, word, dword
+	X86_IO_WRITE_HANDLER write[3]; // byte, word, dword
+	void* device;
+	uint16_t base;
+	uint16_t end; // inclusive
+} X86_IO_DEVICE;
+
+typedef enum _X86_IO_TRACE_MODE {
+	X86_IO_TRACE_MODE_OFF = 0,
+	X86_IO_TRACE_MODE_RECORD, // every access goes to the devices and is appended to the trace
+	X86_IO_TRACE_MODE_REPLAY, // accesses take the next record instead of going to the devices
+} X86_IO_TRACE_MODE;
+
+typedef struct _X86_IO_TRACE_RECORD {
+	uint32_t address; // linear address of the in / out
+	uint32_t value; // value read or written
+	uint16_t port;
+	uint8_t size; // 1, 2 or 4
+	uint8_t write; // 1 for out
+} X86_IO_TRACE_RECORD;
+
+typedef struct _X86_IO_TRACE {
+	X86_IO_TRACE_MODE mode;
+	X86_IO_TRACE_RECORD* records;
+	uint32_t count; // records held
+	uint32_t capacity;
+	uint32_t position; // next record to replay
+	int error; // replay met an access the trace does not hold, or recording ran out of memory
+} X86_IO_TRACE;
+
+typedef struct _X86_IO {
+	X86_IO_DEVICE devices[X86_IO_DEVICE_MAX]; // devices[0] has no handlers; the ports no device decodes
+	uint32_t device_count;
+	uint8_t* ports; // device index of each port
+	X86_IO_TRACE trace;
+} X86_IO;
+
+/*EVENTS*/
+#define X86_EVENT_MAX 64
+
+typedef void (*X86_EVENT_HANDLER)(X86_CPU* cpu, void* device, uint64_t time);
+
+typedef struct _X86_EVENT {
+	uint64_t time; // virtual time the event is due
+	X86_EVENT_HANDLER handler;
+	void* device; // passed to handler
+	uint32_t id;
+} X86_EVENT;
+
+typedef struct _X86_EVENT_QUEUE {
+	X86_EVENT heap[X86_EVENT_MAX]; // min-heap on time
+	uint32_t count;
+	uint32_t next_id;
+	uint64_t deadline; // time of the earliest event; UINT64_MAX when there is none
+} X86_EVENT_QUEUE;
+
+/*JIT*/
+typedef struct _X86_JIT {
+	uint8_t* code; // executable code buffer
+	uint32_t size;
+	uint32_t used;
+	int enabled;
+	uint32_t retired; // instructions the running translated block has run; a handler counts once it returns success or io
+} X86_JIT;
+
+/*STATS*/
+#define X86_STATS_MAP_ONE_BYTE 0
+#define X86_STATS_MAP_0F 1
+#define X86_STATS_MAP_F3 2
+#define X86_STATS_MAP_F2 3
+#define X86_STATS_INDEX(map, opcode, reg) (((map) << 11) | ((opcode) << 3) | (reg)) // reg; the mod r/m reg of a group opcode, else 0
+#define X86_STATS_SIZE (4 << 11)
+
+typedef struct _X86_STATS {
+	uint64_t* count; // instructions executed per X86_STATS_INDEX; translated blocks are added by x86StatsCollect
+	uint64_t* cycles; // host cycles spent in the handler while cycles are sampled
+	uint64_t* samples; // executions cycles were sampled over
+	int sample_cycles; // read the host timestamp counter around every interpreted instruction
+} X86_STATS;
+
+/*PROFILE*/
+#define X86_PROFILE_NAME_SIZE 48
+
+typedef struct _X86_PROFILE_ENTRY {
+	uint32_t address; // linear address
+	uint32_t count; // samples; 0 when the entry is empty
+} X86_PROFILE_ENTRY;
+
+typedef struct _X86_PROFILE_SYMBOL {
+	uint32_t address; // linear address the symbol starts at; it runs to the next symbol
+	char name[X86_PROFILE_NAME_SIZE];
+} X86_PROFILE_SYMBOL;
+
+typedef struct _X86_PROFILE {
+	X86_PROFILE_ENTRY* addresses; // samples per instruction; open addressing on the address
+	X86_PROFILE_ENTRY* blocks; // samples per block
+	uint32_t address_capacity; // a power of 2
+	uint32_t address_count;
+	uint32_t block_capacity; // a power of 2
+	uint32_t block_count;
+	X86_PROFILE_SYMBOL* symbols;
+	uint32_t symbol_count;
+	uint32_t symbol_capacity;
+	int symbols_sorted; // symbols are in address order
+	uint64_t period; // instructions between samples
+	uint64_t samples;
+	uint32_t event; // id of the posted sample event; 0 when the profiler is off
+	uint32_t block; // eip of the first instruction of the block eip is in
+	int error; // a table could not grow; samples after it are dropped
+} X86_PROFILE;
+
+/*CALL STACK*/
+#define X86_CALL_STACK_DEPTH 256
+
+typedef struct _X86_CALL_NODE {
+	uint32_t address; // linear address the function was entered at
+	uint32_t parent; // index of the caller's node
+	uint32_t child; // index of the first callee's node; 0 when there is none
+	uint32_t sibling; // index of the next callee of parent; 0 when there is none
+	uint64_t self; // instructions run in the function on this path, not counting its callees
+	uint64_t total; // self and the callees; filled in by x86CallStackCollect
+} X86_CALL_NODE;
+
+typedef struct _X86_CALL_FRAME {
+	uint32_t node;
+	uint32_t return_address; // linear address
+} X86_CALL_FRAME;
+
+typedef struct _X86_CALL_STACK {
+	X86_CALL_NODE* nodes; // one per call path; node 0 is above the first function
+	uint32_t node_count;
+	uint32_t node_capacity;
+	X86_CALL_FRAME frames[X86_CALL_STACK_DEPTH]; // frame 0 is never returned from
+	uint32_t depth; // frames in use
+	uint64_t clock; // cpu->clock when the top frame was last charged
+	uint32_t dropped; // calls past X86_CALL_STACK_DEPTH, counted in their caller
+	uint32_t unmatched; // returns to an address no frame was called from
+	int active;
+	int error; // the call tree could not grow; later calls are dropped
+} X86_CALL_STACK;
+
+/*TRACE*/
+#define X86_TRACE_MAX_BYTES 15 // longest instruction
+#define X86_TRACE_EFLAGS_CHANGED 0x01
+
+typedef struct _X86_TRACE_RECORD {
+	uint32_t address; // linear address of the instruction
+	uint32_t eflags; // after the instruction
+	uint32_t registers[X86_GENERAL_REGISTER_COUNT]; // after the instruction
+	uint32_t write_address; // linear address of the first memory write
+	uint32_t write_value;
+	uint8_t bytes[X86_TRACE_MAX_BYTES];
+	uint8_t length;
+	uint8_t key; // X86_CODE_KEY the bytes decode with
+	uint8_t write_size; // 1, 2 or 4; 0 when the instruction made no memory write through x86CPUWrite*
+	uint8_t changed; // bit n when registers[n] differs from the record before
+	uint8_t flags; // X86_TRACE_EFLAGS_CHANGED
+} X86_TRACE_RECORD;
+
+typedef struct _X86_TRACE {
+	X86_TRACE_RECORD* ring; // single producer, single consumer
+	uint32_t capacity; // records; a power of 2
+	uint32_t head; // next record the cpu fills; written by the cpu thread only
+	uint8_t head_pad[60];
+	uint32_t tail; // next record the writer thread drains; written by the writer thread only
+	uint8_t tail_pad[60];
+	uint32_t cached_tail; // tail as the cpu last read it
+	X86_TRACE_RECORD* record; // record of the instruction executing; NULL between instructions
+	void* file;
+	uintptr_t thread;
+	uint32_t stop; // set by x86TraceStop; the writer thread drains the ring and ends
+	int error; // a write to the file failed; records after it are dropped
+	int active;
+} X86_TRACE;
+
+/*RUN*/
+typedef struct _X86_CPU_EXIT {
+	X86_CPU_EXIT_REASON reason;
+	int error; // X86_CPU_ERROR_* that ended the run
+	uint32_t address; // linear address of eip when the run ended
+	uint64_t instructions; // instructions executed by the run
+	uint16_t port; // last I/O port accessed
+	uint8_t port_size;
+	uint8_t port_write;
+	uint32_t port_value;
+} X86_CPU_EXIT;
+
+typedef struct _X86_BREAKPOINT {
+	uint32_t address; // linear address
+	int set;
+} X86_BREAKPOINT;
+
 /*CPU*/
-typedef struct _X86_CPU {
+struct _X86_CPU {
 	X86_GENERAL_REGISTER registers[X86_GENERAL_REGISTER_COUNT];
 	X86_SEGMENT_REGISTER segment_registers[X86_SEGMENT_REGISTER_COUNT];
 	X86_SEGMENT_DESCRIPTOR segment_descriptors[X86_SEGMENT_REGISTER_COUNT];
 	X86_CONTROL_REGISTER control_registers[X86_CONTROL_REGISTER_COUNT];
-	X86_EFLAGS eflags;
+	X86_EFLAGS eflags; // CF, PF, ZF, SF and OF are only current after x86CPUGetEflags
+	X86_LAZY_FLAGS lazy_flags;
 	union {
 		X86_REG16 ip;
 		X86_REG32 eip;
 	};
 	uint8_t* eip_ptr;
+	X86_FETCH_WINDOW fetch_window; // emptied when cs, the cpu mode or the linear to host mapping changes
 	
 	X86_MEMORY mem;
 	int hlt;
@@ -149,23 +510,37 @@ typedef struct _X86_CPU {
 	X86_GLOBAL_DESCRIPTOR idtr;
 	X86_LOCAL_DESCRIPTOR ldtr;
 
-	uint64_t* gdt;
-	uint64_t* idt;
+	const uint64_t* gdt;
+	const uint64_t* idt;
 	uint64_t* ldt;
 
 	int mode;
+	uint8_t code_key; // X86_CODE_KEY of mode and cs
+
+	X86_BUS bus;
+	X86_IO io;
+	X86_TLB tlb;
+	X86_DECODE_CACHE decode_cache;
+	X86_JIT jit;
+
+	uint64_t clock; // virtual time; one tick per instruction executed
+	X86_EVENT_QUEUE events;
+
+	X86_STATS stats;
+	X86_PROFILE profile;
+	X86_CALL_STACK calls; // shadow call stack; CALL, RET and far jumps update it while it is active
+	X86_TRACE trace; // instruction trace; every instruction goes through x86CPUExecute while it is active
+
+	uint32_t stop_mask; // X86_CPU_STOP_* of the current run
+	uint64_t run_end; // cpu->clock the current run ends at; UINT64_MAX outside a run
+	X86_CPU_EXIT exit;
+
+	X86_BREAKPOINT breakpoints[X86_CPU_BREAKPOINT_COUNT];
+	uint32_t breakpoint_count;
 	
 	char output_str[32];
 	char addressing_str[32];
-} X86_CPU;
-
-typedef struct _PREFIX_BYTE_STRUCT {
-	BYTE segment_override;
-	BYTE byte_66 : 1;
-	BYTE byte_67 : 1;
-	BYTE byte_f3 : 1;
-	BYTE byte_0f : 1;
-} PREFIX_BYTE_STRUCT;
+};
 
 int x86CPUFetchPrefixBytes(X86_CPU* cpu, PREFIX_BYTE_STRUCT* prefix, X86_OPCODE* opcode, uint32_t* counter);
 
@@ -174,6 +549,11 @@ int x86InitMemory(X86_MEMORY* mem, uint32_t rom_base, uint32_t rom_end, uint32_t
 int x86ClearMemory(X86_MEMORY* mem);
 int x86FreeMemory(X86_MEMORY* mem);
 
+/* Mirror the image at the start of the rom window across the whole window. When image_size is a power of 2 that
+   divides the window and the host can alias memory, the mirrors share host pages; otherwise the image is copied.
+   The top mirror stays private so the top of rom can be overlaid */
+int x86CPUMirrorRom(X86_CPU* cpu, uint32_t image_size);
+
 /*CPU*/
 int x86ResetCPU(X86_CPU* cpu);
 int x86InitCPU(X86_CPU* cpu, uint32_t rom_base, uint32_t rom_end, uint32_t ram_base, uint32_t ram_end);
@@ -184,11 +564,33 @@ uint32_t x86CPUGetRegister(X86_CPU* cpu, uint32_t reg, uint32_t operand_size);
 int32_t x86CPUGetRegisterSigned(X86_CPU* cpu, uint32_t reg, uint32_t operand_size);
 void x86CPUSetRegister(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t value);
 
+/* Unpack the gdt entry of selector into descriptor */
 void x86CPULoadSegmentDescriptor(X86_CPU* cpu, uint16_t selector, X86_SEGMENT_DESCRIPTOR* descriptor);
 
+/* Load a segment register (SEG_*) and its descriptor cache; from the gdt in protected mode, selector << 4 in real mode */
+void x86CPULoadSegment(X86_CPU* cpu, uint32_t segment, uint16_t selector);
+
+/* Recompute the state derived from cpu->mode and the segment descriptors; call after changing either */
+void x86CPUUpdateMode(X86_CPU* cpu);
+
 void x86CPUDumpRegisters(X86_CPU* cpu);
+
+/* Get eflags with the arithmetic flags computed */
+X86_EFLAGS* x86CPUGetEflags(X86_CPU* cpu);
 void x86CPUGetDefaultSize(X86_CPU* cpu, PREFIX_BYTE_STRUCT* prefix, uint8_t* operand_size, uint8_t* address_size);
 
+int x86CPUDecode(X86_CPU* cpu, X86_INSTRUCTION* instr);
 int x86CPUExecute(X86_CPU* cpu);
 
+/* Execute up to max_instructions of virtual time or until a stop condition. Time spent halted, in a loop to itself or in a
+   poll loop that stopped changing anything is skipped up to the next event instead of executed, and is not counted in
+   cpu->exit.instructions. A halted cpu exits with X86_CPU_EXIT_HLT; at once if no event is posted to wake it, otherwise
+   after the whole max_instructions. A run that starts on the breakpoint the last run exited on runs that instruction
+   instead of stopping again. details of the exit are in cpu->exit */
+X86_CPU_EXIT_REASON x86CPURun(X86_CPU* cpu, uint64_t max_instructions, uint32_t stop_mask);
+
+/* Breakpoints; returns the breakpoint index or -1 if the table is full */
+int x86CPUAddBreakpoint(X86_CPU* cpu, uint32_t address, int set);
+int x86CPUIsBreakpoint(X86_CPU* cpu, uint32_t address);
+
 #endif
@@ -14,6 +14,27 @@
 #include "cpu_eflags.h"
 #include "cpu_instruction.h"
 
-int x86Alu(X86_EFLAGS* eflags, INSTRUCTION_TYPE type, uint32_t operand1, uint32_t operand2, uint32_t operand_size, uint32_t* result);
+/* Last flag producing operation. OF, ZF, SF and PF are computed from it when they are read; CF is kept up to date */
+typedef struct _X86_LAZY_FLAGS {
+	uint32_t operand1;
+	uint32_t operand2;
+	uint32_t result; // not truncated to operand_size
+	BYTE type; // INSTRUCTION_TYPE
+	BYTE operand_size;
+	BYTE CF; // carry flag
+} X86_LAZY_FLAGS;
+
+void x86InitLazyFlags(X86_LAZY_FLAGS* flags);
+
+int x86Alu(X86_LAZY_FLAGS* flags, INSTRUCTION_TYPE type, uint32_t operand1, uint32_t operand2, uint32_t operand_size, uint32_t* result);
+
+/* Flag read */
+BYTE x86AluOF(const X86_LAZY_FLAGS* flags);
+BYTE x86AluZF(const X86_LAZY_FLAGS* flags);
+BYTE x86AluSF(const X86_LAZY_FLAGS* flags);
+BYTE x86AluPF(const X86_LAZY_FLAGS* flags);
+
+/* Write CF, PF, ZF, SF and OF into eflags */
+void x86AluGetEflags(const X86_LAZY_FLAGS* flags, X86_EFLAGS* eflags);
 
 #endif
@@ -0,0 +1,55 @@
+// cpu_bus.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_BUS_H
+#define _CPU_BUS_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define X86_BUS_PAGE_SIZE (1 << X86_BUS_PAGE_SHIFT)
+
+/* region attributes */
+#define X86_BUS_READ 0x01
+#define X86_BUS_WRITE 0x02
+#define X86_BUS_EXECUTE 0x04
+
+/* Set up the page table and register the ram and rom of cpu->mem. Every page starts unmapped */
+int x86InitBus(X86_CPU* cpu);
+void x86FreeBus(X86_CPU* cpu);
+
+/* Register a region of base to end inclusive; base and end + 1 must be page aligned. A region covers the pages of
+   the regions registered before it, so device windows can be placed over a larger ram or rom window. Regions are
+   numbered in the order they are registered, from 1; the next one gets cpu->bus.region_count.
+   returns 0 on success */
+
+/* Host memory; host is the byte at base */
+int x86BusAddMemory(X86_CPU* cpu, X86_BUS_REGION_TYPE type, uint32_t base, uint32_t end, BYTE* host, uint32_t attributes);
+
+/* Memory mapped I/O; every access calls read or write with the offset from base. either handler may be NULL */
+int x86BusAddMmio(X86_CPU* cpu, uint32_t base, uint32_t end, X86_BUS_READ_HANDLER read, X86_BUS_WRITE_HANDLER write, void* device);
+
+/* Repeat the target_size bytes of memory at target across the region. the target must lie in one memory region that
+   is not writable */
+int x86BusAddMirror(X86_CPU* cpu, uint32_t base, uint32_t end, uint32_t target, uint32_t target_size);
+
+/* Move an mmio region to base to end inclusive, or take it out of the page table. The region keeps its number, so it
+   still covers the regions registered before it and is covered by the ones after. x86BusMapRegion returns 0 on success */
+int x86BusMapRegion(X86_CPU* cpu, uint32_t index, uint32_t base, uint32_t end);
+void x86BusUnmapRegion(X86_CPU* cpu, uint32_t index);
+
+/* Get the region of a physical address */
+X86_BUS_REGION* x86BusGetRegion(X86_CPU* cpu, uint32_t address);
+
+/* Host pointer of the page that holds address if the page is host memory with all of the attributes, otherwise NULL */
+BYTE* x86BusGetHostPage(X86_CPU* cpu, uint32_t address, uint32_t attributes);
+
+/* Access that can not go through host memory; mmio calls the device, unmapped space reads 0 and drops writes,
+   and writes to memory without X86_BUS_WRITE are dropped */
+uint32_t x86BusRead(X86_CPU* cpu, uint32_t address, uint32_t size);
+void x86BusWrite(X86_CPU* cpu, uint32_t address, uint32_t size, uint32_t value);
+
+#endif
@@ -0,0 +1,37 @@
+// cpu_cache.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_CACHE_H
+#define _CPU_CACHE_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define X86_DECODE_CACHE_SIZE 0x2000 // entries; must be a power of 2
+#define X86_DECODE_CACHE_PAGE_SHIFT 12 // 4KB code pages
+#define X86_DECODE_CACHE_PAGE_COUNT (1 << (32 - X86_DECODE_CACHE_PAGE_SHIFT))
+#define X86_BLOCK_CACHE_SIZE 0x1000 // blocks; must be a power of 2
+#define X86_BLOCK_CHAIN_MAX 64 // blocks executed per x86CPUExecuteBlock call
+
+int x86InitDecodeCache(X86_CPU* cpu);
+void x86FreeDecodeCache(X86_CPU* cpu);
+void x86CPUFlushDecodeCache(X86_CPU* cpu);
+
+/* Does the page of the linear address hold decoded instructions */
+int x86CPUIsCodePage(X86_CPU* cpu, uint32_t address);
+
+/* Invalidate decoded instructions if the linear range holds code */
+void x86CPUInvalidateCode(X86_CPU* cpu, uint32_t address, uint32_t size);
+
+/* Get the decoded instruction at eip, decoding it on a miss */
+X86_INSTRUCTION* x86CPUFetchInstruction(X86_CPU* cpu, int* result);
+
+/* Execute basic blocks from eip, following block links. stops before a block that would take cpu->clock more than max_instructions
+   ahead; count is set to the instructions executed. A poll loop that stops changing anything is skipped to the end of the budget;
+   the skipped iterations advance cpu->clock but are not counted */
+int x86CPUExecuteBlock(X86_CPU* cpu, uint32_t max_instructions, uint32_t* count);
+
+#endif
@@ -0,0 +1,42 @@
+// cpu_callstack.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_CALLSTACK_H
+#define _CPU_CALLSTACK_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Start tracking calls from the function at eip. Drops the call tree held before. returns 0 on success */
+int x86CallStackStart(X86_CPU* cpu);
+
+/* Stop tracking calls. The call tree is kept for x86CallStackWriteFolded */
+void x86CallStackStop(X86_CPU* cpu);
+
+/* Drop the call tree */
+void x86FreeCallStack(X86_CPU* cpu);
+
+/* A call to eip that returns to return_address (linear); called by the handler after it sets eip */
+void x86CallStackCall(X86_CPU* cpu, uint32_t return_address);
+
+/* A return to eip; pops the frames up to the one called from eip */
+void x86CallStackReturn(X86_CPU* cpu);
+
+/* A far jump to eip; the frames are dropped and eip starts a new path */
+void x86CallStackFarJump(X86_CPU* cpu);
+
+/* Charge the instructions since the last call or return to the top frame and fill in the total of every node */
+void x86CallStackCollect(X86_CPU* cpu);
+
+/* Write the call tree in the folded stack format flame graph tools read; one "caller;callee <instructions>" line
+   per path, counting the instructions of the last function only. returns 0 on success */
+int x86CallStackWriteFolded(X86_CPU* cpu, const char* filename);
+
+/* Print the max_entries call paths with the most instructions, counting callees, with the instructions of the
+   last function alone */
+void x86CallStackDump(X86_CPU* cpu, uint32_t max_entries);
+
+#endif
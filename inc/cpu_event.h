@@ -0,0 +1,27 @@
+// cpu_event.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_EVENT_H
+#define _CPU_EVENT_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Empty the event queue and start virtual time at 0 */
+void x86InitEvents(X86_CPU* cpu);
+
+/* Call handler once cpu->clock reaches time. Events due at the same time run in the order they were posted; a time
+   already passed runs at the next dispatch. A handler that stands in for an interrupt wakes a halted cpu by clearing
+   cpu->hlt. returns the event id, or 0 if the queue is full */
+uint32_t x86EventPost(X86_CPU* cpu, uint64_t time, X86_EVENT_HANDLER handler, void* device);
+
+/* Remove a posted event that has not run. returns 0 if it was removed */
+int x86EventCancel(X86_CPU* cpu, uint32_t id);
+
+/* Run the events due at cpu->clock, earliest first, including ones the handlers post that are also due */
+void x86EventDispatch(X86_CPU* cpu);
+
+#endif
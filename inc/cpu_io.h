@@ -0,0 +1,61 @@
+// cpu_io.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_IO_H
+#define _CPU_IO_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* handler widths */
+#define X86_IO_BYTE 0
+#define X86_IO_WORD 1
+#define X86_IO_DWORD 2
+
+/* trace log; a header then header.count records */
+#define X86_IO_TRACE_MAGIC 0x52544F49 // "IOTR"
+#define X86_IO_TRACE_VERSION 1
+
+typedef struct _X86_IO_TRACE_HEADER {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size; // sizeof(X86_IO_TRACE_RECORD)
+	uint32_t count;
+} X86_IO_TRACE_HEADER;
+
+/* Set up the port table. Every port starts with no device */
+int x86InitIo(X86_CPU* cpu);
+void x86FreeIo(X86_CPU* cpu);
+
+/* Register a device that decodes ports base to end inclusive. read and write hold the handlers of each width, indexed by
+   X86_IO_BYTE, X86_IO_WORD and X86_IO_DWORD; either array and any handler in it may be NULL. A device covers the ports of
+   the devices registered before it. Handlers get the port as accessed, not the offset from base.
+   returns 0 on success */
+int x86IoAddDevice(X86_CPU* cpu, uint16_t base, uint16_t end, const X86_IO_READ_HANDLER read[3], const X86_IO_WRITE_HANDLER write[3], void* device);
+
+/* Get the device that decodes a port; devices[0] when no device does */
+X86_IO_DEVICE* x86IoGetDevice(X86_CPU* cpu, uint16_t port);
+
+/* Port access of size 1, 2 or 4 bytes. An access with no handler of its width is split into two of half the width,
+   which may go to different devices; a byte access with no handler reads 0 and drops writes */
+uint32_t x86IoRead(X86_CPU* cpu, uint16_t port, uint32_t size);
+void x86IoWrite(X86_CPU* cpu, uint16_t port, uint32_t size, uint32_t value);
+
+/* Record every in and out with the linear address it was issued at. Drops the trace held before */
+void x86IoTraceRecord(X86_CPU* cpu);
+
+/* Replay a log from x86IoTraceSave; the cpu must start in the state the recording started in. ins return the recorded
+   value and outs are dropped, in order, while they match the log; the first access that does not ends the replay and
+   goes to the devices. cpu->io.trace.error is set if the log was not used up. returns 0 on success */
+int x86IoTraceReplay(X86_CPU* cpu, const uint8_t* log, uint32_t size);
+
+/* Allocate a log of the records held, to write to a file. free it with free(). returns NULL if out of memory */
+uint8_t* x86IoTraceSave(X86_CPU* cpu, uint32_t* size);
+
+/* Stop recording or replaying and drop the trace */
+void x86IoTraceStop(X86_CPU* cpu);
+
+#endif
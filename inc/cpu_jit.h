@@ -0,0 +1,31 @@
+// cpu_jit.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_JIT_H
+#define _CPU_JIT_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define X86_JIT_HOST_X64 // the jit emits x86-64 host code
+#endif
+
+#ifndef X86_JIT_THRESHOLD
+#define X86_JIT_THRESHOLD 16 // interpreted runs before a block is translated
+#endif
+#define X86_JIT_CODE_SIZE 0x400000 // 4MB code buffer
+
+int x86InitJit(X86_CPU* cpu);
+void x86FreeJit(X86_CPU* cpu);
+
+/* Drop all translated blocks */
+void x86JitFlush(X86_CPU* cpu);
+
+/* Translate a basic block to host code. returns NULL if the block can not be translated */
+X86_JIT_BLOCK x86JitCompile(X86_CPU* cpu, X86_BLOCK* block);
+
+#endif
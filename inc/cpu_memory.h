@@ -9,29 +9,43 @@
 #include <stdint.h>
 #include "type_defs.h"
 
+/* Linear address of an offset in a segment (SEG_*) */
+uint32_t x86GetLinearAddress(X86_CPU* cpu, uint32_t segment, uint32_t offset);
+/* Linear address of an offset in cs */
 uint32_t x86GetEffectiveAddress(X86_CPU* cpu, uint32_t address);
 
 /* READ MEMORY */
-void* x86GetCPUMemoryPtr(X86_CPU* cpu, uint32_t address);
+/* Host pointer to the cs offset address for reading. never NULL; for mmio and unmapped space it points at a zero page shared by
+   every such address, which the device never sees. x86CPURead* go through the bus; write with x86CPUWrite* */
+const void* x86GetCPUMemoryPtr(X86_CPU* cpu, uint32_t address);
+/* Host pointer to an offset in a segment if it is host memory that allows the read, or the write when write = 1. size is set to the
+   number of bytes from offset towards higher (down = 0) or lower (down = 1) offsets, offset included, that are contiguous in host memory */
+void* x86GetCPUMemorySpan(X86_CPU* cpu, uint32_t segment, uint32_t offset, int down, int write, uint32_t* size);
+/* x86CPURead*, x86CPUWrite* and x86GetCPUMemoryWritePtr take linear addresses; see x86GetLinearAddress */
 BYTE x86CPUReadByte(X86_CPU* cpu, uint32_t address);
 WORD x86CPUReadWord(X86_CPU* cpu, uint32_t address);
 DWORD x86CPUReadDword(X86_CPU* cpu, uint32_t address);
 uint32_t x86CPUReadMemory(X86_CPU* cpu, uint32_t address, uint32_t operand_size);
 
 /* WRITE MEMORY */
+/* Host pointer for a write of size bytes, or NULL if the write has to go through the bus or crosses a page. invalidates decoded
+   code the write overlaps */
+void* x86GetCPUMemoryWritePtr(X86_CPU* cpu, uint32_t address, uint32_t size);
 void x86CPUWriteByte(X86_CPU* cpu, uint32_t address, BYTE value);
 void x86CPUWriteWord(X86_CPU* cpu, uint32_t address, WORD value);
 void x86CPUWriteDword(X86_CPU* cpu, uint32_t address, DWORD value);
 
 
 /* FETCH MEMORY AT EIP */
+/* Host pointer to the instruction byte at cs:address, or NULL if it is not host memory. Bytes after it are only
+   contiguous to the end of its page; fetch them with x86CPUFetch* */
+void* x86GetCPUFetchPtr(X86_CPU* cpu, uint32_t address);
+/* Fetch the bytes at cs:eip + *counter and advance counter. Bytes that cross a page or wrap the offset are fetched
+   one at a time; bytes that are not host memory read as 0 */
 BYTE x86CPUFetchByte(X86_CPU* cpu, uint32_t* counter);
 WORD x86CPUFetchWord(X86_CPU* cpu, uint32_t* counter);
 DWORD x86CPUFetchDword(X86_CPU* cpu, uint32_t* counter);
 uint32_t x86CPUFetchMemory(X86_CPU* cpu, uint32_t operand_size, uint32_t* counter);
-
-/* IO read / write */
-BYTE x86CPUGetIOByte(X86_CPU* cpu, uint32_t address);
-void x86CPUSetIOByte(X86_CPU* cpu, uint32_t operand_size, uint32_t address, uint32_t value);
+int32_t x86CPUFetchMemorySigned(X86_CPU* cpu, uint32_t operand_size, uint32_t* counter);
 
 #endif
@@ -0,0 +1,99 @@
+// cpu_pci.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_PCI_H
+#define _CPU_PCI_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define X86_PCI_CONFIG_SIZE 256 // bytes of config space per function
+#define X86_PCI_BUS_COUNT 4 // buses a config address can reach; the rest read as empty
+#define X86_PCI_BAR_COUNT 6
+
+/* config address register at 0xCF8 */
+#define X86_PCI_CONFIG_ADDRESS 0x0CF8
+#define X86_PCI_CONFIG_DATA 0x0CFC
+#define X86_PCI_ADDRESS_ENABLE 0x80000000
+#define X86_PCI_ADDRESS_MASK 0x80FFFFFC // enable, bus, device, function and dword register; bits 30:24 and 1:0 are reserved
+#define X86_PCI_ADDRESS(bus, device, function, reg) (X86_PCI_ADDRESS_ENABLE | ((bus) << 16) | ((device) << 11) | ((function) << 8) | ((reg) & 0xFC))
+
+/* config registers */
+#define X86_PCI_VENDOR_ID 0x00
+#define X86_PCI_DEVICE_ID 0x02
+#define X86_PCI_COMMAND 0x04
+#define X86_PCI_STATUS 0x06
+#define X86_PCI_REVISION_ID 0x08
+#define X86_PCI_CLASS_CODE 0x09 // programming interface, subclass and class
+#define X86_PCI_CACHE_LINE_SIZE 0x0C
+#define X86_PCI_LATENCY_TIMER 0x0D
+#define X86_PCI_HEADER_TYPE 0x0E
+#define X86_PCI_BAR0 0x10
+#define X86_PCI_PRIMARY_BUS 0x18 // bridge
+#define X86_PCI_INTERRUPT_LINE 0x3C
+#define X86_PCI_INTERRUPT_PIN 0x3D
+
+/* command register */
+#define X86_PCI_COMMAND_IO 0x01
+#define X86_PCI_COMMAND_MEMORY 0x02
+#define X86_PCI_COMMAND_MASTER 0x04
+
+/* header type */
+#define X86_PCI_HEADER_DEVICE 0x00
+#define X86_PCI_HEADER_BRIDGE 0x01
+#define X86_PCI_HEADER_MULTI_FUNCTION 0x80
+
+/* bar type; the low bits of the bar */
+#define X86_PCI_BAR_MEMORY 0x00
+#define X86_PCI_BAR_IO 0x01
+#define X86_PCI_BAR_PREFETCH 0x08
+
+typedef struct _X86_PCI_BAR {
+	uint32_t type; // X86_PCI_BAR_MEMORY, X86_PCI_BAR_IO, | X86_PCI_BAR_PREFETCH
+	uint32_t size; // power of 2; 0 when the bar is not implemented
+	X86_BUS_READ_HANDLER read; // memory bar
+	X86_BUS_WRITE_HANDLER write; // memory bar
+	void* device; // passed to read and write
+	uint32_t region; // bus region of a memory bar; 0 until it is first mapped
+} X86_PCI_BAR;
+
+typedef struct _X86_PCI_FUNCTION {
+	uint8_t config[X86_PCI_CONFIG_SIZE];
+	uint8_t write_mask[X86_PCI_CONFIG_SIZE]; // bits of each config byte software can write
+	X86_PCI_BAR bars[X86_PCI_BAR_COUNT];
+	uint8_t bus;
+	uint8_t device;
+	uint8_t function;
+} X86_PCI_FUNCTION;
+
+typedef struct _X86_PCI {
+	X86_CPU* cpu;
+	uint32_t address; // config address register
+	X86_PCI_FUNCTION* functions[X86_PCI_BUS_COUNT << 8]; // indexed by bits 23:8 of the config address; bus, device, function
+} X86_PCI;
+
+/* Register the config address and data ports with the cpu. No functions are present */
+int x86InitPci(X86_PCI* pci, X86_CPU* cpu);
+void x86FreePci(X86_PCI* pci);
+
+/* Add a function with a type 0 (X86_PCI_HEADER_DEVICE) or type 1 (X86_PCI_HEADER_BRIDGE) header. class_code is
+   class << 16 | subclass << 8 | programming interface. returns NULL if the slot is taken, out of range or out of memory */
+X86_PCI_FUNCTION* x86PciAddFunction(X86_PCI* pci, uint8_t bus, uint8_t device, uint8_t function, uint16_t vendor_id, uint16_t device_id, uint32_t class_code, uint8_t header_type);
+
+/* Get the function a config address selects; NULL if there is none */
+X86_PCI_FUNCTION* x86PciGetFunction(X86_PCI* pci, uint32_t address);
+
+/* Implement a bar of size bytes. A memory bar is put on the bus at the address software writes to it while the memory
+   space bit of the command register is set; it must be at least a page. read and write are called with the offset
+   into the bar. An io bar only decodes its address; the device registers its ports with x86IoAddDevice.
+   returns 0 on success */
+int x86PciSetBar(X86_PCI_FUNCTION* function, uint32_t index, uint32_t type, uint32_t size, X86_BUS_READ_HANDLER read, X86_BUS_WRITE_HANDLER write, void* device);
+
+/* Access config space as a config cycle does; writes only change the bits of write_mask and move the bars they touch */
+uint32_t x86PciConfigRead(X86_PCI* pci, X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size);
+void x86PciConfigWrite(X86_PCI* pci, X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size, uint32_t value);
+
+#endif
@@ -0,0 +1,38 @@
+// cpu_profile.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_PROFILE_H
+#define _CPU_PROFILE_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Start sampling the linear address of eip every period instructions of virtual time. Drops the samples held before;
+   the symbols are kept. Sampling ends on its own once the cpu halts with no other event posted to wake it.
+   returns 0 on success */
+int x86ProfileStart(X86_CPU* cpu, uint64_t period);
+
+/* Stop sampling. The samples are kept for x86ProfileWriteReport */
+void x86ProfileStop(X86_CPU* cpu);
+
+/* Drop the samples and the symbols */
+void x86FreeProfile(X86_CPU* cpu);
+
+/* Name the code from address up to the next symbol. returns 0 on success */
+int x86ProfileAddSymbol(X86_CPU* cpu, uint32_t address, const char* name);
+
+/* Get the name of the symbol that starts at address. returns NULL if no symbol starts there */
+const char* x86ProfileGetSymbol(X86_CPU* cpu, uint32_t address);
+
+/* Add the symbols of a map file; one "<hex address> <name>" per line. Blank lines and lines starting with # or ; are
+   skipped. returns 0 on success */
+int x86ProfileLoadSymbols(X86_CPU* cpu, const char* filename);
+
+/* Write the samples to filename as text, hottest first: per symbol, per block and per instruction, up to
+   max_entries lines in each. returns 0 on success */
+int x86ProfileWriteReport(X86_CPU* cpu, const char* filename, uint32_t max_entries);
+
+#endif
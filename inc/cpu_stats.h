@@ -0,0 +1,39 @@
+// cpu_stats.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_STATS_H
+#define _CPU_STATS_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Allocate the opcode histogram; every count starts at 0. returns 0 on success */
+int x86InitStats(X86_CPU* cpu);
+void x86FreeStats(X86_CPU* cpu);
+
+/* Zero every count and cycle total */
+void x86StatsReset(X86_CPU* cpu);
+
+/* Read the host timestamp counter around every interpreted instruction. Translated blocks are counted but not timed */
+void x86StatsSampleCycles(X86_CPU* cpu, int enable);
+
+/* Get the X86_STATS_INDEX of a decoded instruction */
+uint16_t x86StatsGetIndex(X86_INSTRUCTION* instr);
+
+/* Add the runs of a translated block to the counts of its instructions */
+void x86StatsAddBlock(X86_CPU* cpu, X86_BLOCK* block);
+
+/* Add the runs of every translated block, so cpu->stats.count is current */
+void x86StatsCollect(X86_CPU* cpu);
+
+/* Host timestamp counter; 0 on hosts without one */
+uint64_t x86StatsReadTsc();
+
+/* Print the max_entries opcode map entries executed the most, with their share of the instructions executed and the
+   mean host cycles of their handler when cycles were sampled */
+void x86StatsDump(X86_CPU* cpu, uint32_t max_entries);
+
+#endif
@@ -0,0 +1,34 @@
+// cpu_tlb.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_TLB_H
+#define _CPU_TLB_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define X86_TLB_PAGE_SIZE (1 << X86_TLB_PAGE_SHIFT)
+#define X86_TLB_INVALID 1 // no page aligned address matches this tag
+#define X86_TLB_INDEX(address) (((address) >> X86_TLB_PAGE_SHIFT) & (X86_TLB_SIZE - 1))
+#define X86_TLB_TAG(address) ((address) & ~(X86_TLB_PAGE_SIZE - 1))
+
+typedef enum _X86_TLB_ACCESS {
+	X86_TLB_READ,
+	X86_TLB_WRITE,
+	X86_TLB_FETCH,
+} X86_TLB_ACCESS;
+
+/* Drop every entry. Needed when the linear to host mapping changes */
+void x86TlbFlush(X86_CPU* cpu);
+
+/* Drop the entries of the page that holds the linear address */
+void x86TlbFlushPage(X86_CPU* cpu, uint32_t address);
+
+/* Look up the host pointer of a linear address and fill the entry for the access when the page can be mapped.
+   returns NULL if the page is not host memory the access is allowed on */
+void* x86TlbFill(X86_CPU* cpu, uint32_t address, X86_TLB_ACCESS access);
+
+#endif
@@ -0,0 +1,38 @@
+// cpu_trace.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _CPU_TRACE_H
+#define _CPU_TRACE_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* trace file; a header then X86_TRACE_RECORDs until the end of the file */
+#define X86_TRACE_MAGIC 0x54455845 // "EXET"
+#define X86_TRACE_VERSION 1
+
+typedef struct _X86_TRACE_HEADER {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size; // sizeof(X86_TRACE_RECORD)
+} X86_TRACE_HEADER;
+
+/* Start writing a record of every instruction executed to filename. A writer thread drains the records to the file
+   while the cpu runs; the cpu waits for it when it falls a whole ring behind. returns 0 on success */
+int x86TraceStart(X86_CPU* cpu, const char* filename);
+
+/* Write the records still in the ring, end the writer thread and close the file. returns 0 if every record was
+   written */
+int x86TraceStop(X86_CPU* cpu);
+
+/* Called by x86CPUExecute around each instruction while a trace is active */
+void x86TraceBegin(X86_CPU* cpu, X86_INSTRUCTION* instr);
+void x86TraceEnd(X86_CPU* cpu, int executed);
+
+/* Called by the memory writes while a trace is active; the first write of the instruction goes in its record */
+void x86TraceWrite(X86_CPU* cpu, uint32_t address, uint32_t size, uint32_t value);
+
+#endif
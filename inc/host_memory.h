@@ -0,0 +1,31 @@
+// host_memory.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _HOST_MEMORY_H
+#define _HOST_MEMORY_H
+
+#include <stdint.h>
+
+/* Every allocation has HOST_MEMORY_TAIL bytes past its end, so an access that starts in the
+   last bytes of guest memory and runs past the end reads zero instead of faulting */
+#define HOST_MEMORY_TAIL 0x1000
+
+/* Reserve size bytes of demand-zero host memory. pages use no memory until they are touched */
+void* hostAllocMemory(uint32_t size);
+void hostFreeMemory(void* ptr, uint32_t size);
+
+/* Return the pages to the host; they read as zero again */
+void hostDiscardMemory(void* ptr, uint32_t size);
+
+/* Replace the size bytes at ptr with repeated views of one section that holds the image_size bytes at ptr,
+   so every view shares the same pages. The last view is copy-on-write; writes to it are not seen by the
+   other views. image_size must be a power of 2 that divides size. returns 0 on success, leaving ptr as it
+   was on failure */
+int hostMapMirrors(void* ptr, uint32_t image_size, uint32_t size, intptr_t* section);
+
+/* Replace the views with demand-zero memory and close the section */
+void hostUnmapMirrors(void* ptr, uint32_t image_size, uint32_t size, intptr_t section);
+
+#endif
@@ -0,0 +1,42 @@
+// host_perf.h
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef _HOST_PERF_H
+#define _HOST_PERF_H
+
+#include <stdint.h>
+
+/* Host hardware counters */
+enum {
+	HOST_PERF_CYCLES,
+	HOST_PERF_INSTRUCTIONS,
+	HOST_PERF_BRANCH_MISSES,
+	HOST_PERF_L1D_MISSES,
+	HOST_PERF_LLC_MISSES,
+	HOST_PERF_DTLB_MISSES,
+	HOST_PERF_COUNTER_COUNT
+};
+
+typedef struct _HOST_PERF {
+	int fd[HOST_PERF_COUNTER_COUNT]; // -1 when the host does not have the counter
+	uint64_t value[HOST_PERF_COUNTER_COUNT]; // counts of the last start to stop; scaled up when the counter was shared
+	int open; // at least one counter is open
+} HOST_PERF;
+
+/* Open the counters for this thread, user mode only. Counters the host does not have are left out. Linux only; on
+   other hosts no counter opens. returns 0 if at least one counter opened */
+int hostPerfOpen(HOST_PERF* perf);
+void hostPerfClose(HOST_PERF* perf);
+
+/* Zero the counters and start counting */
+void hostPerfStart(HOST_PERF* perf);
+
+/* Stop counting and read the counters into perf->value */
+void hostPerfStop(HOST_PERF* perf);
+
+/* Print the counters, each per guest instruction, and the host instructions per cycle */
+void hostPerfPrint(HOST_PERF* perf, uint64_t guest_instructions);
+
+#endif
@@ -11,11 +11,6 @@
 
 #define CPU_INPUT
 
-typedef struct _BREAKPOINT {
-	bool set;
-	uint32_t address;
-} BREAKPOINT;
-
 int input_loop(); // input.c
 
 #endif
@@ -5,68 +5,129 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "cpu.h"
 #include "cpu_instruction.h"
 #include "cpu_memory.h"
 #include "cpu_sib.h"
+#include "cpu_cache.h"
+#include "cpu_tlb.h"
+#include "cpu_bus.h"
+#include "cpu_io.h"
+#include "cpu_event.h"
+#include "cpu_trace.h"
+#include "cpu_stats.h"
+#include "cpu_profile.h"
+#include "cpu_callstack.h"
+#include "host_memory.h"
+#include "cpu_jit.h"
 
 #include "type_defs.h"
 #include "mem_tracking.h"
 
 void error_out(X86_CPU* cpu, uint32_t counter)
 {
+	uint32_t offset = 0;
 	for (uint32_t i = 0; i < counter; ++i) {
-		sprintf(cpu->output_str + (i * 3), "%02X ", cpu->eip_ptr[i]);
+		sprintf(cpu->output_str + (i * 3), "%02X ", x86CPUFetchByte(cpu, &offset));
 	}
 }
 
 /*MEMORY*/
 int x86InitMemory(X86_MEMORY* mem, uint32_t rom_base, uint32_t rom_end, uint32_t ram_base, uint32_t ram_end) 
 {
-	// ram
 	mem->ram_base = ram_base;
 	mem->ram_end = ram_end;
 	mem->ram_size = (ram_end - ram_base + 1);
-	mem->ram = (BYTE*)malloc(mem->ram_size);
-
-	// rom
 	mem->rom_base = rom_base;
 	mem->rom_end = rom_end;
 	mem->rom_size = (rom_end - rom_base + 1);
-	mem->rom = (BYTE*)malloc(mem->rom_size);
+	mem->rom_image_size = 0;
+	mem->rom_section = 0;
+
+	// ram; demand-zero so only the pages the guest touches are backed.
+	mem->ram = (BYTE*)hostAllocMemory(mem->ram_size);
 
-	if (mem->ram == NULL || mem->rom == NULL)
+	// rom; demand-zero so the pages of a large window cost nothing until they are loaded.
+	mem->rom = (BYTE*)hostAllocMemory(mem->rom_size);
+
+	// accesses outside ram and rom.
+	mem->open_read = (BYTE*)hostAllocMemory(X86_TLB_PAGE_SIZE);
+
+	if (mem->ram == NULL || mem->rom == NULL || mem->open_read == NULL)
 		return 1;
 
 	return 0;
 }
+static void unmap_rom_mirrors(X86_MEMORY* mem)
+{
+	// the window reads as zero again.
+	hostUnmapMirrors(mem->rom, mem->rom_image_size, mem->rom_size, mem->rom_section);
+	mem->rom_image_size = 0;
+	mem->rom_section = 0;
+}
 int x86ClearMemory(X86_MEMORY* mem) 
 {
 	// ram
 	if (mem->ram != NULL)
-		memset(mem->ram, 0, mem->ram_size);
+		hostDiscardMemory(mem->ram, mem->ram_size);
 
 	// rom
-	if (mem->rom != NULL)
-		memset(mem->rom, 0, mem->rom_size);
+	if (mem->rom_image_size != 0) {
+		unmap_rom_mirrors(mem);
+	}
+	else if (mem->rom != NULL) {
+		hostDiscardMemory(mem->rom, mem->rom_size);
+	}
 
 	return 0;
 }
 int x86FreeMemory(X86_MEMORY* mem) 
 {
-	// ram
+	if (mem->rom_image_size != 0)
+		unmap_rom_mirrors(mem);
+
 	if (mem->ram != NULL) {
-		free(mem->ram);
+		hostFreeMemory(mem->ram, mem->ram_size);
 		mem->ram = NULL;
 	}
-
-	// rom
 	if (mem->rom != NULL) {
-		free(mem->rom);
+		hostFreeMemory(mem->rom, mem->rom_size);
 		mem->rom = NULL;
 	}
+	if (mem->open_read != NULL) {
+		hostFreeMemory(mem->open_read, X86_TLB_PAGE_SIZE);
+		mem->open_read = NULL;
+	}
+
+	return 0;
+}
+int x86CPUMirrorRom(X86_CPU* cpu, uint32_t image_size)
+{
+	X86_MEMORY* mem = &cpu->mem;
+	intptr_t section = 0;
+	uint32_t offset;
+
+	if (mem->rom == NULL || mem->rom_image_size != 0 || image_size == 0)
+		return 1;
+	if (image_size >= mem->rom_size)
+		return 0; // nothing to mirror
+
+	if ((image_size & (image_size - 1)) == 0 && mem->rom_size % image_size == 0 && hostMapMirrors(mem->rom, image_size, mem->rom_size, &section) == 0) {
+		mem->rom_image_size = image_size;
+		mem->rom_section = section;
+	}
+	else {
+		// the mirrors can not share pages; copy the image, doubling the copied part each pass.
+		for (offset = image_size; offset < mem->rom_size && offset * 2 > offset && offset * 2 <= mem->rom_size; offset *= 2) {
+			memcpy(mem->rom + offset, mem->rom, offset);
+		}
+	}
 
+	// the mirrors changed under the decoded code.
+	x86CPUFlushDecodeCache(cpu);
 	return 0;
 }
 
@@ -77,35 +138,31 @@ int x86ResetCPU(X86_CPU* cpu)
 	for (i = 0; i < X86_GENERAL_REGISTER_COUNT; ++i) {
 		cpu->registers[i].r32 = 0;
 	}
+	cpu->mode = CPU_REAL_MODE;
 	for (i = 0; i < X86_SEGMENT_REGISTER_COUNT; ++i) {
-		cpu->segment_registers[i] = 0;
-		cpu->segment_descriptors[i].base = 0;
-		cpu->segment_descriptors[i].limit = 0;
-		cpu->segment_descriptors[i].access = 0;
-		cpu->segment_descriptors[i].flags = 0;
+		memset(&cpu->segment_descriptors[i], 0, sizeof(X86_SEGMENT_DESCRIPTOR));
+		x86CPULoadSegment(cpu, i, 0);
 	}
 	for (i = 0; i < X86_CONTROL_REGISTER_COUNT; ++i) {
 		cpu->control_registers[i] = 0;
 	}
 
 	x86InitEflags(&cpu->eflags);
+	x86InitLazyFlags(&cpu->lazy_flags);
 
-	cpu->mode = CPU_REAL_MODE;
-	cpu->segment_descriptors[SEG_CS].base = 0xf000;
-	cpu->segment_descriptors[SEG_CS].limit = 0xf000;
-	cpu->segment_registers[SEG_CS] = 0;
+	x86CPULoadSegment(cpu, SEG_CS, 0xf000);
 	cpu->eip = 0xfff0;
 	cpu->eip_ptr = NULL;
 
 	// global descriptor table
 	cpu->gdtr.base = 0;
 	cpu->gdtr.limit = 0xFFFF;
-	cpu->gdt = (uint64_t*)cpu->mem.ram;
+	cpu->gdt = (const uint64_t*)cpu->mem.ram;
 
 	// interrupt descriptor table
 	cpu->idtr.base = 0;
 	cpu->idtr.limit = 0xFFFF;
-	cpu->idt = (uint64_t*)cpu->mem.ram;
+	cpu->idt = (const uint64_t*)cpu->mem.ram;
 
 	// local descriptor table
 	cpu->ldtr.base = 0;
@@ -117,6 +174,9 @@ int x86ResetCPU(X86_CPU* cpu)
 	memset(cpu->output_str, 0, sizeof(cpu->output_str));
 	memset(cpu->addressing_str, 0, sizeof(cpu->addressing_str));
 
+	x86TlbFlush(cpu);
+	x86CPUFlushDecodeCache(cpu);
+
 	return 0;
 }
 int x86InitCPU(X86_CPU* cpu, uint32_t rom_base, uint32_t rom_end, uint32_t ram_base, uint32_t ram_end)
@@ -124,8 +184,32 @@ int x86InitCPU(X86_CPU* cpu, uint32_t rom_base, uint32_t rom_end, uint32_t ram_b
 	if (x86InitMemory(&cpu->mem, rom_base, rom_end, ram_base, ram_end) != 0)
 		return 1;
 
+	if (x86InitBus(cpu) != 0)
+		return 1;
+
+	if (x86InitIo(cpu) != 0)
+		return 1;
+
+	if (x86InitDecodeCache(cpu) != 0)
+		return 1;
+
+	if (x86InitJit(cpu) != 0)
+		return 1;
+
+	if (x86InitStats(cpu) != 0)
+		return 1;
+
+	x86InitEvents(cpu);
+
 	x86ClearMemory(&cpu->mem);
 
+	cpu->stop_mask = 0;
+	cpu->run_end = UINT64_MAX;
+	cpu->breakpoint_count = 0;
+	memset(&cpu->profile, 0, sizeof(X86_PROFILE));
+	memset(&cpu->calls, 0, sizeof(X86_CALL_STACK));
+	memset(&cpu->trace, 0, sizeof(X86_TRACE));
+
 	x86ResetCPU(cpu);
 
 	return 0;
@@ -133,6 +217,14 @@ int x86InitCPU(X86_CPU* cpu, uint32_t rom_base, uint32_t rom_end, uint32_t ram_b
 int x86FreeCPU(X86_CPU* cpu) 
 {
 	x86ResetCPU(cpu);
+	x86TraceStop(cpu);
+	x86FreeProfile(cpu);
+	x86FreeCallStack(cpu);
+	x86FreeStats(cpu);
+	x86FreeJit(cpu);
+	x86FreeDecodeCache(cpu);
+	x86FreeIo(cpu);
+	x86FreeBus(cpu);
 	x86FreeMemory(&cpu->mem);
 	return 0;
 }
@@ -187,22 +279,16 @@ void x86CPUSetRegister(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32
 
 void set_memory_value(X86_CPU* cpu, uint32_t address, uint32_t operand_size, uint32_t value)
 {
-	if (address > cpu->mem.rom_base) {
-		return;
-	}
-	void* ptr = x86GetCPUMemoryPtr(cpu, address);
-
-	if (ptr == NULL)
-		return;
-
+	// the bus drops writes to rom.
 	switch (operand_size) {
 		case 1:
-			*(uint8_t*)ptr = (uint8_t)value;
+			x86CPUWriteByte(cpu, address, (BYTE)value);
+			break;
 		case 2:
-			*(uint16_t*)ptr = (uint16_t)value;
+			x86CPUWriteWord(cpu, address, (WORD)value);
 			break;
 		case 4:
-			*(uint32_t*)ptr = (uint32_t)value;
+			x86CPUWriteDword(cpu, address, (DWORD)value);
 			break;
 	}
 }
@@ -213,15 +299,60 @@ void x86CPULoadSegmentDescriptor(X86_CPU* cpu, uint16_t selector, X86_SEGMENT_DE
 	uint64_t value = cpu->gdt[index];
 
 	descriptor->base = ((value >> 16) & 0xFFFFFF) + ((value >> 56) << 24);
-	descriptor->limit = (value & 0xFFFF) + ((value >> 48) & 0xF0000);
+	descriptor->limit = (value & 0xFFFF) + ((value >> 32) & 0xF0000);
 	descriptor->access = (value >> 40) & 0xFF;
 	descriptor->flags = (value >> 52) & 0xF;
 	descriptor->default_size = (value >> 54) & 0b1;
+
+	// the limit is in 4KB units when the granularity bit is set.
+	if (descriptor->flags & 0b1000)
+		descriptor->limit = (descriptor->limit << 12) | 0xFFF;
+}
+void x86CPULoadSegment(X86_CPU* cpu, uint32_t segment, uint16_t selector)
+{
+	X86_SEGMENT_DESCRIPTOR* descriptor = &cpu->segment_descriptors[segment];
+
+	cpu->segment_registers[segment] = selector;
+
+	if (cpu->mode == CPU_REAL_MODE) {
+		// real mode addresses are in the top 1MB of the address space, where the rom is.
+		descriptor->base = (cpu->mem.rom_end - 0xFFFFF) + ((uint32_t)selector << 4);
+		descriptor->limit = 0xFFFF;
+		descriptor->default_size = 0;
+	}
+	else {
+		x86CPULoadSegmentDescriptor(cpu, selector, descriptor);
+	}
+
+	x86CPUUpdateMode(cpu);
+}
+
+void x86CPUUpdateMode(X86_CPU* cpu)
+{
+	X86_SEGMENT_DESCRIPTOR* cs = &cpu->segment_descriptors[SEG_CS];
+	X86_SEGMENT_DESCRIPTOR* descriptor;
+	int i;
+
+	cpu->code_key = X86_CODE_KEY(cpu->mode, cs->default_size & 1);
+	cpu->fetch_window.size = 0;
+
+	// the descriptors keep their base across a mode switch until the segment is loaded again; only the offset size changes.
+	for (i = 0; i < X86_SEGMENT_REGISTER_COUNT; ++i) {
+		descriptor = &cpu->segment_descriptors[i];
+		if (cpu->mode == CPU_REAL_MODE) {
+			descriptor->mask = 0xFFFF;
+			descriptor->flat = 0;
+		}
+		else {
+			descriptor->mask = 0xFFFFFFFF;
+			descriptor->flat = (descriptor->base == 0 && descriptor->limit == 0xFFFFFFFF);
+		}
+	}
 }
 
-int lldt(X86_CPU* cpu, uint32_t address, uint32_t counter) {
+int lldt(X86_CPU* cpu, uint32_t address) {
 	// Load the LDT register
-	uint16_t selector = *(uint16_t*)x86GetCPUMemoryPtr(cpu, address);
+	uint16_t selector = *(const uint16_t*)x86GetCPUMemoryPtr(cpu, address);
 
 	// Load the source operand into the segment selector field of the local descriptor table register (LDTR)
 	cpu->ldtr.selector = selector;
@@ -239,122 +370,100 @@ int lldt(X86_CPU* cpu, uint32_t address, uint32_t counter) {
 
 /* opcodes */
 
-int move_imm_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int move_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// mov reg, imm8
-	uint32_t imm = x86CPUFetchMemory(cpu, operand_size, &counter);
-	x86CPUSetRegister(cpu, reg, operand_size, imm);
-	cpu->eip += counter;	
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, instr->imm);
+	cpu->eip += instr->length;	
 	return 0;
 }
-int move_ptr_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int move_ptr_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// mov reg, [address]
-	uint32_t address = x86CPUFetchMemory(cpu, operand_size, &counter);
-	uint32_t value = x86CPUReadMemory(cpu, address, operand_size);
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;	
+	uint32_t value = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, instr->imm), instr->operand_size);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;	
 	return 0;
 }
-int inc_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int inc_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// inc reg
-	uint32_t v = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_INC, v, 1, operand_size, &v);
-	x86CPUSetRegister(cpu, reg, operand_size, v);
-	cpu->eip += counter;
+	uint32_t v = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_INC, v, 1, instr->operand_size, &v);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, v);
+	cpu->eip += instr->length;
 	return 0;
 }
-int dec_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int dec_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// dec reg
-	uint32_t v = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_DEC, v, 1, operand_size, &v);
-	x86CPUSetRegister(cpu, reg, operand_size, v);
-	cpu->eip += counter;
+	uint32_t v = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_DEC, v, 1, instr->operand_size, &v);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, v);
+	cpu->eip += instr->length;
 	return 0;
 }
-int shr_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int shr_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// shr reg, imm
-	BYTE imm8 = x86CPUFetchByte(cpu, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	value = value >> imm8;
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	value = value >> (BYTE)instr->imm;
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int shl_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int shl_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// shl reg, imm
-	BYTE imm8 = x86CPUFetchByte(cpu, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	value = value << imm8;
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	value = value << (BYTE)instr->imm;
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int cld(X86_CPU* cpu, uint32_t counter)
+int cld(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// clear direction flag
 	cpu->eflags.DF = 0;
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int std(X86_CPU* cpu, uint32_t counter)
+int std(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// set direction flag
 	cpu->eflags.DF = 1;
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int cli(X86_CPU* cpu, uint32_t counter)
+int cli(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// clear interrupt flag
 	cpu->eflags.IF = 0;
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int sti(X86_CPU* cpu, uint32_t counter)
+int sti(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// set interrupt flag
 	cpu->eflags.IF = 1;
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int hlt(X86_CPU* cpu, uint32_t counter)
+int hlt(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// hlt
 	cpu->hlt = 1;
-	cpu->eip += counter;	
+	cpu->eip += instr->length;	
 	return 0;
 }
-int jmp_imm_rel(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int jmp_imm_rel(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	int offset = 0;
-	switch (operand_size) {
-		case 1:
-			offset = (signed char)x86CPUFetchByte(cpu, &counter);
-			break;
-		case 2:
-			offset = (short)x86CPUFetchWord(cpu, &counter);
-			break;
-		case 4:
-			offset = (int)x86CPUFetchDword(cpu, &counter); 
-			break;
-	}
-	cpu->eip += counter + offset;
+	cpu->eip += instr->length + (int)instr->imm;
 	return 0;
 }
-int jmp_far(X86_CPU* cpu, uint32_t counter)
+int jmp_far(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	uint32_t address = x86CPUFetchDword(cpu, &counter);
-	uint16_t selector = x86CPUFetchWord(cpu, &counter);
-
-	cpu->eip = address;
-
-	/* update CS register and reload segment descriptor */
-	x86CPULoadSegmentDescriptor(cpu, selector, &cpu->segment_descriptors[SEG_CS]);
+	cpu->eip = instr->imm;
 
 	/* update mode */
 	switch (cpu->mode) {
@@ -371,91 +480,113 @@ int jmp_far(X86_CPU* cpu, uint32_t counter)
 			}
 			break;
 	}
+
+	/* update CS register and reload segment descriptor */
+	x86CPULoadSegment(cpu, SEG_CS, instr->selector);
+
+	if (cpu->calls.active)
+		x86CallStackFarJump(cpu);
 	return 0;
 }
-int jcc(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, uint32_t counter)
+int call_rel(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	// jump condition
+	// CALL rel16/32
+	uint32_t operand_size = instr->operand_size;
+	uint32_t mask = operand_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint32_t esp = x86CPUGetRegister(cpu, REG_ESP, operand_size);
+	uint32_t return_address = (cpu->eip + instr->length) & mask;
+	x86CPUSetRegister(cpu, REG_ESP, operand_size, esp - operand_size);
+	set_memory_value(cpu, x86GetLinearAddress(cpu, SEG_SS, esp - operand_size), operand_size, return_address);
+	cpu->eip = (return_address + (int)instr->imm) & mask;
 
-	X86_EFLAGS eflags = cpu->eflags;
-	int offset = 0;
+	if (cpu->calls.active)
+		x86CallStackCall(cpu, x86GetEffectiveAddress(cpu, return_address));
+	return 0;
+}
+int ret_near(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// RET, RET imm16; imm is the bytes of arguments to pop after the return address.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t esp = x86CPUGetRegister(cpu, REG_ESP, operand_size);
+	cpu->eip = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, SEG_SS, esp), operand_size);
+	x86CPUSetRegister(cpu, REG_ESP, operand_size, esp + operand_size + instr->imm);
 
-	switch (operand_size) {
-		case 1:
-			offset = (signed char)x86CPUFetchByte(cpu, &counter);
-			break;
-		case 2:
-			offset = (short)x86CPUFetchWord(cpu, &counter);
-			break;
-		case 4:
-			offset = (int)x86CPUFetchDword(cpu, &counter);
-			break;
-	}
+	if (cpu->calls.active)
+		x86CallStackReturn(cpu);
+	return 0;
+}
+int jcc(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// jump condition
+
+	X86_LAZY_FLAGS* flags = &cpu->lazy_flags; // only the flags a condition tests are computed
+	uint32_t counter = instr->length;
+	int offset = (int)instr->imm;
 	
 	// last 4 bits of the opcode are the conditional test.
-	switch (opcode & 0x0f) {
+	switch (instr->opcode.byte & 0x0f) {
 		case CONDITIONAL_TEST_OVERFLOW:
-			if (eflags.OF == 1)
+			if (x86AluOF(flags) == 1)
 				counter += offset;			
 			break;
 		case CONDITIONAL_TEST_NO_OVERFLOW:
-			if (eflags.OF == 0)
+			if (x86AluOF(flags) == 0)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_CARRY:
-			if (eflags.CF == 1)
+			if (flags->CF == 1)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_NOT_CARRY:
-			if (eflags.CF == 0)
+			if (flags->CF == 0)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_EQUAL_ZERO:
-			if (eflags.ZF == 1)
+			if (x86AluZF(flags) == 1)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_NOT_EQUAL_ZERO:
-			if (eflags.ZF == 0)
+			if (x86AluZF(flags) == 0)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_BELOW_OR_EQUAL:
-			if (eflags.CF == 1 || eflags.ZF == 1)
+			if (flags->CF == 1 || x86AluZF(flags) == 1)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_ABOVE:
-			if (eflags.CF == 0 && eflags.ZF == 0)
+			if (flags->CF == 0 && x86AluZF(flags) == 0)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_SIGN:
-			if (eflags.SF == 1)
+			if (x86AluSF(flags) == 1)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_NOT_SIGN:
-			if (eflags.SF == 0)
+			if (x86AluSF(flags) == 0)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_PARITY:
-			if (eflags.PF == 1)
+			if (x86AluPF(flags) == 1)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_NOT_PARITY:
-			if (eflags.PF == 0)
+			if (x86AluPF(flags) == 0)
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_LESS:
-			if (eflags.SF != eflags.OF)
+			if (x86AluSF(flags) != x86AluOF(flags))
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_NOT_LESS:
-			if (eflags.SF == eflags.OF)
+			if (x86AluSF(flags) == x86AluOF(flags))
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_LESS_OR_EQUAL:
-			if (eflags.ZF == 1 || eflags.SF != eflags.OF)
+			if (x86AluZF(flags) == 1 || x86AluSF(flags) != x86AluOF(flags))
 				counter += offset;
 			break;
 		case CONDITIONAL_TEST_NOT_LESS_OR_EQUAL:
-			if (eflags.ZF == 0 && eflags.SF == eflags.OF)
+			if (x86AluZF(flags) == 0 && x86AluSF(flags) == x86AluOF(flags))
 				counter += offset;
 			break;
 	}
@@ -463,182 +594,184 @@ int jcc(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, uint32_t counter)
 	cpu->eip += counter;
 	return 0;
 }
-int cmp_imm_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int cmp_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// cmp value in reg to imm
-	uint32_t imm = x86CPUFetchMemory(cpu, operand_size, &counter);
-	uint32_t reg_v = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_CMP, imm, reg_v, operand_size, NULL);
-	cpu->eip += counter;	
+	uint32_t reg_v = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_CMP, instr->imm, reg_v, instr->operand_size, NULL);
+	cpu->eip += instr->length;	
+	return 0;
+}
+int io_event(X86_CPU* cpu, uint16_t port, uint32_t operand_size, int write, uint32_t value)
+{
+	// record the port access; end the run if the caller asked to stop on I/O.
+	cpu->exit.port = port;
+	cpu->exit.port_size = operand_size;
+	cpu->exit.port_write = write;
+	cpu->exit.port_value = value;
+	if (cpu->stop_mask & X86_CPU_STOP_IO)
+		return X86_CPU_ERROR_IO;
 	return 0;
 }
-int in_byte_reg(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int in_byte_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// input byte/word/dword from I/O port in DX into AL/AX/EAX.
 	WORD address = (WORD)x86CPUGetRegister(cpu, REG_DX, 2);
-	uint32_t value = x86CPUGetIOByte(cpu, address);
-	x86CPUSetRegister(cpu, REG_EAX, operand_size, value);
-	cpu->eip += counter;
-	return 0;
+	uint32_t value = x86IoRead(cpu, address, instr->operand_size);
+	x86CPUSetRegister(cpu, REG_EAX, instr->operand_size, value);
+	cpu->eip += instr->length;
+	return io_event(cpu, address, instr->operand_size, 0, value);
 }
-int out_byte_reg(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int out_byte_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// output byte/word/dword in AL/AX/EAX to I/O port address in DX.
 	WORD address = (WORD)x86CPUGetRegister(cpu, REG_DX, 2);
-	uint32_t value = x86CPUGetRegister(cpu, REG_EAX, operand_size);
-	x86CPUSetIOByte(cpu, operand_size, address, value);
-	cpu->eip += counter;	
-	return 0;
+	uint32_t value = x86CPUGetRegister(cpu, REG_EAX, instr->operand_size);
+	x86IoWrite(cpu, address, instr->operand_size, value);
+	cpu->eip += instr->length;	
+	return io_event(cpu, address, instr->operand_size, 1, value);
 }
-int in_byte_imm(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int in_byte_imm(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// input byte/word/dword from imm8 I/O port address into AL/AX/EAX
-	BYTE imm = x86CPUFetchByte(cpu, &counter);
-	uint32_t value = x86CPUGetIOByte(cpu, imm);
-	x86CPUSetRegister(cpu, REG_EAX, operand_size, value);
-	cpu->eip += counter;	
-	return 0;
+	uint32_t value = x86IoRead(cpu, (BYTE)instr->imm, instr->operand_size);
+	x86CPUSetRegister(cpu, REG_EAX, instr->operand_size, value);
+	cpu->eip += instr->length;	
+	return io_event(cpu, (BYTE)instr->imm, instr->operand_size, 0, value);
 }
-int out_byte_imm(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int out_byte_imm(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// output byte/word/dword in AL/AX/EAX to I/O port address imm8.
-	BYTE imm = x86CPUFetchByte(cpu, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, REG_EAX, operand_size);
-	x86CPUSetIOByte(cpu, operand_size, imm, value);
-	cpu->eip += counter;
-	return 0;
+	uint32_t value = x86CPUGetRegister(cpu, REG_EAX, instr->operand_size);
+	x86IoWrite(cpu, (BYTE)instr->imm, instr->operand_size, value);
+	cpu->eip += instr->length;
+	return io_event(cpu, (BYTE)instr->imm, instr->operand_size, 1, value);
 }
-int movzx(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t src_size, uint32_t dest_size, uint32_t counter)
+int movzx(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// B6 MOVZX r16, r/m8
 	// B6 MOVZX r32, r/m8
 	// B7 MOVZX r32, r/m16
 
-	uint32_t value = x86CPUGetRegister(cpu, mode->rm, src_size);
-	x86CPUSetRegister(cpu, mode->reg, dest_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->mode.bits.rm, instr->src_size);
+	x86CPUSetRegister(cpu, instr->mode.bits.reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int movsx(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t src_size, uint32_t dest_size, uint32_t counter)
+int movsx(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// BE MOVSX r16, r/m8
 	// BE MOVSX r32, r/m8
 	// BF MOVSX r32, r/m16
 
-	int32_t value = x86CPUGetRegisterSigned(cpu, mode->rm, src_size);
-	x86CPUSetRegister(cpu, mode->reg, dest_size, value);
-	cpu->eip += counter;
+	int32_t value = x86CPUGetRegisterSigned(cpu, instr->mode.bits.rm, instr->src_size);
+	x86CPUSetRegister(cpu, instr->mode.bits.reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int and_imm_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int and_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// logical AND reg imm
-	uint32_t imm = x86CPUFetchMemory(cpu, operand_size, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_AND, value, imm, operand_size, &value);
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_AND, value, instr->imm, instr->operand_size, &value);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int or_imm_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int or_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// logical OR reg imm
-	uint32_t imm = x86CPUFetchMemory(cpu, operand_size, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_OR, value, imm, operand_size, &value);
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_OR, value, instr->imm, instr->operand_size, &value);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int add_imm_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int add_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// add reg imm
-	uint32_t imm = x86CPUFetchMemory(cpu, operand_size, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_ADD, value, imm, operand_size, &value);
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_ADD, value, instr->imm, instr->operand_size, &value);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int sub_imm_reg(X86_CPU* cpu, uint32_t reg, uint32_t operand_size, uint32_t counter)
+int sub_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// sub reg imm
-	uint32_t imm = x86CPUFetchMemory(cpu, operand_size, &counter);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	x86Alu(&cpu->eflags, INSTRUCTION_TYPE_SUB, value, imm, operand_size, &value);
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	cpu->eip += counter;
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, instr->operand_size);
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_SUB, value, instr->imm, instr->operand_size, &value);
+	x86CPUSetRegister(cpu, instr->reg, instr->operand_size, value);
+	cpu->eip += instr->length;
 	return 0;
 }
-int lgdt(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t address_size, uint32_t operand_size, BYTE segment_override_byte, uint32_t counter) {
+int lgdt(X86_CPU* cpu, X86_INSTRUCTION* instr) {
 	// Load the GDT register
 
 	ADDRESSING_MODE_FIELD_STRUCT am = { 0 };//uint32_t address;
-	get_addressing_mode(cpu, mode, address_size, operand_size, &am, &counter);
-
-	uint8_t* descriptor = (uint8_t*)x86GetCPUMemoryPtr(cpu, am.address);
+	get_addressing_mode(cpu, instr, instr->operand_size, &am);
 
 	// load the values in the source operand into the global descriptor table register (GDTR) 
 
-	cpu->gdtr.limit = *(uint16_t*)descriptor;
-	cpu->gdtr.base = *(uint32_t*)(descriptor + 2);
-	if (operand_size == 2)
+	cpu->gdtr.limit = x86CPUReadWord(cpu, am.address);
+	cpu->gdtr.base = x86CPUReadDword(cpu, am.address + 2);
+	if (instr->operand_size == 2)
 		cpu->gdtr.base &= 0x00FFFFFF;
-	cpu->gdt = (uint64_t*)x86GetCPUMemoryPtr(cpu, cpu->gdtr.base);
+	cpu->gdt = (const uint64_t*)x86GetCPUMemoryPtr(cpu, cpu->gdtr.base);
 
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int lidt(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t address_size, uint32_t operand_size, BYTE segment_override_byte, uint32_t counter) {
+int lidt(X86_CPU* cpu, X86_INSTRUCTION* instr) {
 	// Load the IDT register
 
 	ADDRESSING_MODE_FIELD_STRUCT am = { 0 };//uint32_t address;
-	get_addressing_mode(cpu, mode, address_size, operand_size, &am, &counter);
-
-	uint8_t* descriptor = (uint8_t*)x86GetCPUMemoryPtr(cpu, am.address);
+	get_addressing_mode(cpu, instr, instr->operand_size, &am);
 
 	// load the values in the source operand into the interrupt descriptor table register (IDTR).
 
-	cpu->idtr.limit = *(uint16_t*)descriptor;
-	cpu->idtr.base = *(uint32_t*)(descriptor + 2);
-	if (operand_size == 2)
+	cpu->idtr.limit = x86CPUReadWord(cpu, am.address);
+	cpu->idtr.base = x86CPUReadDword(cpu, am.address + 2);
+	if (instr->operand_size == 2)
 		cpu->idtr.base &= 0x00FFFFFF;
-	cpu->idt = (uint64_t*)x86GetCPUMemoryPtr(cpu, cpu->idtr.base);
-	cpu->eip += counter;
+	cpu->idt = (const uint64_t*)x86GetCPUMemoryPtr(cpu, cpu->idtr.base);
+	cpu->eip += instr->length;
 
 	return 0;
 }
-int lldt_imm(X86_CPU* cpu, uint32_t counter) {
+int lldt_imm(X86_CPU* cpu, X86_INSTRUCTION* instr) {
 	// Load the LDT register
-	uint32_t address = x86CPUFetchMemory(cpu, 2, &counter);
-	lldt(cpu, address, counter);	
-	cpu->eip += counter;
+	lldt(cpu, instr->imm);	
+	cpu->eip += instr->length;
 	return 0;
 }
-int lldt_reg(X86_CPU* cpu, uint32_t reg, uint32_t counter) {
+int lldt_reg(X86_CPU* cpu, X86_INSTRUCTION* instr) {
 	// Load the LDT register
-	uint32_t address = x86CPUGetRegister(cpu, reg, 2);
-	lldt(cpu, address, counter);	
-	cpu->eip += counter;
+	uint32_t address = x86CPUGetRegister(cpu, instr->mode.bits.rm, 2);
+	lldt(cpu, address);	
+	cpu->eip += instr->length;
 	return 0;
 }
-int mov_seg_r32(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t counter)
+int mov_seg_r32(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// MOV seg, r32
 
-	uint8_t sreg = mode->reg;
-	uint8_t reg = mode->rm;
+	uint8_t sreg = instr->mode.bits.reg;
+	uint8_t reg = instr->mode.bits.rm;
 	uint32_t selector = x86CPUGetRegister(cpu, reg, 4);
 
-	cpu->segment_registers[sreg] = selector;
-	x86CPULoadSegmentDescriptor(cpu, selector, &cpu->segment_descriptors[sreg]);
-	cpu->eip += counter;
+	if (sreg >= X86_SEGMENT_REGISTER_COUNT)
+		return X86_CPU_ERROR_UD;
+
+	x86CPULoadSegment(cpu, sreg, selector);
+	cpu->eip += instr->length;
 	return 0;
 }
-int mov_cr_r32(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t counter)
+int mov_cr_r32(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// MOV cr0-7, r32
 
+	X86_MOD_RM_BITS* mode = &instr->mode.bits;
 	if (mode->rm == 1 || mode->rm == 5 ||
 		mode->rm == 6 || mode->rm == 7) {
 		return X86_CPU_ERROR_UD;
@@ -646,13 +779,18 @@ int mov_cr_r32(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t counter)
 
 	uint32_t value = x86CPUGetRegister(cpu, mode->reg, 4);
 	cpu->control_registers[mode->rm] = value;
-	cpu->eip += counter;
+	if (mode->rm == 0 || mode->rm == 3) {
+		// paging enable and the page directory base change the linear to host mapping.
+		x86TlbFlush(cpu);
+	}
+	cpu->eip += instr->length;
 	return 0;
 }
-int mov_r32_cr(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t counter)
+int mov_r32_cr(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// MOV r32, cr0-7
 
+	X86_MOD_RM_BITS* mode = &instr->mode.bits;
 	if (mode->rm == 1 || mode->rm == 5 ||
 		mode->rm == 6 || mode->rm == 7) {
 		return X86_CPU_ERROR_UD;
@@ -660,563 +798,1350 @@ int mov_r32_cr(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t counter)
 
 	uint32_t value = cpu->control_registers[mode->reg];
 	x86CPUSetRegister(cpu, mode->rm, 4, value);
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int wrmsr(X86_CPU* cpu, uint32_t counter)
+int wrmsr(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	//Write to Model Specific Register
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int invd(X86_CPU* cpu, uint32_t counter)
+int invd(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// Invalidate Cache
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int wbinvd(X86_CPU* cpu, uint32_t counter)
+int wbinvd(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
 	// Write Back and Invalidate Cache
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int nop(X86_CPU* cpu, uint32_t counter)
+int nop(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	cpu->eip += counter;
+	cpu->eip += instr->length;
 	return 0;
 }
-int movs(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
-{
-	// Move Data From String to String - MOVS r8/r16/r32
-	// move byte/word/dword from address ds:si/esi to es:di/edi.
-	uint32_t esi = x86CPUGetRegister(cpu, REG_ESI, operand_size);
-	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, operand_size);
-	uint32_t value = x86CPUReadMemory(cpu, esi, operand_size);
+/* String instructions
 
-	set_memory_value(cpu, edi, operand_size, value);
-	if (cpu->eflags.DF == 0) {
-		x86CPUSetRegister(cpu, REG_ESI, operand_size, esi + operand_size);
-		x86CPUSetRegister(cpu, REG_EDI, operand_size, edi + operand_size);
-	}
-	else {
-		x86CPUSetRegister(cpu, REG_ESI, operand_size, esi - operand_size);
-		x86CPUSetRegister(cpu, REG_EDI, operand_size, edi - operand_size);
+	The REP forms do not step one element at a time through the memory interface.
+	They look up the host range behind si/esi and di/edi once and move, fill or
+	compare as many elements as the range holds with memmove, memset, memcmp and
+	memchr. A range ends where the host memory of a bus region ends, where the
+	index register wraps at the address size, or, for writes, at memory the bus
+	does not let the guest write; those elements go through the memory interface
+	one at a time. The
+	result matches running the elements one by one, overlapping moves included. */
+
+static uint32_t string_load(const BYTE* ptr, uint32_t operand_size)
+{
+	switch (operand_size) {
+		case 1:
+			return *ptr;
+		case 2:
+			return *(uint16_t*)ptr;
+		case 4:
+			return *(uint32_t*)ptr;
 	}
-	cpu->eip += counter;
 	return 0;
 }
-int stos(X86_CPU* cpu, uint32_t address_size, uint32_t operand_size, uint32_t counter)
+static uint32_t string_next(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t index, uint32_t count)
 {
-	// Store String - STOS r8/m16/m32
-	// store al/ax/eax at address es:di/edi 
-	uint32_t eax = x86CPUGetRegister(cpu, REG_EAX, operand_size);
-	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, address_size);
+	uint32_t mask = instr->address_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint32_t delta = count * instr->operand_size;
+	if (cpu->eflags.DF == 0)
+		return (index + delta) & mask;
+	else
+		return (index - delta) & mask;
+}
+static BYTE* string_span(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t segment, uint32_t index, int write, uint32_t max, uint32_t* count)
+{
+	// host pointer to the element at index and the number of elements, up to max, reachable through it.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t mask = instr->address_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint32_t top = index + operand_size - 1;
+	uint32_t size;
+	uint32_t last;
+	uint32_t n;
+	BYTE* ptr;
+
+	*count = 0;
+
+	if (max == 0 || top > mask || top < index)
+		return NULL; // the element wraps the index register.
 
-	set_memory_value(cpu, edi, operand_size, eax);
 	if (cpu->eflags.DF == 0) {
-		x86CPUSetRegister(cpu, REG_EDI, operand_size, edi + operand_size);
+		ptr = (BYTE*)x86GetCPUMemorySpan(cpu, segment, index, 0, write, &size);
+		if (ptr == NULL)
+			return NULL;
+		last = size - 1 < mask - index ? size - 1 : mask - index;
+		n = (last + 1) / operand_size;
 	}
 	else {
-		x86CPUSetRegister(cpu, REG_EDI, operand_size, edi - operand_size);
+		ptr = (BYTE*)x86GetCPUMemorySpan(cpu, segment, top, 1, write, &size);
+		if (ptr == NULL)
+			return NULL;
+		last = size - 1 < top ? size - 1 : top;
+		n = (last + 1) / operand_size;
+		ptr -= operand_size - 1;
 	}
 
-	cpu->eip += counter;
-	return 0;
+	*count = n < max ? n : max;
+	if (*count == 0)
+		return NULL;
+	return ptr;
+}
+static void string_copy(BYTE* dest, const BYTE* src, uint32_t size, uint32_t operand_size, int down)
+{
+	// dest and src point at the lowest byte of each range.
+	uintptr_t d = (uintptr_t)dest;
+	uintptr_t s = (uintptr_t)src;
+	uintptr_t distance;
+	uint32_t offset;
+	uint32_t chunk;
+
+	if (down == 0 && d > s && d < s + size) {
+		// dest overlaps the source ahead of it; the copy repeats the first distance bytes.
+		distance = d - s;
+		if (distance < operand_size) {
+			for (offset = 0; offset < size; offset += operand_size)
+				memmove(dest + offset, src + offset, operand_size);
+			return;
+		}
+		for (offset = 0; offset < size; offset += chunk) {
+			chunk = (size - offset < distance) ? size - offset : (uint32_t)distance;
+			memcpy(dest + offset, src + offset, chunk);
+		}
+	}
+	else if (down == 1 && s > d && s < d + size) {
+		// same, walking down from the top.
+		distance = s - d;
+		if (distance < operand_size) {
+			for (offset = size; offset > 0; offset -= operand_size)
+				memmove(dest + offset - operand_size, src + offset - operand_size, operand_size);
+			return;
+		}
+		for (offset = size; offset > 0; offset -= chunk) {
+			chunk = (offset < distance) ? offset : (uint32_t)distance;
+			memcpy(dest + offset - chunk, src + offset - chunk, chunk);
+		}
+	}
+	else {
+		memmove(dest, src, size);
+	}
 }
-int rep_movs(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+static void string_fill(BYTE* dest, uint32_t size, uint32_t operand_size, uint32_t value)
 {
-	uint32_t value;
-	X86_REG32 ecx = cpu->registers[REG_ECX].r32;
-	X86_REG32 esi = cpu->registers[REG_ESI].r32;
-	X86_REG32 edi = cpu->registers[REG_EDI].r32;
+	// dest points at the lowest byte of the range.
+	uint32_t filled;
+	uint32_t chunk;
 
-	for (; ecx > 0; ecx -= 1) {
-		value = x86CPUReadMemory(cpu, esi, operand_size);
-		set_memory_value(cpu, edi, operand_size, value);
+	switch (operand_size) {
+		case 1:
+			memset(dest, value, size);
+			return;
+		case 2:
+			*(uint16_t*)dest = (uint16_t)value;
+			break;
+		case 4:
+			*(uint32_t*)dest = value;
+			break;
+	}
 
-		if (cpu->eflags.DF == 0) {
-			esi += operand_size;
-			edi += operand_size;
+	// double the filled part until the range is full.
+	for (filled = operand_size; filled < size; filled += chunk) {
+		chunk = (size - filled < filled) ? size - filled : filled;
+		memcpy(dest + filled, dest, chunk);
+	}
+}
+static uint32_t string_compare(const BYTE* src, uint32_t value, const BYTE* dest, uint32_t count, uint32_t operand_size, int down, int repne)
+{
+	// number of elements compared until the repeat condition fails; count if it holds throughout.
+	// src == NULL compares value (scas) instead of the source string (cmps).
+	ptrdiff_t step = down ? -(ptrdiff_t)operand_size : (ptrdiff_t)operand_size;
+	uint32_t i = 0;
+	uint32_t a;
+	uint32_t b;
+
+	if (down == 0) {
+		if (src == NULL && operand_size == 1 && repne) {
+			const BYTE* hit = (const BYTE*)memchr(dest, (BYTE)value, count);
+			return (hit == NULL) ? count : (uint32_t)(hit - dest) + 1;
 		}
-		else {
-			esi -= operand_size;
-			edi -= operand_size;
+		if (src != NULL && repne == 0) {
+			// skip the equal part 64 bytes at a time.
+			while ((count - i) * operand_size >= 64 && memcmp(src + i * operand_size, dest + i * operand_size, 64) == 0)
+				i += 64 / operand_size;
 		}
 	}
 
-	cpu->registers[REG_ECX].r32 = ecx;
-	cpu->registers[REG_ESI].r32 = esi;
-	cpu->registers[REG_EDI].r32 = edi;
-	cpu->eip += counter;
-	return 0;
+	for (; i < count; ++i) {
+		a = (src != NULL) ? string_load(src + (ptrdiff_t)i * step, operand_size) : value;
+		b = string_load(dest + (ptrdiff_t)i * step, operand_size);
+		if ((a == b) == (repne != 0))
+			return i + 1;
+	}
+	return count;
 }
-int loop(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+static void string_advance(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t reg, uint32_t count)
 {
-	// Loop According to ECX Counter -  LOOP rel8
-	signed char rel8 = (signed char)x86CPUFetchByte(cpu, &counter);
-	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, operand_size);
-	ecx -= 1;
-	x86CPUSetRegister(cpu, REG_ECX, operand_size, ecx);
-	cpu->eip += counter;
-	if (ecx != 0)
-		cpu->eip += rel8;
-	return 0;
+	x86CPUSetRegister(cpu, reg, instr->address_size, string_next(cpu, instr, x86CPUGetRegister(cpu, reg, instr->address_size), count));
 }
-int loope(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+
+int movs(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	// Loop According to ECX Counter -  LOOPE rel8
-	signed char rel8 = (signed char)x86CPUFetchByte(cpu, &counter);
-	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, operand_size);
-	ecx -= 1;
-	x86CPUSetRegister(cpu, REG_ECX, operand_size, ecx);
-	cpu->eip += counter;
-	if (ecx != 0 && cpu->eflags.ZF == 1)
-		cpu->eip += rel8;
+	// Move Data From String to String - MOVS m8/m16/m32
+	// move byte/word/dword from address ds:si/esi to es:di/edi.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t esi = x86CPUGetRegister(cpu, REG_ESI, instr->address_size);
+	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, instr->address_size);
+	uint32_t value = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, esi), operand_size);
+
+	set_memory_value(cpu, x86GetLinearAddress(cpu, SEG_ES, edi), operand_size, value);
+	string_advance(cpu, instr, REG_ESI, 1);
+	string_advance(cpu, instr, REG_EDI, 1);
+	cpu->eip += instr->length;
 	return 0;
 }
-int loopne(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int stos(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	// Loop According to ECX Counter -  LOOPNE rel8
-	signed char rel8 = (signed char)x86CPUFetchByte(cpu, &counter);
-	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, operand_size);
-	ecx -= 1;
-	x86CPUSetRegister(cpu, REG_ECX, operand_size, ecx);
-	cpu->eip += counter;
-	if (ecx != 0 && cpu->eflags.ZF == 0)
-		cpu->eip += rel8;
+	// Store String - STOS m8/m16/m32
+	// store al/ax/eax at address es:di/edi.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t eax = x86CPUGetRegister(cpu, REG_EAX, operand_size);
+	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, instr->address_size);
+
+	set_memory_value(cpu, x86GetLinearAddress(cpu, SEG_ES, edi), operand_size, eax);
+	string_advance(cpu, instr, REG_EDI, 1);
+	cpu->eip += instr->length;
 	return 0;
 }
-int push_reg(X86_CPU* cpu, BYTE reg, uint32_t operand_size, uint32_t counter)
+int lods(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	uint32_t esp = x86CPUGetRegister(cpu, REG_ESP, operand_size);
-	uint32_t value = x86CPUGetRegister(cpu, reg, operand_size);
-	x86CPUSetRegister(cpu, REG_ESP, operand_size, esp - operand_size);
-	set_memory_value(cpu, esp - operand_size, operand_size, value);
-	cpu->eip += counter;	
+	// Load String - LODS m8/m16/m32
+	// load byte/word/dword at address ds:si/esi into al/ax/eax.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t esi = x86CPUGetRegister(cpu, REG_ESI, instr->address_size);
+
+	x86CPUSetRegister(cpu, REG_EAX, operand_size, x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, esi), operand_size));
+	string_advance(cpu, instr, REG_ESI, 1);
+	cpu->eip += instr->length;
 	return 0;
 }
-int pop_reg(X86_CPU* cpu, BYTE reg, uint32_t operand_size, uint32_t counter)
+int cmps(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	uint32_t esp = x86CPUGetRegister(cpu, REG_ESP, operand_size);
-	uint32_t value = x86CPUReadMemory(cpu, esp, operand_size);
-	x86CPUSetRegister(cpu, reg, operand_size, value);
-	x86CPUSetRegister(cpu, REG_ESP, operand_size, esp + operand_size);
-	cpu->eip += counter;	
+	// Compare String Operands - CMPS m8/m16/m32
+	// compare byte/word/dword at address ds:si/esi with es:di/edi.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t src = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, x86CPUGetRegister(cpu, REG_ESI, instr->address_size)), operand_size);
+	uint32_t dest = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, SEG_ES, x86CPUGetRegister(cpu, REG_EDI, instr->address_size)), operand_size);
+
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_CMP, src, dest, operand_size, NULL);
+	string_advance(cpu, instr, REG_ESI, 1);
+	string_advance(cpu, instr, REG_EDI, 1);
+	cpu->eip += instr->length;
 	return 0;
 }
-int xchg_reg(X86_CPU* cpu, BYTE reg1, BYTE reg2, uint32_t operand_size, uint32_t counter)
+int scas(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	// xchg reg, reg
-	uint32_t reg1_v = x86CPUGetRegister(cpu, reg1, operand_size);
-	uint32_t reg2_v = x86CPUGetRegister(cpu, reg2, operand_size);
-	x86CPUSetRegister(cpu, reg1, operand_size, reg2_v);
-	x86CPUSetRegister(cpu, reg2, operand_size, reg1_v);
-	cpu->eip += counter;
+	// Scan String - SCAS m8/m16/m32
+	// compare al/ax/eax with byte/word/dword at address es:di/edi.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t eax = x86CPUGetRegister(cpu, REG_EAX, operand_size);
+	uint32_t dest = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, SEG_ES, x86CPUGetRegister(cpu, REG_EDI, instr->address_size)), operand_size);
+
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_CMP, eax, dest, operand_size, NULL);
+	string_advance(cpu, instr, REG_EDI, 1);
+	cpu->eip += instr->length;
 	return 0;
 }
 
-/*DECODE*/
-int decode_opcode_f3(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, uint32_t counter)
+int rep_movs(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	switch (opcode) {
-		case 0xA5: // MOV WORD or DWORD
-			rep_movs(cpu, operand_size, counter);
-			return X86_CPU_ERROR_SUCCESS;
-
-		case 0xA4: // MOV BYTE
-			rep_movs(cpu, 1, counter);
-			return X86_CPU_ERROR_SUCCESS;
+	// Repeat Move String - REP MOVS m8/m16/m32
+	// move (e)cx elements from ds:si/esi to es:di/edi.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->address_size);
+	uint32_t esi = x86CPUGetRegister(cpu, REG_ESI, instr->address_size);
+	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, instr->address_size);
+	uint32_t lowest;
+	uint32_t count;
+	BYTE* src;
+	BYTE* dest;
+
+	while (ecx > 0) {
+		src = string_span(cpu, instr, instr->segment, esi, 0, ecx, &count);
+		dest = string_span(cpu, instr, SEG_ES, edi, 1, count, &count);
+		if (dest == NULL) {
+			set_memory_value(cpu, x86GetLinearAddress(cpu, SEG_ES, edi), operand_size, x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, esi), operand_size));
+			count = 1;
+		}
+		else {
+			lowest = (cpu->eflags.DF == 0) ? edi : string_next(cpu, instr, edi, count - 1);
+			x86CPUInvalidateCode(cpu, x86GetLinearAddress(cpu, SEG_ES, lowest), count * operand_size);
+			if (cpu->eflags.DF == 0)
+				string_copy(dest, src, count * operand_size, operand_size, 0);
+			else
+				string_copy(dest - (count - 1) * operand_size, src - (count - 1) * operand_size, count * operand_size, operand_size, 1);
+		}
+		ecx -= count;
+		esi = string_next(cpu, instr, esi, count);
+		edi = string_next(cpu, instr, edi, count);
 	}
 
-	error_out(cpu, counter);
-	return X86_CPU_ERROR_UD;
-}
-int decode_opcode_0f(X86_CPU* cpu, BYTE opcode, uint32_t address_size, uint32_t operand_size, BYTE segment_override_byte, uint32_t counter)
-{
-	X86_MOD_RM mode;
-
-	switch (opcode) { // 0F xx
-		case 0x00: // LLDT
-			mode.byte = cpu->eip_ptr[counter++];
-			if (mode.bits.reg == 0b010) { // 0f 00 /2 = LLDT r/m
-				if (mode.bits.mod == 0b11) {
-					return lldt_reg(cpu, mode.bits.rm, counter);
-				}
-				else {
-					return lldt_imm(cpu, counter);
-				}
-			} break;
-
-		case 0x01: // LGDT / LIDT
-			mode.byte = cpu->eip_ptr[counter++];
-			if (mode.bits.reg == 0b010) { // 0f 01 /2 = LGDT m
-				return lgdt(cpu, &mode.bits, address_size, operand_size, segment_override_byte, counter);
-			}
-			else if (mode.bits.reg == 0b011) { // 0f 01 /3 = LIDT m
-				return lidt(cpu, &mode.bits, address_size, operand_size, segment_override_byte, counter);
-			} break;
-
-		case 0x08: // invd
-			return invd(cpu, counter);
-
-		case 0x09: // wbinvd
-			return wbinvd(cpu, counter);
-
-		case 0x20: //mov r32, cr0-7
-			mode.byte = cpu->eip_ptr[counter++];
-			return mov_r32_cr(cpu, &mode.bits, counter);
-
-		case 0x22: //mov cr0-7, r32
-			mode.byte = cpu->eip_ptr[counter++];
-			return mov_cr_r32(cpu, &mode.bits, counter);
-
-		case 0x30: // WRMSR
-			return wrmsr(cpu, counter);
-
-		case 0x80:
-		case 0x81:
-		case 0x82:
-		case 0x83:
-		case 0x84:
-		case 0x85:
-		case 0x86:
-		case 0x87:
-		case 0x88:
-		case 0x89:
-		case 0x8A:
-		case 0x8B:
-		case 0x8C:
-		case 0x8D:
-		case 0x8E:
-		case 0x8F: // 16/32 bit JCC
-			return jcc(cpu, opcode, operand_size, counter);
-			
-		case 0xB6: // MOVZX r16/r32, r/m8
-			mode.byte = cpu->eip_ptr[counter++];
-			return movzx(cpu, &mode.bits, 1, operand_size, counter);
-
-		case 0xB7: // MOVZX r32, r/m16
-			mode.byte = cpu->eip_ptr[counter++];
-			return movzx(cpu, &mode.bits, 2, 4, counter);
-
-		case 0xBE: // MOVSX r16/r32, r/m8
-			mode.byte = cpu->eip_ptr[counter++];
-			return movsx(cpu, &mode.bits, 1, operand_size, counter);
-
-		case 0xBF: // MOVSX r32, r/m16
-			mode.byte = cpu->eip_ptr[counter++];
-			return movsx(cpu, &mode.bits, 2, 4, counter);
-	}
-
-	error_out(cpu, counter);
-	return X86_CPU_ERROR_UD;
+	x86CPUSetRegister(cpu, REG_ECX, instr->address_size, ecx);
+	x86CPUSetRegister(cpu, REG_ESI, instr->address_size, esi);
+	x86CPUSetRegister(cpu, REG_EDI, instr->address_size, edi);
+	cpu->eip += instr->length;
+	return 0;
 }
-int decode_opcode_one_byte(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, uint32_t counter)
-{	
-	// check for one byte opcodes
-	switch (opcode) {
-		case 0x04:
-			return add_imm_reg(cpu, REG_AL, 1, counter);
-		case 0x05:
-			return add_imm_reg(cpu, REG_EAX, operand_size, counter);
-
-		case 0x0C:
-			return or_imm_reg(cpu, REG_AL, 1, counter);
-		case 0x0D:
-			return or_imm_reg(cpu, REG_EAX, operand_size, counter);
-
-		case 0x24:
-			return and_imm_reg(cpu, REG_AL, 1, counter);			
-		case 0x25:
-			return and_imm_reg(cpu, REG_EAX, operand_size, counter);
-
-		case 0x2C:
-			return sub_imm_reg(cpu, REG_AL, 1, counter);
-		case 0x2D:
-			return sub_imm_reg(cpu, REG_EAX, operand_size, counter);
-
-		case 0x3C:
-			return cmp_imm_reg(cpu, REG_AL, 1, counter);			
-		case 0x3D:
-			return cmp_imm_reg(cpu, REG_EAX, operand_size, counter);
-
-		case 0x40:
-		case 0x41:
-		case 0x42:
-		case 0x43:
-		case 0x44:
-		case 0x45:
-		case 0x46:
-		case 0x47: // INC 16/32bit
-			return inc_reg(cpu, (opcode & 0b111), operand_size, counter);
-			
-		case 0x48:
-		case 0x49:
-		case 0x4A:
-		case 0x4B:
-		case 0x4C:
-		case 0x4D:
-		case 0x4E:
-		case 0x4F: // DEC 16/32bit
-			return dec_reg(cpu, (opcode & 0b111), operand_size, counter);
-		
-		case 0x50:
-		case 0x51:
-		case 0x52:
-		case 0x53:
-		case 0x54:
-		case 0x55:
-		case 0x56:
-		case 0x57: // PUSH 16/32bit
-			return push_reg(cpu, (opcode & 0b111), operand_size, counter);
-
-		case 0x58:
-		case 0x59:
-		case 0x5A:
-		case 0x5B:
-		case 0x5C:
-		case 0x5D:
-		case 0x5E:
-		case 0x5F: // POP 16/32bit
-			return pop_reg(cpu, (opcode & 0b111), operand_size, counter);
-
-		case 0x70:
-		case 0x71:
-		case 0x72:
-		case 0x73:
-		case 0x74:
-		case 0x75:
-		case 0x76:
-		case 0x77:
-		case 0x78:
-		case 0x79:
-		case 0x7A:
-		case 0x7B:
-		case 0x7C:
-		case 0x7D:
-		case 0x7E:
-		case 0x7F: // JMP condition 8bit		
-			return jcc(cpu, opcode, 1, counter);
-
-		case 0x8E: {			
-			X86_MOD_RM b;
-			b.byte = cpu->eip_ptr[counter++];
-			return mov_seg_r32(cpu, &b.bits, counter);
+int rep_stos(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// Repeat Store String - REP STOS m8/m16/m32
+	// store al/ax/eax in (e)cx elements at es:di/edi.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t eax = x86CPUGetRegister(cpu, REG_EAX, operand_size);
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->address_size);
+	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, instr->address_size);
+	uint32_t lowest;
+	uint32_t count;
+	BYTE* dest;
+
+	while (ecx > 0) {
+		dest = string_span(cpu, instr, SEG_ES, edi, 1, ecx, &count);
+		if (dest == NULL) {
+			set_memory_value(cpu, x86GetLinearAddress(cpu, SEG_ES, edi), operand_size, eax);
+			count = 1;
 		}
-
-		case 0x90:
-			return nop(cpu, counter);
-		case 0x91:
-		case 0x92:
-		case 0x93:
-		case 0x94:
-		case 0x95:
-		case 0x96:
-		case 0x97:
-			return xchg_reg(cpu, REG_EAX, (opcode & 0b111), operand_size, counter);
-
-		case 0xA0:
-			return move_ptr_reg(cpu, REG_AL, 1, counter);
-		case 0xA1:
-			return move_ptr_reg(cpu, REG_EAX, operand_size, counter);
-			
-		case 0xA4:
-			return movs(cpu, 1, counter);		
-		case 0xA5:
-			return movs(cpu, operand_size, counter);
-			
-		case 0xAA:
-			return stos(cpu, 4, 1, counter);
-		case 0xAB:
-			return stos(cpu, 4, operand_size, counter);
-		
-		case 0xB0:
-		case 0xB1:
-		case 0xB2:
-		case 0xB3:
-		case 0xB4:
-		case 0xB5:
-		case 0xB6:
-		case 0xB7: // MOV 8bit		
-			return move_imm_reg(cpu, (opcode & 0b111), 1, counter);
-
-		case 0xB8:
-		case 0xB9:
-		case 0xBA:
-		case 0xBB:
-		case 0xBC:
-		case 0xBD:
-		case 0xBE:
-		case 0xBF: // MOV 16/32bit
-			return move_imm_reg(cpu, (opcode & 0b111), operand_size, counter);
-
-		case 0xE0:
-			return loopne(cpu, operand_size, counter);
-		case 0xE1:
-			return loope(cpu, operand_size, counter);
-		case 0xE2:
-			return loop(cpu, operand_size, counter);
-
-		case 0xE4:
-			return in_byte_imm(cpu, 1, counter);			
-		case 0xE5:
-			return in_byte_imm(cpu, operand_size, counter);
-		case 0xE6:
-			return out_byte_imm(cpu, 1, counter);			
-		case 0xE7:
-			return out_byte_imm(cpu, operand_size, counter);
-
-		case 0xE9:
-			return jmp_imm_rel(cpu, operand_size, counter);
-		case 0xEA:
-			return jmp_far(cpu, counter);
-		case 0xEB:
-			return jmp_imm_rel(cpu, 1, counter);
-		case 0xEC:
-			return in_byte_reg(cpu, 1, counter);			
-		case 0xED:
-			return in_byte_reg(cpu, operand_size, counter);
-		case 0xEE:
-			return out_byte_reg(cpu, 1, counter);
-		case 0xEF:
-			return out_byte_reg(cpu, operand_size, counter);
-
-		case 0xF4:
-			return hlt(cpu, counter);
-
-		case 0xFA:
-			return cli(cpu, counter);
-		case 0xFB:
-			return sti(cpu, counter);
-		case 0xFC:
-			return cld(cpu, counter);			
-		case 0xFD:
-			return std(cpu, counter);
-			
-		case 0xFE: {
-			X86_MOD_RM b;
-			b.byte = cpu->eip_ptr[counter++];
-			if (b.bits.mod == 0b11) {
-				switch (b.bits.reg) {
-					case 0b000: // INC
-						inc_reg(cpu, b.bits.rm, 1, counter);
-						break;
-					case 0b001: // DEC
-						dec_reg(cpu, b.bits.rm, 1, counter);
-						break;
-					default:
-						return 1; // not decoded.
-				}
-			}
-		} return X86_CPU_ERROR_SUCCESS;
-		
-		default:
-			return 1; // not decoded.
+		else {
+			lowest = (cpu->eflags.DF == 0) ? edi : string_next(cpu, instr, edi, count - 1);
+			x86CPUInvalidateCode(cpu, x86GetLinearAddress(cpu, SEG_ES, lowest), count * operand_size);
+			if (cpu->eflags.DF == 1)
+				dest -= (count - 1) * operand_size;
+			string_fill(dest, count * operand_size, operand_size, eax);
+		}
+		ecx -= count;
+		edi = string_next(cpu, instr, edi, count);
 	}
+
+	x86CPUSetRegister(cpu, REG_ECX, instr->address_size, ecx);
+	x86CPUSetRegister(cpu, REG_EDI, instr->address_size, edi);
+	cpu->eip += instr->length;
+	return 0;
 }
-int decode_opcode_extended(X86_CPU* cpu, BYTE extended_opcode, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, uint32_t counter)
+int rep_lods(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
-	// 0x00 - 0x07 (0b000 - 0b111) ( 8 )
-	switch (extended_opcode) {
-		case 0b000: // ADD
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_ADD, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
-
-		case 0b001: // OR
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_OR, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	// Repeat Load String - REP LODS m8/m16/m32
+	// only the last of the (e)cx elements loaded from ds:si/esi is left in al/ax/eax, so a host range is read once.
+	// elements that are not host memory are read one at a time; the device sees every load.
+	uint32_t operand_size = instr->operand_size;
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->address_size);
+	uint32_t esi = x86CPUGetRegister(cpu, REG_ESI, instr->address_size);
+	uint32_t count;
+	BYTE* src;
+
+	while (ecx > 0) {
+		src = string_span(cpu, instr, instr->segment, esi, 0, ecx, &count);
+		if (src == NULL) {
+			count = 1;
+		}
 
-		case 0b010: // ADC
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_ADC, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+		x86CPUSetRegister(cpu, REG_EAX, operand_size, x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, string_next(cpu, instr, esi, count - 1)), operand_size));
+		ecx -= count;
+		esi = string_next(cpu, instr, esi, count);
+	}
 
-		case 0b011: // SBB
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_SBB, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	x86CPUSetRegister(cpu, REG_ECX, instr->address_size, ecx);
+	x86CPUSetRegister(cpu, REG_ESI, instr->address_size, esi);
+	cpu->eip += instr->length;
+	return 0;
+}
+int rep_cmps(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// Repeat Compare String Operands - REPE/REPNE CMPS m8/m16/m32
+	// compare ds:si/esi with es:di/edi while the elements are equal (F3) or not equal (F2).
+	uint32_t operand_size = instr->operand_size;
+	int repne = instr->prefix.byte_f2;
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->address_size);
+	uint32_t esi = x86CPUGetRegister(cpu, REG_ESI, instr->address_size);
+	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, instr->address_size);
+	uint32_t count;
+	uint32_t a;
+	uint32_t b;
+	BYTE* src;
+	BYTE* dest;
+
+	while (ecx > 0) {
+		src = string_span(cpu, instr, instr->segment, esi, 0, ecx, &count);
+		dest = string_span(cpu, instr, SEG_ES, edi, 0, count, &count);
+		if (dest == NULL) {
+			count = 1;
+		}
+		else {
+			count = string_compare(src, 0, dest, count, operand_size, cpu->eflags.DF, repne);
+		}
 
-		case 0b100: // AND
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_AND, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+		// flags come from the last pair compared.
+		a = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, instr->segment, string_next(cpu, instr, esi, count - 1)), operand_size);
+		b = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, SEG_ES, string_next(cpu, instr, edi, count - 1)), operand_size);
+		x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_CMP, a, b, operand_size, NULL);
 
-		case 0b101: // SUB
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_SUB, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+		ecx -= count;
+		esi = string_next(cpu, instr, esi, count);
+		edi = string_next(cpu, instr, edi, count);
+		if ((a == b) == (repne != 0))
+			break;
+	}
 
-		case 0b110: // XOR
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_XOR, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	x86CPUSetRegister(cpu, REG_ECX, instr->address_size, ecx);
+	x86CPUSetRegister(cpu, REG_ESI, instr->address_size, esi);
+	x86CPUSetRegister(cpu, REG_EDI, instr->address_size, edi);
+	cpu->eip += instr->length;
+	return 0;
+}
+int rep_scas(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// Repeat Scan String - REPE/REPNE SCAS m8/m16/m32
+	// compare al/ax/eax with es:di/edi while the elements are equal (F3) or not equal (F2).
+	uint32_t operand_size = instr->operand_size;
+	int repne = instr->prefix.byte_f2;
+	uint32_t eax = x86CPUGetRegister(cpu, REG_EAX, operand_size);
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->address_size);
+	uint32_t edi = x86CPUGetRegister(cpu, REG_EDI, instr->address_size);
+	uint32_t count;
+	uint32_t b;
+	BYTE* dest;
+
+	while (ecx > 0) {
+		dest = string_span(cpu, instr, SEG_ES, edi, 0, ecx, &count);
+		if (dest == NULL) {
+			count = 1;
+		}
+		else {
+			count = string_compare(NULL, eax, dest, count, operand_size, cpu->eflags.DF, repne);
+		}
 
-		case 0b111: // CMP
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_CMP, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			cpu->eip += counter;
-			return X86_CPU_ERROR_DECODED; // cmp only sets flags.
+		// flags come from the last element compared.
+		b = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, SEG_ES, string_next(cpu, instr, edi, count - 1)), operand_size);
+		x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_CMP, eax, b, operand_size, NULL);
 
-		default:
-			error_out(cpu, counter);
-			return X86_CPU_ERROR_UD;
+		ecx -= count;
+		edi = string_next(cpu, instr, edi, count);
+		if ((eax == b) == (repne != 0))
+			break;
 	}
+
+	x86CPUSetRegister(cpu, REG_ECX, instr->address_size, ecx);
+	x86CPUSetRegister(cpu, REG_EDI, instr->address_size, edi);
+	cpu->eip += instr->length;
+	return 0;
 }
-int decode_opcode(X86_CPU* cpu, BYTE opcode, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, uint32_t counter)
+static uint32_t loop_iterations(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t ecx)
 {
-	// 0x00 - 0x3F (0b000000 - 0b111111) ( 64 )
-	
-	switch (opcode) {
-		case 0b000000: // ADD
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_ADD, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	// a loop that branches to itself only counts ecx down; take the iterations up to the next event at once.
+	uint32_t mask = instr->operand_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint64_t end = cpu->events.deadline < cpu->run_end ? cpu->events.deadline : cpu->run_end;
+	uint64_t iterations;
+	uint64_t budget;
 
-		case 0b000010: // OR
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_OR, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	if ((signed char)instr->imm != -(int)instr->length)
+		return 1;
 
-		case 0b001000: // AND
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_AND, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	iterations = (uint64_t)((ecx - 1) & mask) + 1; // ecx 0 wraps
+	budget = end > cpu->clock ? end - cpu->clock : 1;
+	if (iterations > budget)
+		iterations = budget;
 
-		case 0b001010: // SUB
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_SUB, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+	// the caller counts the instruction itself.
+	cpu->clock += iterations - 1;
+	return (uint32_t)iterations;
+}
+int loop(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// Loop According to ECX Counter -  LOOP rel8
+	uint32_t mask = instr->operand_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->operand_size);
+	ecx = (ecx - loop_iterations(cpu, instr, ecx)) & mask;
+	x86CPUSetRegister(cpu, REG_ECX, instr->operand_size, ecx);
+	cpu->eip += instr->length;
+	if (ecx != 0)
+		cpu->eip += (signed char)instr->imm;
+	return 0;
+}
+int loope(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// Loop According to ECX Counter -  LOOPE rel8
+	uint32_t mask = instr->operand_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->operand_size);
+	if (x86AluZF(&cpu->lazy_flags) == 1)
+		ecx = (ecx - loop_iterations(cpu, instr, ecx)) & mask;
+	else
+		ecx = (ecx - 1) & mask;
+	x86CPUSetRegister(cpu, REG_ECX, instr->operand_size, ecx);
+	cpu->eip += instr->length;
+	if (ecx != 0 && x86AluZF(&cpu->lazy_flags) == 1)
+		cpu->eip += (signed char)instr->imm;
+	return 0;
+}
+int loopne(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// Loop According to ECX Counter -  LOOPNE rel8
+	uint32_t mask = instr->operand_size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	uint32_t ecx = x86CPUGetRegister(cpu, REG_ECX, instr->operand_size);
+	if (x86AluZF(&cpu->lazy_flags) == 0)
+		ecx = (ecx - loop_iterations(cpu, instr, ecx)) & mask;
+	else
+		ecx = (ecx - 1) & mask;
+	x86CPUSetRegister(cpu, REG_ECX, instr->operand_size, ecx);
+	cpu->eip += instr->length;
+	if (ecx != 0 && x86AluZF(&cpu->lazy_flags) == 0)
+		cpu->eip += (signed char)instr->imm;
+	return 0;
+}
+int push_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	uint32_t operand_size = instr->operand_size;
+	uint32_t esp = x86CPUGetRegister(cpu, REG_ESP, operand_size);
+	uint32_t value = x86CPUGetRegister(cpu, instr->reg, operand_size);
+	x86CPUSetRegister(cpu, REG_ESP, operand_size, esp - operand_size);
+	set_memory_value(cpu, x86GetLinearAddress(cpu, SEG_SS, esp - operand_size), operand_size, value);
+	cpu->eip += instr->length;	
+	return 0;
+}
+int pop_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	uint32_t operand_size = instr->operand_size;
+	uint32_t esp = x86CPUGetRegister(cpu, REG_ESP, operand_size);
+	uint32_t value = x86CPUReadMemory(cpu, x86GetLinearAddress(cpu, SEG_SS, esp), operand_size);
+	x86CPUSetRegister(cpu, instr->reg, operand_size, value);
+	x86CPUSetRegister(cpu, REG_ESP, operand_size, esp + operand_size);
+	cpu->eip += instr->length;	
+	return 0;
+}
+int xchg_reg(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// xchg reg, reg
+	uint32_t operand_size = instr->operand_size;
+	uint32_t reg1_v = x86CPUGetRegister(cpu, REG_EAX, operand_size);
+	uint32_t reg2_v = x86CPUGetRegister(cpu, instr->reg, operand_size);
+	x86CPUSetRegister(cpu, REG_EAX, operand_size, reg2_v);
+	x86CPUSetRegister(cpu, instr->reg, operand_size, reg1_v);
+	cpu->eip += instr->length;
+	return 0;
+}
 
-		case 0b001100: // XOR
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_XOR, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			return X86_CPU_ERROR_SUCCESS;
+/*EXECUTE MOD R/M*/
+typedef int (*X86_MODRM_OPERATION)(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr);
 
-		case 0b001110: // CMP
-			x86Alu(&cpu->eflags, INSTRUCTION_TYPE_CMP, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
-			cpu->eip += counter;
-			return X86_CPU_ERROR_DECODED; // cmp only sets flags.
-
-		case 0b100001: // XCHG
-			// set register or memory.
-			switch (addressing_mode->src.type) {
-				case INSTRUCTION_RM_INDIRECT:
-					set_memory_value(cpu, addressing_mode->src.address, operand_size, addressing_mode->dest.value);
-					break;
-				case INSTRUCTION_RM_REGISTER:
-					x86CPUSetRegister(cpu, addressing_mode->src.reg, operand_size, addressing_mode->dest.value);
-					break;
-			}
-			*instr_result = addressing_mode->src.value;
-			return X86_CPU_ERROR_SUCCESS;
+int modrm_add(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_ADD, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_or(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_OR, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_adc(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_ADC, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_sbb(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_SBB, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_and(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_AND, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_sub(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_SUB, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_xor(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_XOR, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_cmp(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	x86Alu(&cpu->lazy_flags, INSTRUCTION_TYPE_CMP, addressing_mode->dest.value, addressing_mode->src.value, operand_size, instr_result);
+	cpu->eip += instr->length;
+	return X86_CPU_ERROR_DECODED; // cmp only sets flags.
+}
+int modrm_xchg(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	// set register or memory.
+	switch (addressing_mode->src.type) {
+		case INSTRUCTION_RM_INDIRECT:
+			set_memory_value(cpu, addressing_mode->src.address, operand_size, addressing_mode->dest.value);
+			break;
+		case INSTRUCTION_RM_REGISTER:
+			x86CPUSetRegister(cpu, addressing_mode->src.reg, operand_size, addressing_mode->dest.value);
+			break;
+	}
+	*instr_result = addressing_mode->src.value;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_mov(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	*instr_result = addressing_mode->src.value;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int modrm_jmp(X86_CPU* cpu, ADDRESSING_MODE_STRUCT* addressing_mode, uint32_t operand_size, uint32_t* instr_result, X86_INSTRUCTION* instr)
+{
+	cpu->eip = addressing_mode->src.value;
+	return X86_CPU_ERROR_DECODED;
+}
+
+// 0x00 - 0x3F (0b000000 - 0b111111) ( 64 ); indexed by the opcode op bits. NULL = #UD
+static const X86_MODRM_OPERATION modrm_operations[64] = {
+	[0b000000] = modrm_add,
+	[0b000010] = modrm_or,
+	[0b001000] = modrm_and,
+	[0b001010] = modrm_sub,
+	[0b001100] = modrm_xor,
+	[0b001110] = modrm_cmp,
+	[0b100001] = modrm_xchg,
+	[0b100010] = modrm_mov,
+	[0b111111] = modrm_jmp,
+};
+
+// 0x80 - 0x83 ( 1 0 0 0 0 0 X X ); indexed by the mod r/m reg bits
+static const X86_MODRM_OPERATION modrm_operations_extended[8] = {
+	modrm_add, // 0b000
+	modrm_or,  // 0b001
+	modrm_adc, // 0b010
+	modrm_sbb, // 0b011
+	modrm_and, // 0b100
+	modrm_sub, // 0b101
+	modrm_xor, // 0b110
+	modrm_cmp, // 0b111
+};
+
+int modrm_op(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	// generic mod r/m instruction; 0x00 - 0x3F ( X X X X X X ) and 0x80 - 0x83 ( 1 0 0 0 0 0 X X )
 
-		case 0b100010: // MOV
-			*instr_result = addressing_mode->src.value;
+	int result = 0;
+	uint32_t operand_size = instr->operand_size;
+	X86_MOD_RM_BITS* mode = &instr->mode.bits;
+	ADDRESSING_MODE_STRUCT addressing_mode = { 0 };
+	ADDRESSING_MODE_FIELD_STRUCT rm = { 0 };
+	uint32_t reg_v = 0;
+	INSTRUCTION_RM reg_type = 0;
+	BYTE direction = 0;
+
+	if (instr->opcode.bits.op == 0b100000) {
+		//immediate instruction
+		reg_type = INSTRUCTION_RM_IMM;
+		direction = 0; // direction always const -> reg (cant be reg -> const)
+		reg_v = instr->imm;
+	}
+	else {
+		// r/m or SIB
+		reg_type = INSTRUCTION_RM_REGISTER;
+		direction = instr->opcode.bits.direction;
+
+		reg_v = x86CPUGetRegister(cpu, mode->reg, operand_size);
+	}
+
+	// resolve the addressing mode.
+	get_addressing_mode(cpu, instr, operand_size, &rm);
+
+	// figure out the addressing direction.
+	if (direction == 0) {
+		// reg -> r/m
+
+		addressing_mode.src.value = reg_v;
+		addressing_mode.src.reg = mode->reg;
+		addressing_mode.src.type = reg_type;
+
+		addressing_mode.dest.value = rm.value;
+		addressing_mode.dest.reg = mode->rm;
+		addressing_mode.dest.type = rm.type;
+		addressing_mode.dest.address = rm.address;
+	}
+	else {
+		// r/m -> reg
+
+		addressing_mode.src.value = rm.value;
+		addressing_mode.src.reg = mode->rm;
+		addressing_mode.src.type = rm.type;
+		addressing_mode.src.address = rm.address;
+
+		addressing_mode.dest.value = reg_v;
+		addressing_mode.dest.reg = mode->reg;
+		addressing_mode.dest.type = reg_type;
+	}
+
+	// perform instruction.
+
+	uint32_t instr_result = 0;
+
+	if (instr->opcode.bits.op == 0b100000) {
+		// 0x80 - 0x83 ( 1 0 0 0 0 0 X X )
+		result = modrm_operations_extended[mode->reg](cpu, &addressing_mode, operand_size, &instr_result, instr);
+	}
+	else {
+		// 0x00 - 0x3F ( X X X X X X ); the decoder only accepts ops with an entry.
+		result = modrm_operations[instr->opcode.bits.op](cpu, &addressing_mode, operand_size, &instr_result, instr);
+	}
+	if (result != 0) {
+		if (result == X86_CPU_ERROR_DECODED)
 			return X86_CPU_ERROR_SUCCESS;
+		else
+			return result;
+	}
+
+	// set register or memory.
+	switch (addressing_mode.dest.type) {
+		case INSTRUCTION_RM_INDIRECT:
+			set_memory_value(cpu, rm.address, operand_size, instr_result);
+			break;
+		case INSTRUCTION_RM_REGISTER:		
+			x86CPUSetRegister(cpu, addressing_mode.dest.reg, operand_size, instr_result);
+			break;
+	}
 
-		case 0b111111: // JMP
-			cpu->eip = addressing_mode->src.value;
-			return X86_CPU_ERROR_DECODED;
+	// inc
+	cpu->eip += instr->length;
 
-		default:
-			error_out(cpu, counter);
-			return X86_CPU_ERROR_UD;
+	return 0;
+}
+
+/*DECODE*/
+typedef int (*X86_DECODE_HANDLER)(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter);
+
+int decode_opcode_modrm(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter);
+
+int decode_ud(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	error_out(cpu, *counter);
+	return X86_CPU_ERROR_UD;
+}
+
+/* one operand instructions: opcode size bit selects 8bit or 16/32bit */
+int decode_imm_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter, X86_INSTRUCTION_HANDLER handler)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->reg = REG_EAX;
+	instr->imm = x86CPUFetchMemory(cpu, instr->operand_size, counter);
+	instr->handler = handler;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_add_imm_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	return decode_imm_acc(cpu, instr, counter, add_imm_reg);
+}
+int decode_or_imm_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	return decode_imm_acc(cpu, instr, counter, or_imm_reg);
+}
+int decode_and_imm_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	return decode_imm_acc(cpu, instr, counter, and_imm_reg);
+}
+int decode_sub_imm_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	return decode_imm_acc(cpu, instr, counter, sub_imm_reg);
+}
+int decode_cmp_imm_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	return decode_imm_acc(cpu, instr, counter, cmp_imm_reg);
+}
+int decode_move_ptr_acc(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	return decode_imm_acc(cpu, instr, counter, move_ptr_reg);
+}
+
+/* register encoded in the low 3 bits of the opcode */
+int decode_inc_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->handler = inc_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_dec_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->handler = dec_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_push_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->handler = push_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_pop_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->handler = pop_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_xchg_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->handler = xchg_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_move_imm_reg8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->operand_size = 1;
+	instr->imm = x86CPUFetchMemory(cpu, 1, counter);
+	instr->handler = move_imm_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_move_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->reg = (instr->opcode.byte & 0b111);
+	instr->imm = x86CPUFetchMemory(cpu, instr->operand_size, counter);
+	instr->handler = move_imm_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* branches */
+int decode_jcc_rel8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->imm = x86CPUFetchMemorySigned(cpu, 1, counter);
+	instr->handler = jcc;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_jcc_rel(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->imm = x86CPUFetchMemorySigned(cpu, instr->operand_size, counter);
+	instr->handler = jcc;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_jmp_rel8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->imm = x86CPUFetchMemorySigned(cpu, 1, counter);
+	instr->handler = jmp_imm_rel;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_jmp_rel(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->imm = x86CPUFetchMemorySigned(cpu, instr->operand_size, counter);
+	instr->handler = jmp_imm_rel;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_jmp_far(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->imm = x86CPUFetchDword(cpu, counter);
+	instr->selector = x86CPUFetchWord(cpu, counter);
+	instr->handler = jmp_far;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_call_rel(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->imm = x86CPUFetchMemorySigned(cpu, instr->operand_size, counter);
+	instr->handler = call_rel;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_ret_near(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	// C2 = RET imm16, C3 = RET
+	if (instr->opcode.byte == 0xC2)
+		instr->imm = x86CPUFetchWord(cpu, counter);
+	else
+		instr->imm = 0;
+	instr->handler = ret_near;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_loop_rel8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	// E0 = LOOPNE, E1 = LOOPE, E2 = LOOP
+	static const X86_INSTRUCTION_HANDLER handlers[3] = { loopne, loope, loop };
+	instr->imm = x86CPUFetchByte(cpu, counter);
+	instr->handler = handlers[instr->opcode.byte - 0xE0];
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_hlt(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = hlt;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_mov_seg_r32(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	instr->handler = mov_seg_r32;
+	instr->flags |= X86_INSTRUCTION_BRANCH;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* string instructions */
+int decode_movs(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = movs;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_stos(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = stos;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_lods(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = lods;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_cmps(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = cmps;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_scas(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = scas;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_rep_movs(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = rep_movs;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_rep_stos(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = rep_stos;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_rep_lods(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = rep_lods;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_rep_cmps(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = rep_cmps;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_rep_scas(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = rep_scas;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* io */
+int decode_in_imm(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->imm = x86CPUFetchByte(cpu, counter);
+	instr->handler = in_byte_imm;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_out_imm(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->imm = x86CPUFetchByte(cpu, counter);
+	instr->handler = out_byte_imm;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_in_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = in_byte_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_out_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	if (instr->opcode.bits.size == 0)
+		instr->operand_size = 1;
+	instr->handler = out_byte_reg;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* no operands */
+int decode_nop(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = nop;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_cli(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = cli;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_sti(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = sti;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_cld(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = cld;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_std(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = std;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_invd(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = invd;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_wbinvd(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = wbinvd;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_wrmsr(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->handler = wrmsr;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* mod r/m instructions with a fixed meaning */
+int decode_inc_dec_rm8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	X86_MOD_RM b;
+	uint32_t peek = *counter;
+	b.byte = x86CPUFetchByte(cpu, &peek); // the mod r/m byte is left for the decode it picks
+	if (b.bits.mod == 0b11) {
+		switch (b.bits.reg) {
+			case 0b000: // INC
+				instr->handler = inc_reg;
+				break;
+			case 0b001: // DEC
+				instr->handler = dec_reg;
+				break;
+			default:
+				return decode_opcode_modrm(cpu, instr, counter);
+		}
+		instr->mode = b;
+		instr->reg = b.bits.rm;
+		instr->operand_size = 1;
+		*counter += 1;
+		return X86_CPU_ERROR_SUCCESS;
 	}
+	*counter += 1;
+	return decode_ud(cpu, instr, counter);
 }
+int decode_shift_rm8_imm8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	// C0 = Eb, ib (operand1 = 8 regardless of operand_size) (operand2 = imm8)
+	X86_MOD_RM b;
+	uint32_t peek = *counter;
+	b.byte = x86CPUFetchByte(cpu, &peek);
+	if (b.byte >= 0xe0 && b.byte <= 0xe7) {
+		// SHL r/m 8 imm8
+		*counter += 1;
+		instr->mode = b;
+		instr->reg = b.bits.rm;
+		instr->operand_size = 1;
+		instr->imm = x86CPUFetchByte(cpu, counter);
+		instr->handler = shl_reg;
+		return X86_CPU_ERROR_SUCCESS;
+	}
+	return decode_opcode_modrm(cpu, instr, counter);
+}
+int decode_shift_rm_imm8(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	// C1 = Ev, ib (operand1 = 16 or 32 depending on operand_size) (operand2 = imm8)
+	X86_MOD_RM b;
+	uint32_t peek = *counter;
+	b.byte = x86CPUFetchByte(cpu, &peek);
+	if (b.byte >= 0xe0 && b.byte <= 0xe7) {
+		// SHL r/m 16/32 imm8
+		instr->handler = shl_reg;
+	}
+	else if (b.byte >= 0xe8 && b.byte <= 0xef) {
+		// SHR r/m 16/32 imm8
+		instr->handler = shr_reg;
+	}
+	else {
+		return decode_opcode_modrm(cpu, instr, counter);
+	}
+	*counter += 1;
+	instr->mode = b;
+	instr->reg = b.bits.rm;
+	instr->imm = x86CPUFetchByte(cpu, counter);
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_lldt(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	if (instr->mode.bits.reg == 0b010) { // 0f 00 /2 = LLDT r/m
+		if (instr->mode.bits.mod == 0b11) {
+			instr->handler = lldt_reg;
+		}
+		else {
+			instr->imm = x86CPUFetchMemory(cpu, 2, counter);
+			instr->handler = lldt_imm;
+		}
+		return X86_CPU_ERROR_SUCCESS;
+	}
+	return decode_ud(cpu, instr, counter);
+}
+int decode_lgdt_lidt(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	if (instr->mode.bits.reg == 0b010) { // 0f 01 /2 = LGDT m
+		decode_addressing_mode(cpu, instr, counter);
+		instr->handler = lgdt;
+		return X86_CPU_ERROR_SUCCESS;
+	}
+	else if (instr->mode.bits.reg == 0b011) { // 0f 01 /3 = LIDT m
+		decode_addressing_mode(cpu, instr, counter);
+		instr->handler = lidt;
+		return X86_CPU_ERROR_SUCCESS;
+	}
+	return decode_ud(cpu, instr, counter);
+}
+int decode_mov_r32_cr(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	instr->handler = mov_r32_cr;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_mov_cr_r32(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	instr->handler = mov_cr_r32;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_movzx(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	// B6 = MOVZX r16/r32, r/m8; B7 = MOVZX r32, r/m16
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	if (instr->opcode.bits.size == 0) {
+		instr->src_size = 1;
+	}
+	else {
+		instr->src_size = 2;
+		instr->operand_size = 4;
+	}
+	instr->handler = movzx;
+	return X86_CPU_ERROR_SUCCESS;
+}
+int decode_movsx(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	// BE = MOVSX r16/r32, r/m8; BF = MOVSX r32, r/m16
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+	if (instr->opcode.bits.size == 0) {
+		instr->src_size = 1;
+	}
+	else {
+		instr->src_size = 2;
+		instr->operand_size = 4;
+	}
+	instr->handler = movsx;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* generic mod r/m instruction; 0x00 - 0x3F ( X X X X X X ) and 0x80 - 0x83 ( 1 0 0 0 0 0 X X ) */
+int decode_opcode_modrm(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
+{
+	X86_OPCODE opcode = instr->opcode;
+
+	if (opcode.bits.size == 0) {
+		instr->operand_size = 1;
+	}
+
+	// assume mod r/m byte
+	instr->mode.byte = x86CPUFetchByte(cpu, counter);
+
+	if (opcode.bits.op == 0b100000) {
+		//immediate instruction
+		uint32_t const_size;
+		if (opcode.bits.direction == 1)	// constant is a signed 1 byte operand
+			const_size = 1;
+		else // constant is the same size specified by s.
+			const_size = instr->operand_size;
+
+		instr->imm = x86CPUFetchMemory(cpu, const_size, counter);
+	}
+
+	// figure out the addressing mode.
+	decode_addressing_mode(cpu, instr, counter);
+
+	if (opcode.bits.op != 0b100000 && modrm_operations[opcode.bits.op] == NULL)
+		return decode_ud(cpu, instr, counter);
+
+	if (opcode.bits.op == 0b111111) // JMP
+		instr->flags |= X86_INSTRUCTION_BRANCH;
+
+	instr->handler = modrm_op;
+	return X86_CPU_ERROR_SUCCESS;
+}
+
+/* one byte opcode map. NULL = generic mod r/m instruction */
+static const X86_DECODE_HANDLER decode_one_byte[256] = {
+	[0x04] = decode_add_imm_acc,
+	[0x05] = decode_add_imm_acc,
+	[0x0C] = decode_or_imm_acc,
+	[0x0D] = decode_or_imm_acc,
+	[0x24] = decode_and_imm_acc,
+	[0x25] = decode_and_imm_acc,
+	[0x2C] = decode_sub_imm_acc,
+	[0x2D] = decode_sub_imm_acc,
+	[0x3C] = decode_cmp_imm_acc,
+	[0x3D] = decode_cmp_imm_acc,
+
+	// INC 16/32bit
+	[0x40] = decode_inc_reg, [0x41] = decode_inc_reg, [0x42] = decode_inc_reg, [0x43] = decode_inc_reg,
+	[0x44] = decode_inc_reg, [0x45] = decode_inc_reg, [0x46] = decode_inc_reg, [0x47] = decode_inc_reg,
+	// DEC 16/32bit
+	[0x48] = decode_dec_reg, [0x49] = decode_dec_reg, [0x4A] = decode_dec_reg, [0x4B] = decode_dec_reg,
+	[0x4C] = decode_dec_reg, [0x4D] = decode_dec_reg, [0x4E] = decode_dec_reg, [0x4F] = decode_dec_reg,
+	// PUSH 16/32bit
+	[0x50] = decode_push_reg, [0x51] = decode_push_reg, [0x52] = decode_push_reg, [0x53] = decode_push_reg,
+	[0x54] = decode_push_reg, [0x55] = decode_push_reg, [0x56] = decode_push_reg, [0x57] = decode_push_reg,
+	// POP 16/32bit
+	[0x58] = decode_pop_reg, [0x59] = decode_pop_reg, [0x5A] = decode_pop_reg, [0x5B] = decode_pop_reg,
+	[0x5C] = decode_pop_reg, [0x5D] = decode_pop_reg, [0x5E] = decode_pop_reg, [0x5F] = decode_pop_reg,
+
+	// JMP condition 8bit
+	[0x70] = decode_jcc_rel8, [0x71] = decode_jcc_rel8, [0x72] = decode_jcc_rel8, [0x73] = decode_jcc_rel8,
+	[0x74] = decode_jcc_rel8, [0x75] = decode_jcc_rel8, [0x76] = decode_jcc_rel8, [0x77] = decode_jcc_rel8,
+	[0x78] = decode_jcc_rel8, [0x79] = decode_jcc_rel8, [0x7A] = decode_jcc_rel8, [0x7B] = decode_jcc_rel8,
+	[0x7C] = decode_jcc_rel8, [0x7D] = decode_jcc_rel8, [0x7E] = decode_jcc_rel8, [0x7F] = decode_jcc_rel8,
+
+	[0x8E] = decode_mov_seg_r32,
+
+	[0x90] = decode_nop,
+	[0x91] = decode_xchg_reg, [0x92] = decode_xchg_reg, [0x93] = decode_xchg_reg,
+	[0x94] = decode_xchg_reg, [0x95] = decode_xchg_reg, [0x96] = decode_xchg_reg, [0x97] = decode_xchg_reg,
+
+	[0xA0] = decode_move_ptr_acc,
+	[0xA1] = decode_move_ptr_acc,
+	[0xA4] = decode_movs,
+	[0xA5] = decode_movs,
+	[0xA6] = decode_cmps,
+	[0xA7] = decode_cmps,
+	[0xAA] = decode_stos,
+	[0xAB] = decode_stos,
+	[0xAC] = decode_lods,
+	[0xAD] = decode_lods,
+	[0xAE] = decode_scas,
+	[0xAF] = decode_scas,
+
+	// MOV 8bit
+	[0xB0] = decode_move_imm_reg8, [0xB1] = decode_move_imm_reg8, [0xB2] = decode_move_imm_reg8, [0xB3] = decode_move_imm_reg8,
+	[0xB4] = decode_move_imm_reg8, [0xB5] = decode_move_imm_reg8, [0xB6] = decode_move_imm_reg8, [0xB7] = decode_move_imm_reg8,
+	// MOV 16/32bit
+	[0xB8] = decode_move_imm_reg, [0xB9] = decode_move_imm_reg, [0xBA] = decode_move_imm_reg, [0xBB] = decode_move_imm_reg,
+	[0xBC] = decode_move_imm_reg, [0xBD] = decode_move_imm_reg, [0xBE] = decode_move_imm_reg, [0xBF] = decode_move_imm_reg,
+
+	[0xC0] = decode_shift_rm8_imm8,
+	[0xC1] = decode_shift_rm_imm8,
+	[0xC2] = decode_ret_near,
+	[0xC3] = decode_ret_near,
+
+	[0xE0] = decode_loop_rel8,
+	[0xE1] = decode_loop_rel8,
+	[0xE2] = decode_loop_rel8,
+	[0xE4] = decode_in_imm,
+	[0xE5] = decode_in_imm,
+	[0xE6] = decode_out_imm,
+	[0xE7] = decode_out_imm,
+	[0xE8] = decode_call_rel,
+	[0xE9] = decode_jmp_rel,
+	[0xEA] = decode_jmp_far,
+	[0xEB] = decode_jmp_rel8,
+	[0xEC] = decode_in_reg,
+	[0xED] = decode_in_reg,
+	[0xEE] = decode_out_reg,
+	[0xEF] = decode_out_reg,
+
+	[0xF4] = decode_hlt,
+	[0xFA] = decode_cli,
+	[0xFB] = decode_sti,
+	[0xFC] = decode_cld,
+	[0xFD] = decode_std,
+	[0xFE] = decode_inc_dec_rm8,
+};
+
+/* two byte opcode map ( 0F xx ). NULL = #UD */
+static const X86_DECODE_HANDLER decode_0f[256] = {
+	[0x00] = decode_lldt,
+	[0x01] = decode_lgdt_lidt,
+	[0x08] = decode_invd,
+	[0x09] = decode_wbinvd,
+	[0x20] = decode_mov_r32_cr,
+	[0x22] = decode_mov_cr_r32,
+	[0x30] = decode_wrmsr,
+
+	// 16/32 bit JCC
+	[0x80] = decode_jcc_rel, [0x81] = decode_jcc_rel, [0x82] = decode_jcc_rel, [0x83] = decode_jcc_rel,
+	[0x84] = decode_jcc_rel, [0x85] = decode_jcc_rel, [0x86] = decode_jcc_rel, [0x87] = decode_jcc_rel,
+	[0x88] = decode_jcc_rel, [0x89] = decode_jcc_rel, [0x8A] = decode_jcc_rel, [0x8B] = decode_jcc_rel,
+	[0x8C] = decode_jcc_rel, [0x8D] = decode_jcc_rel, [0x8E] = decode_jcc_rel, [0x8F] = decode_jcc_rel,
+
+	[0xB6] = decode_movzx,
+	[0xB7] = decode_movzx,
+	[0xBE] = decode_movsx,
+	[0xBF] = decode_movsx,
+};
+
+/* rep prefixed opcode map ( F3 xx ). NULL = #UD */
+static const X86_DECODE_HANDLER decode_f3[256] = {
+	[0xA4] = decode_rep_movs,
+	[0xA5] = decode_rep_movs,
+	[0xA6] = decode_rep_cmps,
+	[0xA7] = decode_rep_cmps,
+	[0xAA] = decode_rep_stos,
+	[0xAB] = decode_rep_stos,
+	[0xAC] = decode_rep_lods,
+	[0xAD] = decode_rep_lods,
+	[0xAE] = decode_rep_scas,
+	[0xAF] = decode_rep_scas,
+};
+
+/* repne prefixed opcode map ( F2 xx ). NULL = #UD */
+static const X86_DECODE_HANDLER decode_f2[256] = {
+	[0xA6] = decode_rep_cmps,
+	[0xA7] = decode_rep_cmps,
+	[0xAE] = decode_rep_scas,
+	[0xAF] = decode_rep_scas,
+};
 
 void x86CPUGetDefaultSize(X86_CPU* cpu, PREFIX_BYTE_STRUCT* prefix, uint8_t* operand_size, uint8_t* address_size)
 {
-	if (cpu->mode == CPU_PROTECTED_MODE && cpu->segment_descriptors[SEG_CS].default_size == 1) {
+	if (cpu->code_key == X86_CODE_KEY_PROT32) {
 		if (prefix->byte_66)
 			*operand_size = 2;
 		else
@@ -1250,8 +2175,7 @@ int x86CPUFetchPrefixBytes(X86_CPU* cpu, PREFIX_BYTE_STRUCT* prefix, X86_OPCODE*
 			return X86_CPU_ERROR_UD;
 		}
 
-		prefix_bytes[i] = cpu->eip_ptr[*counter];
-		*counter += 1;
+		prefix_bytes[i] = x86CPUFetchByte(cpu, counter);
 
 		switch (prefix_bytes[i]) {
 
@@ -1265,6 +2189,9 @@ int x86CPUFetchPrefixBytes(X86_CPU* cpu, PREFIX_BYTE_STRUCT* prefix, X86_OPCODE*
 			case 0xF3:
 				prefix->byte_f3 = 1;
 				continue;
+			case 0xF2:
+				prefix->byte_f2 = 1;
+				continue;
 			case 0x0F:
 				prefix->byte_0f = 1;
 				continue;
@@ -1287,173 +2214,237 @@ int x86CPUFetchPrefixBytes(X86_CPU* cpu, PREFIX_BYTE_STRUCT* prefix, X86_OPCODE*
 	return 0;
 }
 
-/*EXECUTE*/
-int x86CPUExecute(X86_CPU* cpu)
+/*DECODE*/
+static BYTE override_segment(BYTE prefix)
+{
+	switch (prefix) {
+		case 0x26:
+			return SEG_ES;
+		case 0x2E:
+			return SEG_CS;
+		case 0x36:
+			return SEG_SS;
+		case 0x64:
+			return SEG_FS;
+		case 0x65:
+			return SEG_GS;
+	}
+	return SEG_DS;
+}
+int x86CPUDecode(X86_CPU* cpu, X86_INSTRUCTION* instr)
 {
+	// decode the instruction at eip. the bytes are fetched through the fetch window.
 	int result = 0;
 	uint32_t counter = 0;
 
-	cpu->eip_ptr = x86GetCPUMemoryPtr(cpu, cpu->eip);
-
-	X86_OPCODE opcode = { 0 };
-	PREFIX_BYTE_STRUCT prefix = { 0 };
-	x86CPUFetchPrefixBytes(cpu, &prefix, &opcode, &counter);
+	memset(instr, 0, sizeof(X86_INSTRUCTION));
 
-	uint8_t operand_size = 0;
-	uint8_t addressing_size = 0;
-	x86CPUGetDefaultSize(cpu, &prefix, &operand_size, &addressing_size);
+	x86CPUFetchPrefixBytes(cpu, &instr->prefix, &instr->opcode, &counter);
+	x86CPUGetDefaultSize(cpu, &instr->prefix, &instr->operand_size, &instr->address_size);
 
-	if (prefix.byte_0f) {
-		return decode_opcode_0f(cpu, opcode.byte, addressing_size, operand_size, prefix.segment_override, counter);
+	X86_DECODE_HANDLER decode;
+	if (instr->prefix.byte_0f) {
+		decode = decode_0f[instr->opcode.byte];
+		if (decode == NULL)
+			decode = decode_ud;
+	}
+	else if (instr->prefix.byte_f3) {
+		decode = decode_f3[instr->opcode.byte];
+		if (decode == NULL)
+			decode = decode_ud;
+	}
+	else if (instr->prefix.byte_f2) {
+		decode = decode_f2[instr->opcode.byte];
+		if (decode == NULL)
+			decode = decode_ud;
 	}
-	else if (prefix.byte_f3) {
-		return decode_opcode_f3(cpu, opcode.byte, operand_size, counter);
-	} 
 	else {
-		result = decode_opcode_one_byte(cpu, opcode.byte, operand_size, counter);
-		if (result != 1) // return if decoded or error.
-			return result;
+		decode = decode_one_byte[instr->opcode.byte];
+		if (decode == NULL) // not a one byte opcode; assume mod r/m.
+			decode = decode_opcode_modrm;
 	}
+	instr->segment = SEG_DS;
+	result = decode(cpu, instr, &counter);
 
-	if (opcode.bits.size == 0) {
-		operand_size = 1;
-	}
+	if (instr->prefix.segment_override != 0)
+		instr->segment = override_segment(instr->prefix.segment_override);
 
-	// assume mod r/m byte
-	X86_MOD_RM mode = { 0 };
-	mode.byte = cpu->eip_ptr[counter++];
-		
-	if (opcode.byte == 0xC0) {
-		// C0 = Eb, ib (operand1 = 8 regardless of operand_size) (operand2 = imm8)
-		if (mode.byte >= 0xe0 && mode.byte <= 0xe7) {
-			// SHL r/m 8 imm8
-			shl_reg(cpu, mode.bits.rm, 1, counter);
-			return X86_CPU_ERROR_SUCCESS;
-		}
-		else if (opcode.byte >= 0xe8 && opcode.byte <= 0xef) {
-			// SHR r/m 8 imm8
-			shr_reg(cpu, mode.bits.rm, 1, counter);
-			return X86_CPU_ERROR_SUCCESS;
-		}
-	}
-	else if (opcode.byte == 0xC1) {
-		// C1 = Ev, ib (operand1 = 16 or 32 depending on operand_size) (operand2 = imm8)
-		if (mode.byte >= 0xe0 && mode.byte <= 0xe7) {
-			// SHL r/m 16/32 imm8
-			shl_reg(cpu, mode.bits.rm, operand_size, counter);
-			return X86_CPU_ERROR_SUCCESS;
-		} 
-		else if (mode.byte >= 0xe8 && mode.byte <= 0xef) {
-			// SHR r/m 16/32 imm8
-			shr_reg(cpu, mode.bits.rm, operand_size, counter);
-			return X86_CPU_ERROR_SUCCESS;
-		}
-	}
-	
-	ADDRESSING_MODE_STRUCT addressing_mode = { 0 };
-	ADDRESSING_MODE_FIELD_STRUCT rm = { 0 };
-	uint32_t reg_v = 0;
-	INSTRUCTION_RM reg_type = 0;
-	BYTE direction = 0;	
+	instr->length = counter;
+	instr->stats = x86StatsGetIndex(instr);
+	return result;
+}
 
-	if (opcode.bits.op == 0b100000) {
-		//immediate instruction
-		reg_type = INSTRUCTION_RM_IMM;
-		direction = 0; // direction always const -> reg (cant be reg -> const)
+/*EXECUTE*/
+int x86CPUExecute(X86_CPU* cpu)
+{
+	int result = 0;
+	int executed;
 
-		uint32_t const_size;
-		if (opcode.bits.direction == 1)	// constant is a signed 1 byte operand
-			const_size = 1;
-		else // constant is the same size specified by s.
-			const_size = operand_size;
+	X86_INSTRUCTION* instr = x86CPUFetchInstruction(cpu, &result);
+	if (instr == NULL)
+		return result;
+
+	if (cpu->trace.active)
+		x86TraceBegin(cpu, instr);
 
-		reg_v = x86CPUFetchMemory(cpu, const_size, &counter);		
+	if (cpu->stats.sample_cycles) {
+		uint64_t start = x86StatsReadTsc();
+		result = instr->handler(cpu, instr);
+		cpu->stats.cycles[instr->stats] += x86StatsReadTsc() - start;
+		cpu->stats.samples[instr->stats] += 1;
 	}
 	else {
-		// r/m or SIB
-		reg_type = INSTRUCTION_RM_REGISTER;
-		direction = opcode.bits.direction;
+		result = instr->handler(cpu, instr);
+	}
 
-		reg_v = x86CPUGetRegister(cpu, mode.bits.reg, operand_size);
+	executed = (result == X86_CPU_ERROR_SUCCESS || result == X86_CPU_ERROR_IO);
+	if (executed) {
+		cpu->clock += 1;
+		cpu->stats.count[instr->stats] += 1;
+		if (instr->flags & X86_INSTRUCTION_BRANCH)
+			cpu->profile.block = cpu->eip;
 	}
-	
-	// figure out the addressing mode.
-	get_addressing_mode(cpu, &mode.bits, addressing_size, operand_size, &rm, &counter);
-	
-	// figure out the addressing direction.
-	if (direction == 0) {
-		// reg -> r/m
 
-		addressing_mode.src.value = reg_v;
-		addressing_mode.src.reg = mode.bits.reg;
-		addressing_mode.src.type = reg_type;
+	if (cpu->trace.active)
+		x86TraceEnd(cpu, executed);
+	return result;
+}
 
-		addressing_mode.dest.value = rm.value;
-		addressing_mode.dest.reg = mode.bits.rm;
-		addressing_mode.dest.type = rm.type;
-		addressing_mode.dest.address = rm.address;
-	}
-	else {
-		// r/m -> reg
+X86_EFLAGS* x86CPUGetEflags(X86_CPU* cpu)
+{
+	// assemble the arithmetic flags from the last alu operation.
+	x86AluGetEflags(&cpu->lazy_flags, &cpu->eflags);
+	return &cpu->eflags;
+}
 
-		addressing_mode.src.value = rm.value;
-		addressing_mode.src.reg = mode.bits.rm;
-		addressing_mode.src.type = rm.type;
-		addressing_mode.src.address = rm.address;
+/*RUN*/
+X86_CPU_EXIT_REASON x86CPURun(X86_CPU* cpu, uint64_t max_instructions, uint32_t stop_mask)
+{
+	X86_CPU_EXIT* info = &cpu->exit;
+	uint64_t count = 0;
+	uint64_t end;
+	int result = 0;
+	int resume = (info->reason == X86_CPU_EXIT_BREAKPOINT); // the last run stopped on the breakpoint at info->address
+	uint32_t address;
 
-		addressing_mode.dest.value = reg_v;
-		addressing_mode.dest.reg = mode.bits.reg;
-		addressing_mode.dest.type = reg_type;
-	}
+	cpu->stop_mask = stop_mask;
 
-	// perform instruction.
+	// the run ends after max_instructions of virtual time, including the time skipped while halted.
+	end = max_instructions > UINT64_MAX - cpu->clock ? UINT64_MAX : cpu->clock + max_instructions;
+	cpu->run_end = end;
 
-	uint32_t instr_result = 0;
+	while (cpu->clock < end) {
+		uint64_t remaining;
 
-	if (opcode.bits.op == 0b100000) {
-		// 0x80 - 0x83 ( 1 0 0 0 0 0 X X )
-		result = decode_opcode_extended(cpu, mode.bits.reg, &addressing_mode, operand_size, &instr_result, counter);
-		if (result != 0) {
-			if (result == X86_CPU_ERROR_DECODED)
-				return X86_CPU_ERROR_SUCCESS;
-			else
-				return result;
+		if (cpu->clock >= cpu->events.deadline)
+			x86EventDispatch(cpu);
+
+		if (cpu->hlt) {
+			// nothing runs until an event wakes the cpu; skip to it. with no event to wake it the run ends here.
+			if (cpu->events.deadline == UINT64_MAX)
+				break;
+			if (cpu->events.deadline >= end) {
+				cpu->clock = end;
+				break;
+			}
+			cpu->clock = cpu->events.deadline;
+			continue;
 		}
-	}
-	else {
-		// 0x00 - 0x3F ( X X X X X X )
-		result = decode_opcode(cpu, opcode.bits.op, &addressing_mode, operand_size, &instr_result, counter);
-		if (result != 0) {
-			if (result == X86_CPU_ERROR_DECODED)
-				return X86_CPU_ERROR_SUCCESS;
-			else
-				return result;
+
+		// a run resumes from the breakpoint the last run stopped on; the instruction there runs before it can stop the cpu again.
+		if (stop_mask & X86_CPU_STOP_BREAKPOINT) {
+			address = x86GetEffectiveAddress(cpu, cpu->eip);
+			if (x86CPUIsBreakpoint(cpu, address) && !(resume && address == info->address)) {
+				result = X86_CPU_ERROR_BREAKPOINT;
+				break;
+			}
+		}
+		resume = 0;
+
+		// stop at the next event so it runs on time.
+		remaining = end - cpu->clock;
+		if (cpu->events.deadline - cpu->clock < remaining)
+			remaining = cpu->events.deadline - cpu->clock;
+
+		if (remaining < X86_BLOCK_MAX_INSTRUCTIONS || cpu->trace.active) {
+			// not enough budget left for a whole block, or every instruction has to be traced.
+			result = x86CPUExecute(cpu);
+			if (result == X86_CPU_ERROR_SUCCESS || result == X86_CPU_ERROR_IO)
+				count += 1;
+		}
+		else {
+			uint32_t executed = 0;
+			result = x86CPUExecuteBlock(cpu, remaining > UINT32_MAX ? UINT32_MAX : (uint32_t)remaining, &executed);
+			count += executed;
 		}
+
+		if (result != X86_CPU_ERROR_SUCCESS)
+			break;
 	}
 
-	// set register or memory.
-	switch (addressing_mode.dest.type) {
-		case INSTRUCTION_RM_INDIRECT:
-			set_memory_value(cpu, rm.address, operand_size, instr_result);
+	cpu->stop_mask = 0;
+	cpu->run_end = UINT64_MAX;
+
+	info->error = result;
+	info->address = x86GetEffectiveAddress(cpu, cpu->eip);
+	info->instructions = count;
+
+	switch (result) {
+		case X86_CPU_ERROR_SUCCESS:
+			info->reason = cpu->hlt ? X86_CPU_EXIT_HLT : X86_CPU_EXIT_COUNT;
 			break;
-		case INSTRUCTION_RM_REGISTER:		
-			x86CPUSetRegister(cpu, addressing_mode.dest.reg, operand_size, instr_result);
+		case X86_CPU_ERROR_HLT:
+			info->reason = X86_CPU_EXIT_HLT;
+			break;
+		case X86_CPU_ERROR_UD:
+			info->reason = X86_CPU_EXIT_UD;
+			break;
+		case X86_CPU_ERROR_BREAKPOINT:
+			info->reason = X86_CPU_EXIT_BREAKPOINT;
+			break;
+		case X86_CPU_ERROR_IO:
+			info->reason = X86_CPU_EXIT_IO;
+			break;
+		default:
+			info->reason = X86_CPU_EXIT_FATAL;
 			break;
 	}
 
-	// inc
-	cpu->eip += counter;
+	return info->reason;
+}
+
+/*BREAKPOINTS*/
+int x86CPUAddBreakpoint(X86_CPU* cpu, uint32_t address, int set)
+{
+	if (cpu->breakpoint_count >= X86_CPU_BREAKPOINT_COUNT)
+		return -1;
+
+	cpu->breakpoints[cpu->breakpoint_count].address = address;
+	cpu->breakpoints[cpu->breakpoint_count].set = set;
+
+	// blocks end before a breakpoint; rebuild them.
+	if (set)
+		x86CPUFlushDecodeCache(cpu);
 
+	return cpu->breakpoint_count++;
+}
+int x86CPUIsBreakpoint(X86_CPU* cpu, uint32_t address)
+{
+	for (uint32_t i = 0; i < cpu->breakpoint_count; ++i) {
+		if (cpu->breakpoints[i].set && cpu->breakpoints[i].address == address)
+			return 1;
+	}
 	return 0;
 }
 
 void x86CPUDumpRegisters(X86_CPU* cpu) 
 {
+	X86_EFLAGS* eflags = x86CPUGetEflags(cpu);
 	printf(	"\n\tEAX: %08x\tEBX: %08x\tECX: %08x\tEDX: %08x" \
 			"\n\tESI: %08x\tEDI: %08x\tEBP: %08x\tESP: %08x"\
 			"\n\tCF=%x\tZF=%x\tSF=%x\tOF=%x\tPF=%x"\
 			"\n",
 		cpu->registers[REG_EAX].r32, cpu->registers[REG_EBX].r32, cpu->registers[REG_ECX].r32, cpu->registers[REG_EDX].r32,
 		cpu->registers[REG_ESI].r32, cpu->registers[REG_EDI].r32, cpu->registers[REG_EBP].r32, cpu->registers[REG_ESP].r32,
-		cpu->eflags.CF, cpu->eflags.ZF, cpu->eflags.SF, cpu->eflags.OF, cpu->eflags.PF);
+		eflags->CF, eflags->ZF, eflags->SF, eflags->OF, eflags->PF);
 };
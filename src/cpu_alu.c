@@ -62,71 +62,116 @@ BYTE set_carry(int32_t a, int32_t b, uint32_t operand_size)
 	return 0;
 }
 
-int x86Alu(X86_EFLAGS* eflags, INSTRUCTION_TYPE type, uint32_t operand1, uint32_t operand2, uint32_t operand_size, uint32_t* result)
+void x86InitLazyFlags(X86_LAZY_FLAGS* flags)
+{
+	// a logic op with a non zero result; all flags clear.
+	flags->operand1 = 0;
+	flags->operand2 = 0;
+	flags->result = 1;
+	flags->type = INSTRUCTION_TYPE_AND;
+	flags->operand_size = 4;
+	flags->CF = 0;
+}
+
+int x86Alu(X86_LAZY_FLAGS* flags, INSTRUCTION_TYPE type, uint32_t operand1, uint32_t operand2, uint32_t operand_size, uint32_t* result)
 {
 	uint32_t r = 0;
 	switch (type) {
 		case INSTRUCTION_TYPE_INC: // preserve CF; set OF, AF, ZF, PSF, F
 			r = (operand1 + 1);
-			eflags->OF = set_overflow_add(operand1, 1, r, operand_size);
+			operand2 = 1;
 			break;
 		
 		case INSTRUCTION_TYPE_DEC: // preserve CF; set OF, AF, ZF, SF, PF
 			r = (operand1 - 1);
-			eflags->OF = set_overflow_sub(operand1, 1, r, operand_size);
+			operand2 = 1;
 			break;
 		
 		case INSTRUCTION_TYPE_ADD: // set OF, CF, AF, ZF, SF, PF
 			r = (operand1 + operand2);
-			eflags->OF = set_overflow_add(operand1, operand2, r, operand_size);
-			eflags->CF = set_carry(r, operand1, operand_size);
+			flags->CF = set_carry(r, operand1, operand_size);
 			break;
 
 		case INSTRUCTION_TYPE_SUB: // set OF, CF, AF, ZF, SF, PF
 		case INSTRUCTION_TYPE_CMP:
 			r = (operand1 - operand2);
-			eflags->OF = set_overflow_sub(operand1, operand2, r, operand_size);
-			eflags->CF = set_carry(operand1, operand2, operand_size);
+			flags->CF = set_carry(operand1, operand2, operand_size);
 			break;
 
 		case INSTRUCTION_TYPE_AND: // clear: OF, CF; set ZF, SF, PF; AF undefined
 			r = (operand1 & operand2);
-			eflags->OF = 0;
-			eflags->CF = 0;
+			flags->CF = 0;
 			break;
 		
 		case INSTRUCTION_TYPE_XOR: // clear: OF, CF; set ZF, SF, PF; AF undefined
 			r = (operand1 ^ operand2);
-			eflags->OF = 0;
-			eflags->CF = 0;
+			flags->CF = 0;
 			break;
 		
 		case INSTRUCTION_TYPE_OR: // clear: OF, CF; set ZF, SF, PF; AF undefined
 			r = (operand1 | operand2);
-			eflags->OF = 0;
-			eflags->CF = 0;
+			flags->CF = 0;
 			break;
 
 		case INSTRUCTION_TYPE_ADC: // set OF, SF, ZF, AF, CF, PF
-			r = operand1 + operand2 + eflags->CF;
-			eflags->OF = set_overflow_add(operand1, operand2, r, operand_size);
-			eflags->CF = set_carry(r, operand1, operand_size) || (eflags->CF && operand1 == r);
+			r = operand1 + operand2 + flags->CF;
+			flags->CF = set_carry(r, operand1, operand_size) || (flags->CF && operand1 == r);
 			break;
 
 		case INSTRUCTION_TYPE_SBB: // set OF, SF, ZF, AF, CF, PF
-			r = operand1 - operand2 - eflags->CF;
-			eflags->OF = set_overflow_sub(operand1, operand2, r, operand_size);
-			eflags->CF = set_carry(operand1, operand2, operand_size) || (eflags->CF && operand1 == operand2);
+			r = operand1 - operand2 - flags->CF;
+			flags->CF = set_carry(operand1, operand2, operand_size) || (flags->CF && operand1 == operand2);
 			break;
 	}
 
-	eflags->ZF = (r == 0);
-	eflags->SF = (r >> (operand_size * 8 - 1)) & 1;
-	eflags->PF = (r % 2 == 0);
+	// OF, ZF, SF and PF are computed when read.
+	flags->operand1 = operand1;
+	flags->operand2 = operand2;
+	flags->result = r;
+	flags->type = type;
+	flags->operand_size = operand_size;
 			
 	if (result != NULL) {
 		*result = r;
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/* FLAG READ */
+BYTE x86AluOF(const X86_LAZY_FLAGS* flags)
+{
+	switch (flags->type) {
+		case INSTRUCTION_TYPE_INC:
+		case INSTRUCTION_TYPE_ADD:
+		case INSTRUCTION_TYPE_ADC:
+			return set_overflow_add(flags->operand1, flags->operand2, flags->result, flags->operand_size);
+
+		case INSTRUCTION_TYPE_DEC:
+		case INSTRUCTION_TYPE_SUB:
+		case INSTRUCTION_TYPE_CMP:
+		case INSTRUCTION_TYPE_SBB:
+			return set_overflow_sub(flags->operand1, flags->operand2, flags->result, flags->operand_size);
+	}
+	return 0; // AND, XOR, OR
+}
+BYTE x86AluZF(const X86_LAZY_FLAGS* flags)
+{
+	return (flags->result == 0);
+}
+BYTE x86AluSF(const X86_LAZY_FLAGS* flags)
+{
+	return (flags->result >> (flags->operand_size * 8 - 1)) & 1;
+}
+BYTE x86AluPF(const X86_LAZY_FLAGS* flags)
+{
+	return (flags->result % 2 == 0);
+}
+void x86AluGetEflags(const X86_LAZY_FLAGS* flags, X86_EFLAGS* eflags)
+{
+	eflags->CF = flags->CF;
+	eflags->PF = x86AluPF(flags);
+	eflags->ZF = x86AluZF(flags);
+	eflags->SF = x86AluSF(flags);
+	eflags->OF = x86AluOF(flags);
+}
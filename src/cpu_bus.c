@@ -0,0 +1,272 @@
+// cpu_bus.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_bus.h"
+#include "cpu_cache.h"
+#include "cpu_tlb.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Memory bus
+
+	Physical memory is a list of regions and a page table that holds the region
+	index of every 4KB page, so resolving an address is one load. Regions are
+	registered in order and each one takes over the pages it covers.
+
+	Ram, rom and mirrors are host memory and go into the TLB like before; mmio
+	pages never do, so only their accesses pay for the region lookup and the
+	call into the device. */
+
+static void map_pages(X86_CPU* cpu, uint32_t index)
+{
+	X86_BUS* bus = &cpu->bus;
+	X86_BUS_REGION* region = &bus->regions[index];
+	uint32_t page;
+	uint32_t i;
+
+	for (i = 1; i < bus->region_count; ++i) {
+		if (i != index && bus->regions[i].mapped && region->base <= bus->regions[i].end && region->end >= bus->regions[i].base)
+			bus->regions[i < index ? i : index].split = 1;
+	}
+
+	for (page = region->base >> X86_BUS_PAGE_SHIFT; page <= region->end >> X86_BUS_PAGE_SHIFT; ++page) {
+		bus->pages[page] = (uint8_t)index;
+	}
+	region->mapped = 1;
+}
+static void remap_pages(X86_CPU* cpu)
+{
+	X86_BUS* bus = &cpu->bus;
+	uint32_t i;
+
+	// lay every mapped region down again in order; a moved region keeps its place in the order.
+	memset(bus->pages, 0, X86_BUS_PAGE_COUNT);
+	for (i = 1; i < bus->region_count; ++i) {
+		bus->regions[i].split = 0;
+	}
+	for (i = 1; i < bus->region_count; ++i) {
+		if (bus->regions[i].mapped)
+			map_pages(cpu, i);
+	}
+
+	x86TlbFlush(cpu);
+	x86CPUFlushDecodeCache(cpu);
+}
+static int check_range(uint32_t base, uint32_t end)
+{
+	return end < base || (base & (X86_BUS_PAGE_SIZE - 1)) != 0 || ((end + 1) & (X86_BUS_PAGE_SIZE - 1)) != 0;
+}
+static int add_region(X86_CPU* cpu, X86_BUS_REGION* region)
+{
+	X86_BUS* bus = &cpu->bus;
+	uint32_t index = bus->region_count;
+
+	if (index >= X86_BUS_REGION_MAX)
+		return 1;
+	if (check_range(region->base, region->end))
+		return 1;
+
+	bus->regions[index] = *region;
+	bus->region_count += 1;
+	map_pages(cpu, index);
+
+	// the pages may be cached as something else.
+	x86TlbFlush(cpu);
+	x86CPUFlushDecodeCache(cpu);
+	return 0;
+}
+
+int x86InitBus(X86_CPU* cpu)
+{
+	X86_BUS* bus = &cpu->bus;
+	X86_BUS_REGION* unmapped = &bus->regions[0];
+
+	bus->pages = (uint8_t*)malloc(X86_BUS_PAGE_COUNT);
+	if (bus->pages == NULL)
+		return 1;
+
+	memset(bus->regions, 0, sizeof(bus->regions));
+	memset(bus->pages, 0, X86_BUS_PAGE_COUNT);
+
+	// region 0; the space no region covers.
+	unmapped->type = X86_BUS_UNMAPPED;
+	unmapped->base = 0;
+	unmapped->end = 0xFFFFFFFF;
+	bus->region_count = 1;
+
+	if (x86BusAddMemory(cpu, X86_BUS_RAM, cpu->mem.ram_base, cpu->mem.ram_end, cpu->mem.ram, X86_BUS_READ | X86_BUS_WRITE | X86_BUS_EXECUTE) != 0)
+		return 1;
+	if (x86BusAddMemory(cpu, X86_BUS_ROM, cpu->mem.rom_base, cpu->mem.rom_end, cpu->mem.rom, X86_BUS_READ | X86_BUS_EXECUTE) != 0)
+		return 1;
+
+	return 0;
+}
+void x86FreeBus(X86_CPU* cpu)
+{
+	X86_BUS* bus = &cpu->bus;
+	if (bus->pages != NULL) {
+		free(bus->pages);
+		bus->pages = NULL;
+	}
+	bus->region_count = 0;
+}
+
+int x86BusAddMemory(X86_CPU* cpu, X86_BUS_REGION_TYPE type, uint32_t base, uint32_t end, BYTE* host, uint32_t attributes)
+{
+	X86_BUS_REGION region = { 0 };
+
+	if ((type != X86_BUS_RAM && type != X86_BUS_ROM) || host == NULL)
+		return 1;
+
+	region.type = type;
+	region.attributes = attributes;
+	region.base = base;
+	region.end = end;
+	region.host = host;
+	return add_region(cpu, &region);
+}
+int x86BusAddMmio(X86_CPU* cpu, uint32_t base, uint32_t end, X86_BUS_READ_HANDLER read, X86_BUS_WRITE_HANDLER write, void* device)
+{
+	X86_BUS_REGION region = { 0 };
+
+	region.type = X86_BUS_MMIO;
+	region.attributes = (read != NULL ? X86_BUS_READ : 0) | (write != NULL ? X86_BUS_WRITE : 0);
+	region.base = base;
+	region.end = end;
+	region.read = read;
+	region.write = write;
+	region.device = device;
+	return add_region(cpu, &region);
+}
+int x86BusAddMirror(X86_CPU* cpu, uint32_t base, uint32_t end, uint32_t target, uint32_t target_size)
+{
+	X86_BUS_REGION region = { 0 };
+	X86_BUS_REGION* memory = x86BusGetRegion(cpu, target);
+
+	// the target must be whole pages of one memory region, so every mirror page maps to one host page.
+	if (target_size == 0 || (target_size & (X86_BUS_PAGE_SIZE - 1)) != 0 || target + (target_size - 1) < target)
+		return 1;
+	if ((memory->type != X86_BUS_RAM && memory->type != X86_BUS_ROM) || target + (target_size - 1) > memory->end)
+		return 1;
+
+	// decoded code is keyed on the linear address; a write through one alias would not invalidate code decoded at another.
+	if (memory->attributes & X86_BUS_WRITE)
+		return 1;
+
+	region.type = X86_BUS_MIRROR;
+	region.attributes = memory->attributes;
+	region.base = base;
+	region.end = end;
+	region.host = memory->host + (target - memory->base);
+	region.target = target;
+	region.target_size = target_size;
+	return add_region(cpu, &region);
+}
+
+int x86BusMapRegion(X86_CPU* cpu, uint32_t index, uint32_t base, uint32_t end)
+{
+	X86_BUS_REGION* region = &cpu->bus.regions[index];
+
+	// only mmio moves; memory regions hold host memory for their one range.
+	if (index == 0 || index >= cpu->bus.region_count || region->type != X86_BUS_MMIO || check_range(base, end))
+		return 1;
+
+	if (region->mapped && region->base == base && region->end == end)
+		return 0;
+
+	region->base = base;
+	region->end = end;
+	region->mapped = 1;
+	remap_pages(cpu);
+	return 0;
+}
+void x86BusUnmapRegion(X86_CPU* cpu, uint32_t index)
+{
+	X86_BUS_REGION* region = &cpu->bus.regions[index];
+
+	if (index == 0 || index >= cpu->bus.region_count || !region->mapped)
+		return;
+
+	region->mapped = 0;
+	remap_pages(cpu);
+}
+
+X86_BUS_REGION* x86BusGetRegion(X86_CPU* cpu, uint32_t address)
+{
+	return &cpu->bus.regions[cpu->bus.pages[address >> X86_BUS_PAGE_SHIFT]];
+}
+BYTE* x86BusGetHostPage(X86_CPU* cpu, uint32_t address, uint32_t attributes)
+{
+	X86_BUS_REGION* region = x86BusGetRegion(cpu, address);
+	uint32_t page = address & ~(X86_BUS_PAGE_SIZE - 1);
+
+	if (region->host == NULL || (region->attributes & attributes) != attributes)
+		return NULL;
+
+	if (region->type == X86_BUS_MIRROR)
+		return region->host + (page - region->base) % region->target_size;
+	return region->host + (page - region->base);
+}
+
+uint32_t x86BusRead(X86_CPU* cpu, uint32_t address, uint32_t size)
+{
+	X86_BUS_REGION* region = x86BusGetRegion(cpu, address);
+	BYTE* page;
+
+	if (region->type == X86_BUS_MMIO) {
+		if (region->read == NULL)
+			return 0;
+		return region->read(region->device, address - region->base, size);
+	}
+
+	page = x86BusGetHostPage(cpu, address, X86_BUS_READ);
+	if (page == NULL)
+		return 0;
+
+	page += address & (X86_BUS_PAGE_SIZE - 1);
+	switch (size) {
+		case 1:
+			return *(uint8_t*)page;
+		case 2:
+			return *(uint16_t*)page;
+		case 4:
+			return *(uint32_t*)page;
+	}
+	return 0;
+}
+void x86BusWrite(X86_CPU* cpu, uint32_t address, uint32_t size, uint32_t value)
+{
+	X86_BUS_REGION* region = x86BusGetRegion(cpu, address);
+	BYTE* page;
+
+	if (region->type == X86_BUS_MMIO) {
+		if (region->write != NULL)
+			region->write(region->device, address - region->base, size, value);
+		return;
+	}
+
+	page = x86BusGetHostPage(cpu, address, X86_BUS_WRITE);
+	if (page == NULL)
+		return;
+
+	x86CPUInvalidateCode(cpu, address, size);
+	page += address & (X86_BUS_PAGE_SIZE - 1);
+	switch (size) {
+		case 1:
+			*(uint8_t*)page = (uint8_t)value;
+			break;
+		case 2:
+			*(uint16_t*)page = (uint16_t)value;
+			break;
+		case 4:
+			*(uint32_t*)page = value;
+			break;
+	}
+}
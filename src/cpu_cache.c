@@ -0,0 +1,496 @@
+// cpu_cache.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_cache.h"
+#include "cpu_jit.h"
+#include "cpu_memory.h"
+#include "cpu_tlb.h"
+#include "cpu_stats.h"
+#include "cpu_io.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Decoded instruction cache.
+	Direct mapped on the linear address of the instruction. Entries are tagged with
+	the cache generation; a flush bumps the generation instead of clearing the entries
+	so an instruction that writes to its own page can still finish executing.
+	Pages holding decoded instructions are tracked in a bitmap so only writes to code
+	pages flush the cache.
+
+	Basic blocks are straight-line runs of decoded instructions ending at a branch,
+	hlt, a segment load or the end of the code page. They share the generation and
+	code page bitmap with the instruction cache. Each block keeps links to the blocks
+	it last exited to, so hot loops dispatch block to block without a lookup. Blocks
+	that run X86_JIT_THRESHOLD times are handed to the jit.
+
+	A block that branches to its own start and only writes registers and flags is a
+	poll loop; a wait on a port, a memory flag or nothing at all. When an iteration
+	leaves the registers and flags as it found them, every later one reads the same
+	values until an event changes a device, so the rest of the budget is skipped
+	in virtual time instead of executed. */
+
+#define CODE_PAGE(address) ((address) >> X86_DECODE_CACHE_PAGE_SHIFT)
+
+/* opcode handlers; cpu.c */
+int move_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int move_ptr_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int inc_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int dec_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int shr_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int shl_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int jmp_imm_rel(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int jcc(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int cmp_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int in_byte_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int in_byte_imm(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int movzx(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int movsx(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int and_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int or_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int add_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int sub_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int nop(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int xchg_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int modrm_op(X86_CPU* cpu, X86_INSTRUCTION* instr);
+
+typedef struct _POLL_STATE {
+	X86_GENERAL_REGISTER registers[X86_GENERAL_REGISTER_COUNT];
+	X86_LAZY_FLAGS flags;
+	uint32_t eip;
+} POLL_STATE;
+
+static int is_code_page(X86_DECODE_CACHE* cache, uint32_t page)
+{
+	return (cache->code_pages[page >> 3] >> (page & 7)) & 1;
+}
+
+static void mark_code_page(X86_CPU* cpu, uint32_t page)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	if (is_code_page(cache, page))
+		return;
+	cache->code_pages[page >> 3] |= (1 << (page & 7));
+
+	// writes to the page must now go through x86CPUInvalidateCode.
+	x86TlbFlushPage(cpu, page << X86_DECODE_CACHE_PAGE_SHIFT);
+}
+
+int x86InitDecodeCache(X86_CPU* cpu)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+
+	cache->entries = (X86_DECODE_CACHE_ENTRY*)malloc(sizeof(X86_DECODE_CACHE_ENTRY) * X86_DECODE_CACHE_SIZE);
+	cache->blocks = (X86_BLOCK*)malloc(sizeof(X86_BLOCK) * X86_BLOCK_CACHE_SIZE);
+	cache->code_pages = (uint8_t*)malloc(X86_DECODE_CACHE_PAGE_COUNT / 8);
+
+	if (cache->entries == NULL || cache->blocks == NULL || cache->code_pages == NULL)
+		return 1;
+
+	memset(cache->entries, 0, sizeof(X86_DECODE_CACHE_ENTRY) * X86_DECODE_CACHE_SIZE);
+	memset(cache->blocks, 0, sizeof(X86_BLOCK) * X86_BLOCK_CACHE_SIZE);
+	memset(cache->code_pages, 0, X86_DECODE_CACHE_PAGE_COUNT / 8);
+	cache->generation = 1;
+
+	return 0;
+}
+void x86FreeDecodeCache(X86_CPU* cpu)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+
+	if (cache->entries != NULL) {
+		free(cache->entries);
+		cache->entries = NULL;
+	}
+	if (cache->blocks != NULL) {
+		free(cache->blocks);
+		cache->blocks = NULL;
+	}
+	if (cache->code_pages != NULL) {
+		free(cache->code_pages);
+		cache->code_pages = NULL;
+	}
+}
+void x86CPUFlushDecodeCache(X86_CPU* cpu)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+
+	if (cache->entries == NULL)
+		return;
+
+	cache->generation += 1;
+	if (cache->generation == 0) {
+		// generation wrapped; old entries could match again.
+		x86StatsCollect(cpu);
+		memset(cache->entries, 0, sizeof(X86_DECODE_CACHE_ENTRY) * X86_DECODE_CACHE_SIZE);
+		memset(cache->blocks, 0, sizeof(X86_BLOCK) * X86_BLOCK_CACHE_SIZE);
+		cache->generation = 1;
+	}
+	memset(cache->code_pages, 0, X86_DECODE_CACHE_PAGE_COUNT / 8);
+}
+int x86CPUIsCodePage(X86_CPU* cpu, uint32_t address)
+{
+	if (cpu->decode_cache.code_pages == NULL)
+		return 0;
+	return is_code_page(&cpu->decode_cache, CODE_PAGE(address));
+}
+void x86CPUInvalidateCode(X86_CPU* cpu, uint32_t address, uint32_t size)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+
+	if (cache->code_pages == NULL || size == 0)
+		return;
+
+	// string instructions write whole ranges; check every page the write touches.
+	uint32_t page = CODE_PAGE(address);
+	uint32_t last = CODE_PAGE(address + size - 1);
+	for (;;) {
+		if (is_code_page(cache, page)) {
+			x86CPUFlushDecodeCache(cpu);
+			return;
+		}
+		if (page == last)
+			break;
+		page = (page + 1) & (X86_DECODE_CACHE_PAGE_COUNT - 1);
+	}
+}
+
+X86_INSTRUCTION* x86CPUFetchInstruction(X86_CPU* cpu, int* result)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	uint32_t address = x86GetEffectiveAddress(cpu, cpu->eip);
+	uint8_t key = cpu->code_key; // the decode depends on the cpu mode and the default operand/address size of cs.
+	X86_DECODE_CACHE_ENTRY* entry = &cache->entries[address & (X86_DECODE_CACHE_SIZE - 1)];
+
+	*result = X86_CPU_ERROR_SUCCESS;
+
+	if (entry->generation == cache->generation && entry->address == address && entry->key == key) {
+		// hit
+		cpu->eip_ptr = entry->ptr;
+		return &entry->instr;
+	}
+
+	// miss; decode the instruction into the entry.
+	cpu->eip_ptr = x86GetCPUFetchPtr(cpu, cpu->eip);
+	if (cpu->eip_ptr == NULL) {
+		*result = X86_CPU_ERROR_FATAL;
+		return NULL;
+	}
+
+	entry->generation = 0;
+	*result = x86CPUDecode(cpu, &entry->instr);
+	if (*result != X86_CPU_ERROR_SUCCESS)
+		return NULL;
+
+	entry->address = address;
+	entry->key = key;
+	entry->ptr = cpu->eip_ptr;
+	entry->generation = cache->generation;
+
+	mark_code_page(cpu, CODE_PAGE(address));
+	mark_code_page(cpu, CODE_PAGE(address + entry->instr.length - 1));
+
+	return &entry->instr;
+}
+
+static int is_block(X86_DECODE_CACHE* cache, X86_BLOCK* block, uint32_t address, uint8_t key)
+{
+	return block != NULL && block->generation == cache->generation && block->address == address && block->key == key;
+}
+static int is_poll_instruction(X86_INSTRUCTION* instr)
+{
+	// the instruction may read registers, memory and ports but only writes registers and flags.
+	X86_INSTRUCTION_HANDLER handler = instr->handler;
+
+	if (handler == modrm_op) {
+		uint32_t op = instr->opcode.bits.op;
+		if (instr->mode.bits.mod == 3)
+			return 1;
+		if (op == 0b100000)
+			return instr->mode.bits.reg == 0b111; // cmp r/m, imm
+		if (op == 0b100001 || op == 0b111111)
+			return 0; // xchg, jmp
+		return instr->opcode.bits.direction == 1 || op == 0b001110; // r/m -> reg, cmp
+	}
+
+	return handler == move_imm_reg || handler == move_ptr_reg || handler == inc_reg || handler == dec_reg ||
+		handler == shr_reg || handler == shl_reg || handler == cmp_imm_reg || handler == and_imm_reg ||
+		handler == or_imm_reg || handler == add_imm_reg || handler == sub_imm_reg || handler == in_byte_reg ||
+		handler == in_byte_imm || handler == movzx || handler == movsx || handler == xchg_reg || handler == nop;
+}
+static int is_poll_block(X86_BLOCK* block, uint32_t length)
+{
+	X86_INSTRUCTION* last = &block->instr[block->count - 1];
+
+	// the block must end in a branch to its own start.
+	if ((last->handler != jcc && last->handler != jmp_imm_rel) || (int)last->imm != -(int)length)
+		return 0;
+
+	for (uint32_t i = 0; i < block->count - 1u; ++i) {
+		if (!is_poll_instruction(&block->instr[i]))
+			return 0;
+	}
+	return 1;
+}
+
+static X86_BLOCK* build_block(X86_CPU* cpu, X86_BLOCK* block, uint32_t address, uint8_t key, int* result)
+{
+	// decode instructions from eip until a branch or the end of the code page.
+
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	uint32_t eip = cpu->eip;
+	uint8_t* eip_ptr = cpu->eip_ptr;
+	uint32_t page = CODE_PAGE(address);
+	uint32_t offset = 0;
+
+	// the runs of the translated block that was here count for the instructions it held.
+	x86StatsAddBlock(cpu, block);
+
+	block->generation = 0;
+	block->count = 0;
+	block->flags = 0;
+	block->hits = 0;
+	block->native = NULL;
+	block->link[0] = NULL;
+	block->link[1] = NULL;
+	block->ptr = (uint8_t*)x86GetCPUFetchPtr(cpu, eip);
+	if (block->ptr == NULL) {
+		*result = X86_CPU_ERROR_FATAL;
+		return NULL;
+	}
+
+	while (block->count < X86_BLOCK_MAX_INSTRUCTIONS) {
+		X86_INSTRUCTION* instr = &block->instr[block->count];
+
+		cpu->eip = eip + offset;
+		if (CODE_PAGE(x86GetEffectiveAddress(cpu, cpu->eip)) != page)
+			break;
+
+		// end the block before a breakpoint so the run loop sees it.
+		if (block->count != 0 && cpu->breakpoint_count != 0 && x86CPUIsBreakpoint(cpu, x86GetEffectiveAddress(cpu, cpu->eip)))
+			break;
+
+		cpu->eip_ptr = block->ptr + offset;
+		*result = x86CPUDecode(cpu, instr);
+		if (*result != X86_CPU_ERROR_SUCCESS)
+			break;
+
+		block->count += 1;
+		offset += instr->length;
+
+		if (instr->flags & X86_INSTRUCTION_BRANCH)
+			break;
+	}
+
+	cpu->eip = eip;
+
+	if (block->count == 0) {
+		// the first instruction failed to decode.
+		cpu->eip_ptr = block->ptr;
+		return NULL;
+	}
+
+	// an instruction that failed to decode after the first is left for the next block.
+	*result = X86_CPU_ERROR_SUCCESS;
+	cpu->eip_ptr = eip_ptr;
+
+	if (is_poll_block(block, offset))
+		block->flags |= X86_BLOCK_POLL;
+
+	block->address = address;
+	block->key = key;
+	block->generation = cache->generation;
+
+	mark_code_page(cpu, page);
+	mark_code_page(cpu, CODE_PAGE(address + offset - 1));
+
+	return block;
+}
+static X86_BLOCK* get_block(X86_CPU* cpu, X86_BLOCK* prev, uint8_t key, int* result)
+{
+	// get the block at eip; follow the links of the previous block first.
+
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	uint32_t address = x86GetEffectiveAddress(cpu, cpu->eip);
+	X86_BLOCK* block;
+
+	if (prev != NULL) {
+		if (is_block(cache, prev->link[0], address, key))
+			return prev->link[0];
+		if (is_block(cache, prev->link[1], address, key))
+			return prev->link[1];
+	}
+
+	block = &cache->blocks[address & (X86_BLOCK_CACHE_SIZE - 1)];
+	if (!is_block(cache, block, address, key)) {
+		block = build_block(cpu, block, address, key, result);
+		if (block == NULL)
+			return NULL;
+	}
+
+	if (prev != NULL && prev->generation == cache->generation) {
+		// link the previous block to this one.
+		if (prev->link[0] == NULL || prev->link[0]->generation != cache->generation)
+			prev->link[0] = block;
+		else
+			prev->link[1] = block;
+	}
+
+	return block;
+}
+static int execute_block(X86_CPU* cpu, X86_BLOCK* block, uint32_t* count)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	uint32_t generation = cache->generation;
+	uint32_t offset = 0;
+	int result = 0;
+
+	if (block->native == NULL) {
+		block->hits += 1;
+		if (block->hits == X86_JIT_THRESHOLD)
+			block->native = x86JitCompile(cpu, block);
+	}
+
+	if (block->native != NULL) {
+		// the translated code keeps cpu->clock current; a block that exits early counts the instructions it ran.
+		cpu->jit.retired = block->count;
+		result = block->native(cpu);
+		*count += cpu->jit.retired;
+		if (cpu->jit.retired == block->count) {
+			block->runs += 1;
+		}
+		else {
+			for (uint32_t i = 0; i < cpu->jit.retired; ++i) {
+				cpu->stats.count[block->instr[i].stats] += 1;
+			}
+		}
+		cpu->profile.block = cpu->eip;
+		return result;
+	}
+
+	for (uint32_t i = 0; i < block->count; ++i) {
+		X86_INSTRUCTION* instr = &block->instr[i];
+
+		cpu->eip_ptr = block->ptr + offset;
+		if (cpu->stats.sample_cycles) {
+			uint64_t start = x86StatsReadTsc();
+			result = instr->handler(cpu, instr);
+			cpu->stats.cycles[instr->stats] += x86StatsReadTsc() - start;
+			cpu->stats.samples[instr->stats] += 1;
+		}
+		else {
+			result = instr->handler(cpu, instr);
+		}
+		if (result != X86_CPU_ERROR_SUCCESS && result != X86_CPU_ERROR_IO)
+			return result; // the instruction did not run; counted like x86CPUExecute does.
+
+		*count += 1;
+		cpu->clock += 1;
+		cpu->stats.count[instr->stats] += 1;
+		if (result != X86_CPU_ERROR_SUCCESS)
+			return result;
+
+		if (cache->generation != generation)
+			break; // the block wrote to code; the rest of the block may be stale.
+
+		offset += instr->length;
+	}
+
+	// eip starts the next block.
+	cpu->profile.block = cpu->eip;
+	return X86_CPU_ERROR_SUCCESS;
+}
+static void save_poll_state(X86_CPU* cpu, POLL_STATE* state)
+{
+	memcpy(state->registers, cpu->registers, sizeof(state->registers));
+	state->flags = cpu->lazy_flags;
+	state->eip = cpu->eip;
+}
+static int is_idle(X86_CPU* cpu, POLL_STATE* state)
+{
+	// the iteration came back to the start with nothing changed.
+	X86_LAZY_FLAGS* flags = &cpu->lazy_flags;
+
+	if (cpu->eip != state->eip || memcmp(state->registers, cpu->registers, sizeof(state->registers)) != 0)
+		return 0;
+	if (flags->operand1 != state->flags.operand1 || flags->operand2 != state->flags.operand2 || flags->result != state->flags.result ||
+		flags->type != state->flags.type || flags->operand_size != state->flags.operand_size || flags->CF != state->flags.CF)
+		return 0;
+
+	// a trace keeps every in; a breakpoint at the loop stops it before time moves on.
+	if (cpu->io.trace.mode != X86_IO_TRACE_MODE_OFF)
+		return 0;
+	if ((cpu->stop_mask & X86_CPU_STOP_BREAKPOINT) && cpu->breakpoint_count != 0 && x86CPUIsBreakpoint(cpu, x86GetEffectiveAddress(cpu, cpu->eip)))
+		return 0;
+
+	return 1;
+}
+static inline int execute_blocks(X86_CPU* cpu, const uint8_t key, uint32_t max_instructions, uint32_t* count)
+{
+	// run blocks decoded for one code key; returns when the cpu mode or cs changes.
+	X86_BLOCK* block = NULL;
+	POLL_STATE poll;
+	uint64_t end = cpu->clock + max_instructions;
+	int result = 0;
+
+	*count = 0;
+
+	for (uint32_t i = 0; i < X86_BLOCK_CHAIN_MAX; ++i) {
+		if (i != 0 && (cpu->stop_mask & X86_CPU_STOP_BREAKPOINT) && cpu->breakpoint_count != 0) {
+			if (x86CPUIsBreakpoint(cpu, x86GetEffectiveAddress(cpu, cpu->eip)))
+				return X86_CPU_ERROR_BREAKPOINT;
+		}
+
+		block = get_block(cpu, block, key, &result);
+		if (block == NULL)
+			return result;
+
+		if (cpu->clock >= end || block->count > end - cpu->clock)
+			break; // out of budget; the block is left for the next call.
+
+		if (block->flags & X86_BLOCK_POLL)
+			save_poll_state(cpu, &poll);
+
+		result = execute_block(cpu, block, count);
+		if (result != X86_CPU_ERROR_SUCCESS || cpu->hlt)
+			break;
+
+		if ((block->flags & X86_BLOCK_POLL) && is_idle(cpu, &poll)) {
+			// skip the whole iterations left in the budget; the caller stops the budget at the next event.
+			cpu->clock += (end - cpu->clock) / block->count * block->count;
+			break;
+		}
+
+		if (cpu->code_key != key)
+			break; // mode switch; the caller picks the loop for the new mode.
+	}
+
+	return result;
+}
+int x86CPUExecuteBlock(X86_CPU* cpu, uint32_t max_instructions, uint32_t* count)
+{
+	int result;
+
+	// the key is a constant in the real mode 16bit and protected mode 32bit loops, which only takes the load of the key out
+	// of the block lookup. decode and the handlers are shared; they take the operand and address size from the decoded
+	// instruction at run time, and decode reads cpu->code_key once per instruction it decodes.
+	switch (cpu->code_key) {
+		case X86_CODE_KEY_PROT32:
+			result = execute_blocks(cpu, X86_CODE_KEY_PROT32, max_instructions, count);
+			break;
+		case X86_CODE_KEY_REAL16:
+			result = execute_blocks(cpu, X86_CODE_KEY_REAL16, max_instructions, count);
+			break;
+		default:
+			result = execute_blocks(cpu, cpu->code_key, max_instructions, count);
+			break;
+	}
+
+	return result;
+}
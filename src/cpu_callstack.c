@@ -0,0 +1,281 @@
+// cpu_callstack.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_callstack.h"
+#include "cpu_memory.h"
+#include "cpu_profile.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Shadow call stack
+
+	CALL pushes a frame for the function it enters and RET pops back to the
+	frame that called from the address it returns to. A RET that matches no
+	frame, a push and ret used as a jump, leaves the stack alone. A far jump
+	changes the meaning of every saved return address, so it drops the frames
+	and the function it enters starts a new path.
+
+	Each distinct path is a node in a call tree; a frame is the node of its
+	path. Instructions are charged to the top frame in one go at each call,
+	return and far jump, from the difference in cpu->clock, so nothing is done
+	per instruction. Totals are summed up the tree when it is read; a callee
+	node is always made after its caller, so one pass from the end does it. */
+
+#define CALL_TREE_SIZE 0x400 // nodes the tree starts with
+#define CALL_NAME_SIZE (X86_PROFILE_NAME_SIZE + 8)
+
+typedef struct _CALL_ENTRY {
+	uint64_t total;
+	uint32_t node;
+} CALL_ENTRY;
+
+static void charge(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	stack->nodes[stack->frames[stack->depth - 1].node].self += cpu->clock - stack->clock;
+	stack->clock = cpu->clock;
+}
+static uint32_t get_node(X86_CALL_STACK* stack, uint32_t parent, uint32_t address)
+{
+	// the callee node of parent entered at address; made if there is none. returns 0 if the tree could not grow.
+	X86_CALL_NODE* node;
+	uint32_t i;
+
+	for (i = stack->nodes[parent].child; i != 0; i = stack->nodes[i].sibling) {
+		if (stack->nodes[i].address == address)
+			return i;
+	}
+
+	if (stack->node_count == stack->node_capacity) {
+		uint32_t capacity = stack->node_capacity * 2;
+		X86_CALL_NODE* nodes = (X86_CALL_NODE*)realloc(stack->nodes, capacity * sizeof(X86_CALL_NODE));
+		if (nodes == NULL) {
+			stack->error = 1;
+			return 0;
+		}
+		stack->nodes = nodes;
+		stack->node_capacity = capacity;
+	}
+
+	i = stack->node_count++;
+	node = &stack->nodes[i];
+	node->address = address;
+	node->parent = parent;
+	node->child = 0;
+	node->sibling = stack->nodes[parent].child;
+	node->self = 0;
+	node->total = 0;
+	stack->nodes[parent].child = i;
+	return i;
+}
+
+int x86CallStackStart(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+
+	x86FreeCallStack(cpu);
+
+	stack->nodes = (X86_CALL_NODE*)malloc(CALL_TREE_SIZE * sizeof(X86_CALL_NODE));
+	if (stack->nodes == NULL)
+		return 1;
+	memset(&stack->nodes[0], 0, sizeof(X86_CALL_NODE));
+	stack->node_count = 1;
+	stack->node_capacity = CALL_TREE_SIZE;
+
+	stack->frames[0].node = get_node(stack, 0, x86GetEffectiveAddress(cpu, cpu->eip));
+	stack->frames[0].return_address = 0;
+	stack->depth = 1;
+	stack->clock = cpu->clock;
+	stack->active = 1;
+	return 0;
+}
+void x86CallStackStop(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	if (!stack->active)
+		return;
+	charge(cpu);
+	stack->active = 0;
+}
+void x86FreeCallStack(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	if (stack->nodes != NULL)
+		free(stack->nodes);
+	memset(stack, 0, sizeof(X86_CALL_STACK));
+}
+
+void x86CallStackCall(X86_CPU* cpu, uint32_t return_address)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	uint32_t node;
+
+	charge(cpu);
+
+	if (stack->depth == X86_CALL_STACK_DEPTH || stack->error) {
+		stack->dropped += 1;
+		return;
+	}
+
+	node = get_node(stack, stack->frames[stack->depth - 1].node, x86GetEffectiveAddress(cpu, cpu->eip));
+	if (node == 0) {
+		stack->dropped += 1;
+		return;
+	}
+
+	stack->frames[stack->depth].node = node;
+	stack->frames[stack->depth].return_address = return_address;
+	stack->depth += 1;
+}
+void x86CallStackReturn(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	uint32_t address = x86GetEffectiveAddress(cpu, cpu->eip);
+	uint32_t i;
+
+	charge(cpu);
+
+	// the nearest frame wins; returns that skip frames unwind them.
+	for (i = stack->depth - 1; i > 0; --i) {
+		if (stack->frames[i].return_address == address) {
+			stack->depth = i;
+			return;
+		}
+	}
+	stack->unmatched += 1;
+}
+void x86CallStackFarJump(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	uint32_t node;
+
+	charge(cpu);
+
+	node = get_node(stack, 0, x86GetEffectiveAddress(cpu, cpu->eip));
+	if (node == 0)
+		return;
+
+	stack->frames[0].node = node;
+	stack->depth = 1;
+}
+
+void x86CallStackCollect(X86_CPU* cpu)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	uint32_t i;
+
+	if (stack->nodes == NULL)
+		return;
+	if (stack->active)
+		charge(cpu);
+
+	for (i = 0; i < stack->node_count; ++i) {
+		stack->nodes[i].total = stack->nodes[i].self;
+	}
+	for (i = stack->node_count - 1; i > 0; --i) {
+		stack->nodes[stack->nodes[i].parent].total += stack->nodes[i].total;
+	}
+}
+
+/* OUTPUT */
+static void get_function_name(X86_CPU* cpu, uint32_t address, char* buf, size_t size)
+{
+	const char* name = x86ProfileGetSymbol(cpu, address);
+	if (name != NULL)
+		snprintf(buf, size, "%s", name);
+	else
+		snprintf(buf, size, "%08x", address);
+
+	// ; separates the functions of a folded stack.
+	for (; *buf != '\0'; ++buf) {
+		if (*buf == ';')
+			*buf = ':';
+	}
+}
+static void write_path(X86_CPU* cpu, FILE* file, uint32_t node)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	uint32_t path[X86_CALL_STACK_DEPTH];
+	uint32_t depth = 0;
+	char name[CALL_NAME_SIZE];
+
+	// walk up to the root, then write from the first function down.
+	for (; node != 0 && depth < X86_CALL_STACK_DEPTH; node = stack->nodes[node].parent) {
+		path[depth++] = node;
+	}
+	while (depth != 0) {
+		depth -= 1;
+		get_function_name(cpu, stack->nodes[path[depth]].address, name, sizeof(name));
+		fprintf(file, depth != 0 ? "%s;" : "%s", name);
+	}
+}
+static int compare_entries(const void* a, const void* b)
+{
+	uint64_t total_a = ((const CALL_ENTRY*)a)->total;
+	uint64_t total_b = ((const CALL_ENTRY*)b)->total;
+	return total_a < total_b ? 1 : (total_a > total_b ? -1 : 0);
+}
+
+int x86CallStackWriteFolded(X86_CPU* cpu, const char* filename)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	FILE* file;
+	uint32_t i;
+
+	x86CallStackCollect(cpu);
+
+	file = fopen(filename, "w");
+	if (file == NULL)
+		return 1;
+
+	for (i = 1; i < stack->node_count; ++i) {
+		if (stack->nodes[i].self == 0)
+			continue;
+		write_path(cpu, file, i);
+		fprintf(file, " %llu\n", (unsigned long long)stack->nodes[i].self);
+	}
+
+	return fclose(file) != 0;
+}
+
+void x86CallStackDump(X86_CPU* cpu, uint32_t max_entries)
+{
+	X86_CALL_STACK* stack = &cpu->calls;
+	CALL_ENTRY* entries;
+	uint32_t count = 0;
+	uint32_t i;
+
+	x86CallStackCollect(cpu);
+	if (stack->node_count < 2)
+		return;
+
+	entries = (CALL_ENTRY*)malloc(stack->node_count * sizeof(CALL_ENTRY));
+	if (entries == NULL)
+		return;
+
+	for (i = 1; i < stack->node_count; ++i) {
+		entries[count].total = stack->nodes[i].total;
+		entries[count].node = i;
+		count += 1;
+	}
+	qsort(entries, count, sizeof(CALL_ENTRY), compare_entries);
+
+	printf("\n\t%u call paths, %u calls dropped, %u returns unmatched\n", count, stack->dropped, stack->unmatched);
+	for (i = 0; i < count && i < max_entries; ++i) {
+		X86_CALL_NODE* node = &stack->nodes[entries[i].node];
+		printf("\t%12llu %12llu  ", (unsigned long long)node->total, (unsigned long long)node->self);
+		write_path(cpu, stdout, entries[i].node);
+		printf("\n");
+	}
+
+	free(entries);
+}
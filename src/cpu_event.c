@@ -0,0 +1,132 @@
+// cpu_event.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_event.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Event scheduler
+
+	Virtual time is cpu->clock, which the execution loops advance by the
+	instructions they execute. Devices post events at a virtual time and the
+	queue keeps them in a min-heap, so the earliest one is always heap[0] and its
+	time is cached in the deadline the run loop compares the clock against.
+
+	x86CPURun never lets a batch of instructions run past the deadline, and a
+	halted cpu does not execute anything, so the run loop moves the clock straight
+	to the next event instead of counting out the idle time. */
+
+static int is_before(X86_EVENT* a, X86_EVENT* b)
+{
+	// ids grow, so equal times keep the order the events were posted in.
+	return a->time < b->time || (a->time == b->time && (int32_t)(a->id - b->id) < 0);
+}
+static void swap_events(X86_EVENT* a, X86_EVENT* b)
+{
+	X86_EVENT t = *a;
+	*a = *b;
+	*b = t;
+}
+static void sift_up(X86_EVENT_QUEUE* queue, uint32_t i)
+{
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (!is_before(&queue->heap[i], &queue->heap[parent]))
+			break;
+		swap_events(&queue->heap[i], &queue->heap[parent]);
+		i = parent;
+	}
+}
+static void sift_down(X86_EVENT_QUEUE* queue, uint32_t i)
+{
+	for (;;) {
+		uint32_t first = i;
+		uint32_t left = i * 2 + 1;
+		uint32_t right = left + 1;
+		if (left < queue->count && is_before(&queue->heap[left], &queue->heap[first]))
+			first = left;
+		if (right < queue->count && is_before(&queue->heap[right], &queue->heap[first]))
+			first = right;
+		if (first == i)
+			break;
+		swap_events(&queue->heap[i], &queue->heap[first]);
+		i = first;
+	}
+}
+static void remove_event(X86_EVENT_QUEUE* queue, uint32_t i)
+{
+	queue->count -= 1;
+	if (i != queue->count) {
+		queue->heap[i] = queue->heap[queue->count];
+		sift_down(queue, i);
+		sift_up(queue, i);
+	}
+	queue->deadline = queue->count != 0 ? queue->heap[0].time : UINT64_MAX;
+}
+
+void x86InitEvents(X86_CPU* cpu)
+{
+	memset(&cpu->events, 0, sizeof(X86_EVENT_QUEUE));
+	cpu->events.next_id = 1;
+	cpu->events.deadline = UINT64_MAX;
+	cpu->clock = 0;
+}
+
+uint32_t x86EventPost(X86_CPU* cpu, uint64_t time, X86_EVENT_HANDLER handler, void* device)
+{
+	X86_EVENT_QUEUE* queue = &cpu->events;
+	X86_EVENT* event;
+	uint32_t id;
+
+	if (queue->count >= X86_EVENT_MAX || handler == NULL)
+		return 0;
+
+	id = queue->next_id;
+	queue->next_id += 1;
+	if (queue->next_id == 0)
+		queue->next_id = 1;
+
+	event = &queue->heap[queue->count];
+	event->time = time;
+	event->handler = handler;
+	event->device = device;
+	event->id = id;
+
+	queue->count += 1;
+	sift_up(queue, queue->count - 1);
+	queue->deadline = queue->heap[0].time;
+	return id;
+}
+int x86EventCancel(X86_CPU* cpu, uint32_t id)
+{
+	X86_EVENT_QUEUE* queue = &cpu->events;
+	uint32_t i;
+
+	for (i = 0; i < queue->count; ++i) {
+		if (queue->heap[i].id == id) {
+			remove_event(queue, i);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void x86EventDispatch(X86_CPU* cpu)
+{
+	X86_EVENT_QUEUE* queue = &cpu->events;
+	X86_EVENT event;
+
+	while (queue->count != 0 && queue->heap[0].time <= cpu->clock) {
+		// take the event off first; its handler may post the next one.
+		event = queue->heap[0];
+		remove_event(queue, 0);
+		event.handler(cpu, event.device, event.time);
+	}
+}
@@ -0,0 +1,284 @@
+// cpu_io.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_io.h"
+#include "cpu_memory.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Port I/O
+
+	The 64K port space is a table that holds the device index of every port, the
+	same way the bus holds the region of every page. An in or out loads the port's
+	entry and calls the device's handler for the access width directly.
+
+	Devices that only decode some widths leave the others NULL; those accesses
+	are split into narrower ones, port by port, like a bus that only moves bytes.
+
+	A trace records each in and out as the cpu issues it, before any split.
+	Replay hands the recorded in values back in order and never calls a device,
+	so a run that starts from the same state takes the same path without the
+	device models. The first access that does not match the next record ends the
+	replay and goes to the devices. */
+
+#define IO_WIDTH(size) ((size) >> 1) // 1, 2, 4 -> X86_IO_BYTE, X86_IO_WORD, X86_IO_DWORD
+
+int x86InitIo(X86_CPU* cpu)
+{
+	X86_IO* io = &cpu->io;
+
+	io->ports = (uint8_t*)malloc(X86_IO_PORT_COUNT);
+	if (io->ports == NULL)
+		return 1;
+
+	memset(io->devices, 0, sizeof(io->devices));
+	memset(&io->trace, 0, sizeof(io->trace));
+	memset(io->ports, 0, X86_IO_PORT_COUNT);
+
+	// device 0; the ports no device decodes.
+	io->devices[0].base = 0;
+	io->devices[0].end = 0xFFFF;
+	io->device_count = 1;
+
+	return 0;
+}
+void x86FreeIo(X86_CPU* cpu)
+{
+	X86_IO* io = &cpu->io;
+	if (io->ports != NULL) {
+		free(io->ports);
+		io->ports = NULL;
+	}
+	io->device_count = 0;
+	x86IoTraceStop(cpu);
+}
+
+int x86IoAddDevice(X86_CPU* cpu, uint16_t base, uint16_t end, const X86_IO_READ_HANDLER read[3], const X86_IO_WRITE_HANDLER write[3], void* device)
+{
+	X86_IO* io = &cpu->io;
+	X86_IO_DEVICE* entry;
+	uint32_t index = io->device_count;
+	uint32_t port;
+	int i;
+
+	if (index >= X86_IO_DEVICE_MAX || end < base)
+		return 1;
+
+	entry = &io->devices[index];
+	memset(entry, 0, sizeof(X86_IO_DEVICE));
+	for (i = 0; i < 3; ++i) {
+		if (read != NULL)
+			entry->read[i] = read[i];
+		if (write != NULL)
+			entry->write[i] = write[i];
+	}
+	entry->device = device;
+	entry->base = base;
+	entry->end = end;
+	io->device_count += 1;
+
+	for (port = base; port <= end; ++port) {
+		io->ports[port] = (uint8_t)index;
+	}
+
+	return 0;
+}
+
+X86_IO_DEVICE* x86IoGetDevice(X86_CPU* cpu, uint16_t port)
+{
+	return &cpu->io.devices[cpu->io.ports[port]];
+}
+
+static uint32_t read_port(X86_CPU* cpu, uint16_t port, uint32_t size)
+{
+	X86_IO_DEVICE* device = x86IoGetDevice(cpu, port);
+	X86_IO_READ_HANDLER read = device->read[IO_WIDTH(size)];
+	uint32_t half;
+
+	if (read != NULL)
+		return read(device->device, port);
+
+	if (size == 1)
+		return 0;
+
+	half = size >> 1;
+	return read_port(cpu, port, half) | (read_port(cpu, (uint16_t)(port + half), half) << (half * 8));
+}
+static void write_port(X86_CPU* cpu, uint16_t port, uint32_t size, uint32_t value)
+{
+	X86_IO_DEVICE* device = x86IoGetDevice(cpu, port);
+	X86_IO_WRITE_HANDLER write = device->write[IO_WIDTH(size)];
+	uint32_t half;
+
+	if (write != NULL) {
+		write(device->device, port, value);
+		return;
+	}
+
+	if (size == 1)
+		return;
+
+	half = size >> 1;
+	write_port(cpu, port, half, value);
+	write_port(cpu, (uint16_t)(port + half), half, value >> (half * 8));
+}
+
+static void trace_append(X86_CPU* cpu, uint16_t port, uint32_t size, int write, uint32_t value)
+{
+	X86_IO_TRACE* trace = &cpu->io.trace;
+	X86_IO_TRACE_RECORD* record;
+
+	if (trace->count == trace->capacity) {
+		uint32_t capacity = trace->capacity == 0 ? 0x1000 : trace->capacity * 2;
+		X86_IO_TRACE_RECORD* records = (X86_IO_TRACE_RECORD*)realloc(trace->records, capacity * sizeof(X86_IO_TRACE_RECORD));
+		if (records == NULL) {
+			// keep what was recorded; the trace ends here.
+			trace->mode = X86_IO_TRACE_MODE_OFF;
+			trace->error = 1;
+			return;
+		}
+		trace->records = records;
+		trace->capacity = capacity;
+	}
+
+	record = &trace->records[trace->count++];
+	record->address = x86GetEffectiveAddress(cpu, cpu->eip);
+	record->value = value;
+	record->port = port;
+	record->size = (uint8_t)size;
+	record->write = (uint8_t)write;
+}
+static X86_IO_TRACE_RECORD* trace_next(X86_CPU* cpu, uint16_t port, uint32_t size, int write)
+{
+	X86_IO_TRACE* trace = &cpu->io.trace;
+	X86_IO_TRACE_RECORD* record;
+
+	if (trace->position < trace->count) {
+		record = &trace->records[trace->position];
+		if (record->port == port && record->size == size && record->write == write && record->address == x86GetEffectiveAddress(cpu, cpu->eip)) {
+			trace->position += 1;
+			return record;
+		}
+	}
+
+	// the run left the recorded path or ran past its end.
+	trace->mode = X86_IO_TRACE_MODE_OFF;
+	trace->error = (trace->position < trace->count);
+	return NULL;
+}
+static uint32_t trace_read(X86_CPU* cpu, uint16_t port, uint32_t size)
+{
+	X86_IO_TRACE_RECORD* record;
+	uint32_t value;
+
+	if (cpu->io.trace.mode == X86_IO_TRACE_MODE_REPLAY) {
+		record = trace_next(cpu, port, size, 0);
+		if (record != NULL)
+			return record->value;
+		return read_port(cpu, port, size);
+	}
+
+	value = read_port(cpu, port, size);
+	trace_append(cpu, port, size, 0, value);
+	return value;
+}
+static void trace_write(X86_CPU* cpu, uint16_t port, uint32_t size, uint32_t value)
+{
+	if (cpu->io.trace.mode == X86_IO_TRACE_MODE_REPLAY) {
+		if (trace_next(cpu, port, size, 1) == NULL)
+			write_port(cpu, port, size, value);
+		return;
+	}
+
+	write_port(cpu, port, size, value);
+	trace_append(cpu, port, size, 1, value);
+}
+
+uint32_t x86IoRead(X86_CPU* cpu, uint16_t port, uint32_t size)
+{
+	if (cpu->io.trace.mode != X86_IO_TRACE_MODE_OFF)
+		return trace_read(cpu, port, size);
+	return read_port(cpu, port, size);
+}
+void x86IoWrite(X86_CPU* cpu, uint16_t port, uint32_t size, uint32_t value)
+{
+	if (cpu->io.trace.mode != X86_IO_TRACE_MODE_OFF) {
+		trace_write(cpu, port, size, value);
+		return;
+	}
+	write_port(cpu, port, size, value);
+}
+
+void x86IoTraceRecord(X86_CPU* cpu)
+{
+	x86IoTraceStop(cpu);
+	cpu->io.trace.mode = X86_IO_TRACE_MODE_RECORD;
+}
+int x86IoTraceReplay(X86_CPU* cpu, const uint8_t* log, uint32_t size)
+{
+	X86_IO_TRACE* trace = &cpu->io.trace;
+	X86_IO_TRACE_HEADER header;
+	uint32_t bytes;
+
+	x86IoTraceStop(cpu);
+
+	if (log == NULL || size < sizeof(X86_IO_TRACE_HEADER))
+		return 1;
+
+	memcpy(&header, log, sizeof(X86_IO_TRACE_HEADER));
+	if (header.magic != X86_IO_TRACE_MAGIC || header.version != X86_IO_TRACE_VERSION || header.record_size != sizeof(X86_IO_TRACE_RECORD))
+		return 1;
+	if (header.count > (size - sizeof(X86_IO_TRACE_HEADER)) / sizeof(X86_IO_TRACE_RECORD))
+		return 1;
+
+	bytes = header.count * sizeof(X86_IO_TRACE_RECORD);
+	if (bytes != 0) {
+		trace->records = (X86_IO_TRACE_RECORD*)malloc(bytes);
+		if (trace->records == NULL)
+			return 1;
+		memcpy(trace->records, log + sizeof(X86_IO_TRACE_HEADER), bytes);
+	}
+
+	trace->count = header.count;
+	trace->capacity = header.count;
+	trace->mode = X86_IO_TRACE_MODE_REPLAY;
+	return 0;
+}
+uint8_t* x86IoTraceSave(X86_CPU* cpu, uint32_t* size)
+{
+	X86_IO_TRACE* trace = &cpu->io.trace;
+	X86_IO_TRACE_HEADER header;
+	uint32_t bytes = trace->count * sizeof(X86_IO_TRACE_RECORD);
+	uint8_t* log;
+
+	log = (uint8_t*)malloc(sizeof(X86_IO_TRACE_HEADER) + bytes);
+	if (log == NULL)
+		return NULL;
+
+	header.magic = X86_IO_TRACE_MAGIC;
+	header.version = X86_IO_TRACE_VERSION;
+	header.record_size = sizeof(X86_IO_TRACE_RECORD);
+	header.count = trace->count;
+	memcpy(log, &header, sizeof(X86_IO_TRACE_HEADER));
+	if (bytes != 0)
+		memcpy(log + sizeof(X86_IO_TRACE_HEADER), trace->records, bytes);
+
+	*size = sizeof(X86_IO_TRACE_HEADER) + bytes;
+	return log;
+}
+void x86IoTraceStop(X86_CPU* cpu)
+{
+	X86_IO_TRACE* trace = &cpu->io.trace;
+	if (trace->records != NULL) {
+		free(trace->records);
+		trace->records = NULL;
+	}
+	memset(trace, 0, sizeof(X86_IO_TRACE));
+}
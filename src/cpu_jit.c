@@ -0,0 +1,778 @@
+// cpu_jit.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpu_jit.h"
+
+#ifdef X86_JIT_HOST_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#include "cpu.h"
+#include "cpu_cache.h"
+#include "cpu_instruction.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Block translator.
+	Hot basic blocks decoded in 32bit protected mode are translated to x86-64 host code.
+	Inside a block the guest general registers live in host r8d - r15d and the cpu
+	pointer in rbx. 32bit register forms of mov, add, or, and, sub, xor, cmp, inc, dec,
+	shl, shr, xchg, movzx, movsx and jmp rel are emitted natively, recording the
+	flags in cpu->lazy_flags the same way x86Alu does. Every other instruction calls its
+	interpreter handler with the guest registers written back around the call. The
+	clock is brought up to date before and after each call and cpu->jit.retired is set
+	to the instructions the block has run, so a block that leaves early counts only those. */
+
+#ifdef X86_JIT_HOST_X64
+
+/* opcode handlers; cpu.c */
+int move_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int inc_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int dec_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int shr_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int shl_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int add_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int or_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int and_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int sub_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int cmp_imm_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int movzx(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int movsx(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int xchg_reg(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int nop(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int jmp_imm_rel(X86_CPU* cpu, X86_INSTRUCTION* instr);
+int modrm_op(X86_CPU* cpu, X86_INSTRUCTION* instr);
+
+/*HOST REGISTERS*/
+enum {
+	HOST_RAX = 0,
+	HOST_RCX = 1,
+	HOST_RDX = 2,
+	HOST_RBX = 3,
+	HOST_RSP = 4,
+	HOST_RBP = 5,
+	HOST_RSI = 6,
+	HOST_RDI = 7,
+	HOST_R8 = 8,
+};
+
+/*HOST CONDITION CODES*/
+enum {
+	HOST_CC_E = 0x4,
+	HOST_CC_NE = 0x5,
+	HOST_CC_L = 0xC,
+};
+
+/*ALU /r OPCODES AND /digit EXTENSIONS*/
+enum {
+	HOST_ALU_ADD = 0,
+	HOST_ALU_OR = 1,
+	HOST_ALU_AND = 4,
+	HOST_ALU_SUB = 5,
+	HOST_ALU_XOR = 6,
+	HOST_ALU_CMP = 7,
+};
+
+#define JIT_MAX_FIXUPS (X86_BLOCK_MAX_INSTRUCTIONS * 2 + 1)
+
+typedef struct _JIT_EMITTER {
+	uint8_t* code; // NULL on the analysis pass
+	uint32_t size;
+	uint32_t pos;
+	uint32_t exit_fixups[JIT_MAX_FIXUPS]; // rel32 jumps to the block exit
+	uint32_t exit_count;
+	uint32_t pending_eip; // eip advance not yet written to the cpu
+	uint32_t pending_clock; // instructions run natively not yet added to cpu->clock
+	uint8_t live; // guest registers used natively
+	uint8_t dirty; // guest registers written natively
+} JIT_EMITTER;
+
+/* EMIT */
+static void emit8(JIT_EMITTER* e, uint8_t value)
+{
+	if (e->code != NULL && e->pos < e->size)
+		e->code[e->pos] = value;
+	e->pos += 1;
+}
+static void emit32(JIT_EMITTER* e, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		emit8(e, (uint8_t)(value >> (i * 8)));
+}
+static void emit64(JIT_EMITTER* e, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+		emit8(e, (uint8_t)(value >> (i * 8)));
+}
+static void emit_rex(JIT_EMITTER* e, int w, uint32_t reg, uint32_t rm, int force)
+{
+	uint8_t rex = 0x40 | (w << 3) | ((reg >= 8) << 2) | (rm >= 8);
+	if (rex != 0x40 || force)
+		emit8(e, rex);
+}
+static void emit_rr(JIT_EMITTER* e, uint8_t opcode, uint32_t dst, uint32_t src)
+{
+	// op r/m32, r32
+	emit_rex(e, 0, src, dst, 0);
+	emit8(e, opcode);
+	emit8(e, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+static void emit_mov_rr(JIT_EMITTER* e, uint32_t dst, uint32_t src)
+{
+	emit_rr(e, 0x89, dst, src);
+}
+static void emit_alu_rr(JIT_EMITTER* e, uint32_t alu, uint32_t dst, uint32_t src)
+{
+	emit_rr(e, (uint8_t)((alu << 3) | 0x01), dst, src);
+}
+static void emit_mov_ri(JIT_EMITTER* e, uint32_t dst, uint32_t imm)
+{
+	emit_rex(e, 0, 0, dst, 0);
+	emit8(e, 0xB8 + (dst & 7));
+	emit32(e, imm);
+}
+static void emit_mov_ri64(JIT_EMITTER* e, uint32_t dst, uint64_t imm)
+{
+	emit_rex(e, 1, 0, dst, 0);
+	emit8(e, 0xB8 + (dst & 7));
+	emit64(e, imm);
+}
+static void emit_mov_rr64(JIT_EMITTER* e, uint32_t dst, uint32_t src)
+{
+	emit_rex(e, 1, src, dst, 0);
+	emit8(e, 0x89);
+	emit8(e, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+static void emit_cpu_op(JIT_EMITTER* e, uint8_t opcode, uint32_t reg, uint32_t offset)
+{
+	// op r32, [rbx + disp32] / op [rbx + disp32], r32
+	emit_rex(e, 0, reg, HOST_RBX, 0);
+	emit8(e, opcode);
+	emit8(e, 0x80 | ((reg & 7) << 3) | HOST_RBX);
+	emit32(e, offset);
+}
+static void emit_load(JIT_EMITTER* e, uint32_t reg, uint32_t offset)
+{
+	emit_cpu_op(e, 0x8B, reg, offset);
+}
+static void emit_store(JIT_EMITTER* e, uint32_t reg, uint32_t offset)
+{
+	emit_cpu_op(e, 0x89, reg, offset);
+}
+static void emit_cpu_alu_i(JIT_EMITTER* e, uint32_t alu, uint32_t offset, uint32_t imm)
+{
+	// op dword [rbx + disp32], imm32
+	emit8(e, 0x81);
+	emit8(e, 0x80 | (alu << 3) | HOST_RBX);
+	emit32(e, offset);
+	emit32(e, imm);
+}
+static void emit_cpu_mov_i(JIT_EMITTER* e, uint32_t offset, uint32_t imm)
+{
+	// mov dword [rbx + disp32], imm32
+	emit8(e, 0xC7);
+	emit8(e, 0x80 | HOST_RBX);
+	emit32(e, offset);
+	emit32(e, imm);
+}
+static void emit_cpu_add64_i(JIT_EMITTER* e, uint32_t offset, uint32_t imm)
+{
+	// add qword [rbx + disp32], imm32
+	emit8(e, 0x48);
+	emit_cpu_alu_i(e, HOST_ALU_ADD, offset, imm);
+}
+static void emit_shift_ri(JIT_EMITTER* e, uint32_t ext, uint32_t dst, uint8_t imm)
+{
+	// shl (4) / shr (5) r/m32, imm8
+	emit_rex(e, 0, 0, dst, 0);
+	emit8(e, 0xC1);
+	emit8(e, 0xC0 | (ext << 3) | (dst & 7));
+	emit8(e, imm);
+}
+static void emit_cpu_byte(JIT_EMITTER* e, uint32_t offset, uint8_t imm)
+{
+	// mov byte [rbx + disp32], imm8
+	emit8(e, 0xC6);
+	emit8(e, 0x80 | HOST_RBX);
+	emit32(e, offset);
+	emit8(e, imm);
+}
+static void emit_cpu_setcc(JIT_EMITTER* e, uint8_t cc, uint32_t offset)
+{
+	// setcc byte [rbx + disp32]
+	emit8(e, 0x0F);
+	emit8(e, 0x90 | cc);
+	emit8(e, 0x80 | HOST_RBX);
+	emit32(e, offset);
+}
+static void emit_extend(JIT_EMITTER* e, uint8_t opcode, uint32_t dst, uint32_t src)
+{
+	// movzx / movsx r32, r/m8 or r/m16
+	int byte_reg = (opcode == 0xB6 || opcode == 0xBE);
+	emit_rex(e, 0, dst, src, byte_reg && src >= 4);
+	emit8(e, 0x0F);
+	emit8(e, opcode);
+	emit8(e, 0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+static void emit_exit_jump(JIT_EMITTER* e, int conditional)
+{
+	// jnz exit / jmp exit; patched once the exit is emitted.
+	if (conditional) {
+		emit8(e, 0x0F);
+		emit8(e, 0x80 | HOST_CC_NE);
+	}
+	else {
+		emit8(e, 0xE9);
+	}
+	if (e->exit_count < JIT_MAX_FIXUPS)
+		e->exit_fixups[e->exit_count++] = e->pos;
+	emit32(e, 0);
+}
+
+static uint32_t emit_jump8(JIT_EMITTER* e, uint8_t cc)
+{
+	// jcc rel8 forward; returns the offset to patch with patch_jump8 once the target is emitted.
+	emit8(e, 0x70 | cc);
+	emit8(e, 0);
+	return e->pos - 1;
+}
+static void patch_jump8(JIT_EMITTER* e, uint32_t at)
+{
+	if (e->code != NULL && at < e->size)
+		e->code[at] = (uint8_t)(e->pos - (at + 1));
+}
+
+/* GUEST STATE */
+static uint32_t guest_offset(uint32_t reg)
+{
+	return (uint32_t)(offsetof(X86_CPU, registers) + reg * sizeof(X86_GENERAL_REGISTER));
+}
+static uint32_t guest(JIT_EMITTER* e, uint32_t reg, int write)
+{
+	// host register holding guest register reg.
+	e->live |= (1 << reg);
+	if (write)
+		e->dirty |= (1 << reg);
+	return HOST_R8 + reg;
+}
+static void load_guest_registers(JIT_EMITTER* e, uint8_t mask)
+{
+	for (uint32_t i = 0; i < X86_GENERAL_REGISTER_COUNT; ++i) {
+		if (mask & (1 << i))
+			emit_load(e, HOST_R8 + i, guest_offset(i));
+	}
+}
+static void store_guest_registers(JIT_EMITTER* e, uint8_t mask)
+{
+	for (uint32_t i = 0; i < X86_GENERAL_REGISTER_COUNT; ++i) {
+		if (mask & (1 << i))
+			emit_store(e, HOST_R8 + i, guest_offset(i));
+	}
+}
+static void sync_eip(JIT_EMITTER* e)
+{
+	if (e->pending_eip != 0) {
+		emit_cpu_alu_i(e, HOST_ALU_ADD, (uint32_t)offsetof(X86_CPU, eip), e->pending_eip);
+		e->pending_eip = 0;
+	}
+}
+static void sync_clock(JIT_EMITTER* e)
+{
+	if (e->pending_clock != 0) {
+		emit_cpu_add64_i(e, (uint32_t)offsetof(X86_CPU, clock), e->pending_clock);
+		e->pending_clock = 0;
+	}
+}
+
+/* FLAGS */
+static uint32_t lazy_offset(uint32_t field)
+{
+	return (uint32_t)offsetof(X86_CPU, lazy_flags) + field;
+}
+static void emit_flags(JIT_EMITTER* e, INSTRUCTION_TYPE type)
+{
+	// record the operation in cpu->lazy_flags from result eax, operand1 ecx and operand2 edx; mirrors x86Alu.
+	emit_store(e, HOST_RCX, lazy_offset(offsetof(X86_LAZY_FLAGS, operand1)));
+	emit_store(e, HOST_RDX, lazy_offset(offsetof(X86_LAZY_FLAGS, operand2)));
+	emit_store(e, HOST_RAX, lazy_offset(offsetof(X86_LAZY_FLAGS, result)));
+	emit_cpu_byte(e, lazy_offset(offsetof(X86_LAZY_FLAGS, type)), (uint8_t)type);
+	emit_cpu_byte(e, lazy_offset(offsetof(X86_LAZY_FLAGS, operand_size)), 4);
+
+	switch (type) {
+		case INSTRUCTION_TYPE_ADD:
+			emit_alu_rr(e, HOST_ALU_CMP, HOST_RAX, HOST_RCX); // CF = (int)r < (int)a
+			emit_cpu_setcc(e, HOST_CC_L, lazy_offset(offsetof(X86_LAZY_FLAGS, CF)));
+			break;
+		case INSTRUCTION_TYPE_SUB:
+		case INSTRUCTION_TYPE_CMP:
+			emit_alu_rr(e, HOST_ALU_CMP, HOST_RCX, HOST_RDX); // CF = (int)a < (int)b
+			emit_cpu_setcc(e, HOST_CC_L, lazy_offset(offsetof(X86_LAZY_FLAGS, CF)));
+			break;
+		case INSTRUCTION_TYPE_INC:
+		case INSTRUCTION_TYPE_DEC:
+			break; // CF preserved
+		default:
+			emit_cpu_byte(e, lazy_offset(offsetof(X86_LAZY_FLAGS, CF)), 0);
+			break;
+	}
+}
+static void emit_alu(JIT_EMITTER* e, uint32_t alu, INSTRUCTION_TYPE type, uint32_t dst, uint32_t a, uint32_t b, int b_is_imm, int write)
+{
+	// r = a op b with flags; a and b are host registers or b an immediate.
+	emit_mov_rr(e, HOST_RCX, a);
+	if (b_is_imm)
+		emit_mov_ri(e, HOST_RDX, b);
+	else
+		emit_mov_rr(e, HOST_RDX, b);
+	emit_mov_rr(e, HOST_RAX, HOST_RCX);
+	emit_alu_rr(e, alu, HOST_RAX, HOST_RDX);
+	emit_flags(e, type);
+	if (write)
+		emit_mov_rr(e, dst, HOST_RAX);
+}
+static int get_alu(uint32_t op, uint32_t* alu, INSTRUCTION_TYPE* type)
+{
+	// map an x86Alu operation to a host alu op. 0 if not translated.
+	switch (op) {
+		case HOST_ALU_ADD:
+			*type = INSTRUCTION_TYPE_ADD;
+			break;
+		case HOST_ALU_OR:
+			*type = INSTRUCTION_TYPE_OR;
+			break;
+		case HOST_ALU_AND:
+			*type = INSTRUCTION_TYPE_AND;
+			break;
+		case HOST_ALU_SUB:
+			*type = INSTRUCTION_TYPE_SUB;
+			break;
+		case HOST_ALU_XOR:
+			*type = INSTRUCTION_TYPE_XOR;
+			break;
+		case HOST_ALU_CMP:
+			*type = INSTRUCTION_TYPE_CMP;
+			break;
+		default: // ADC, SBB
+			return 0;
+	}
+	*alu = (op == HOST_ALU_CMP) ? HOST_ALU_SUB : op;
+	return 1;
+}
+
+/* TRANSLATE */
+static int emit_modrm_op(JIT_EMITTER* e, X86_INSTRUCTION* instr)
+{
+	X86_MOD_RM_BITS* mode = &instr->mode.bits;
+	uint32_t op = instr->opcode.bits.op;
+	uint32_t alu = 0;
+	INSTRUCTION_TYPE type = 0;
+
+	if (mode->mod != 0b11 || instr->operand_size != 4)
+		return 0;
+
+	if (op == 0b100000) {
+		// 0x81, 0x83 r32, imm
+		if (!get_alu(mode->reg, &alu, &type))
+			return 0;
+		int write = (mode->reg != HOST_ALU_CMP);
+		uint32_t dst = guest(e, mode->rm, write);
+		emit_alu(e, alu, type, dst, dst, instr->imm, 1, write);
+		return 1;
+	}
+
+	uint32_t dst_reg = instr->opcode.bits.direction ? mode->reg : mode->rm;
+	uint32_t src_reg = instr->opcode.bits.direction ? mode->rm : mode->reg;
+
+	switch (op) {
+		case 0b000000: // ADD
+		case 0b000010: // OR
+		case 0b001000: // AND
+		case 0b001010: // SUB
+		case 0b001100: // XOR
+		case 0b001110: { // CMP
+			get_alu(op >> 1, &alu, &type);
+			int write = (op != 0b001110);
+			uint32_t src = guest(e, src_reg, 0);
+			uint32_t dst = guest(e, dst_reg, write);
+			emit_alu(e, alu, type, dst, dst, src, 0, write);
+		} return 1;
+
+		case 0b100001: { // XCHG
+			uint32_t reg = guest(e, mode->reg, 1);
+			uint32_t rm = guest(e, mode->rm, 1);
+			emit_mov_rr(e, HOST_RAX, reg);
+			emit_mov_rr(e, reg, rm);
+			emit_mov_rr(e, rm, HOST_RAX);
+		} return 1;
+
+		case 0b100010: { // MOV
+			uint32_t src = guest(e, src_reg, 0);
+			uint32_t dst = guest(e, dst_reg, 1);
+			emit_mov_rr(e, dst, src);
+		} return 1;
+	}
+	return 0;
+}
+static int emit_extend_op(JIT_EMITTER* e, X86_INSTRUCTION* instr, int sign)
+{
+	// movzx / movsx r32, r8 / r16; the source is always the rm register.
+	uint32_t rm = instr->mode.bits.rm;
+
+	if (instr->operand_size != 4)
+		return 0;
+
+	if (instr->src_size == 1) {
+		if (rm <= 3) {
+			emit_mov_rr(e, HOST_RAX, guest(e, rm, 0));
+		}
+		else {
+			emit_mov_rr(e, HOST_RAX, guest(e, rm - 4, 0));
+			emit_shift_ri(e, 5, HOST_RAX, 8);
+		}
+		emit_extend(e, sign ? 0xBE : 0xB6, HOST_RAX, HOST_RAX);
+	}
+	else {
+		emit_extend(e, sign ? 0xBF : 0xB7, HOST_RAX, guest(e, rm, 0));
+	}
+	emit_mov_rr(e, guest(e, instr->mode.bits.reg, 1), HOST_RAX);
+	return 1;
+}
+static int emit_native(JIT_EMITTER* e, X86_INSTRUCTION* instr)
+{
+	// emit instr as host code. returns 0 if instr needs its interpreter handler.
+	X86_INSTRUCTION_HANDLER handler = instr->handler;
+
+	if (handler == modrm_op)
+		return emit_modrm_op(e, instr);
+	if (handler == movzx)
+		return emit_extend_op(e, instr, 0);
+	if (handler == movsx)
+		return emit_extend_op(e, instr, 1);
+	if (handler == nop)
+		return 1;
+
+	if (instr->operand_size != 4)
+		return 0;
+
+	if (handler == move_imm_reg) {
+		emit_mov_ri(e, guest(e, instr->reg, 1), instr->imm);
+		return 1;
+	}
+	if (handler == inc_reg || handler == dec_reg) {
+		uint32_t reg = guest(e, instr->reg, 1);
+		int inc = (handler == inc_reg);
+		emit_mov_rr(e, HOST_RCX, reg);
+		emit_mov_ri(e, HOST_RDX, 1);
+		emit_mov_rr(e, HOST_RAX, HOST_RCX);
+		emit_alu_rr(e, inc ? HOST_ALU_ADD : HOST_ALU_SUB, HOST_RAX, HOST_RDX);
+		emit_flags(e, inc ? INSTRUCTION_TYPE_INC : INSTRUCTION_TYPE_DEC);
+		emit_mov_rr(e, reg, HOST_RAX);
+		return 1;
+	}
+	if (handler == shl_reg || handler == shr_reg) {
+		emit_shift_ri(e, (handler == shl_reg) ? 4 : 5, guest(e, instr->reg, 1), (uint8_t)instr->imm);
+		return 1;
+	}
+	if (handler == add_imm_reg || handler == or_imm_reg || handler == and_imm_reg || handler == sub_imm_reg) {
+		uint32_t alu = HOST_ALU_ADD;
+		INSTRUCTION_TYPE type = INSTRUCTION_TYPE_ADD;
+		if (handler == or_imm_reg) {
+			alu = HOST_ALU_OR;
+			type = INSTRUCTION_TYPE_OR;
+		}
+		else if (handler == and_imm_reg) {
+			alu = HOST_ALU_AND;
+			type = INSTRUCTION_TYPE_AND;
+		}
+		else if (handler == sub_imm_reg) {
+			alu = HOST_ALU_SUB;
+			type = INSTRUCTION_TYPE_SUB;
+		}
+		uint32_t reg = guest(e, instr->reg, 1);
+		emit_alu(e, alu, type, reg, reg, instr->imm, 1, 1);
+		return 1;
+	}
+	if (handler == cmp_imm_reg) {
+		// x86Alu(CMP, imm, reg)
+		emit_mov_ri(e, HOST_RAX, instr->imm);
+		emit_alu(e, HOST_ALU_SUB, INSTRUCTION_TYPE_CMP, 0, HOST_RAX, guest(e, instr->reg, 0), 0, 0);
+		return 1;
+	}
+	if (handler == xchg_reg) {
+		uint32_t eax = guest(e, REG_EAX, 1);
+		uint32_t reg = guest(e, instr->reg, 1);
+		emit_mov_rr(e, HOST_RAX, eax);
+		emit_mov_rr(e, eax, reg);
+		emit_mov_rr(e, reg, HOST_RAX);
+		return 1;
+	}
+	return 0;
+}
+static void emit_handler_call(JIT_EMITTER* e, X86_INSTRUCTION* instr, uint32_t index)
+{
+	// call the interpreter handler with the guest state in the cpu. the handler sees the clock of the instructions before it
+	// and counts as run once it returns success or io, like it does in x86CPUExecute.
+	uint32_t success;
+	uint32_t io;
+
+	sync_eip(e);
+	sync_clock(e);
+	store_guest_registers(e, e->dirty);
+	emit_cpu_mov_i(e, (uint32_t)offsetof(X86_CPU, jit.retired), index + 1);
+#ifdef _WIN32
+	emit_mov_rr64(e, HOST_RCX, HOST_RBX);
+	emit_mov_ri64(e, HOST_RDX, (uint64_t)(uintptr_t)instr);
+#else
+	emit_mov_rr64(e, HOST_RDI, HOST_RBX);
+	emit_mov_ri64(e, HOST_RSI, (uint64_t)(uintptr_t)instr);
+#endif
+	emit_mov_ri64(e, HOST_RAX, (uint64_t)(uintptr_t)instr->handler);
+	emit8(e, 0xFF); // call rax
+	emit8(e, 0xD0);
+
+	// a failed handler did not run; leave with the instructions before it.
+	emit_rr(e, 0x85, HOST_RAX, HOST_RAX); // test eax, eax
+	success = emit_jump8(e, HOST_CC_E);
+	emit8(e, 0x83); emit8(e, 0xF8); emit8(e, X86_CPU_ERROR_IO); // cmp eax, imm8
+	io = emit_jump8(e, HOST_CC_E);
+	emit_cpu_mov_i(e, (uint32_t)offsetof(X86_CPU, jit.retired), index);
+	emit_exit_jump(e, 0);
+
+	patch_jump8(e, success);
+	patch_jump8(e, io);
+	e->pending_clock = 1;
+	sync_clock(e);
+	emit_rr(e, 0x85, HOST_RAX, HOST_RAX); // test eax, eax
+	emit_exit_jump(e, 1);
+}
+static void emit_block(JIT_EMITTER* e, X86_BLOCK* block, uint8_t live)
+{
+	uint32_t generation_offset = (uint32_t)offsetof(X86_CPU, decode_cache.generation);
+	int handler_last = 0;
+	int handler_called = 0;
+
+	// prologue; rbx, rsi, rdi, r12 - r15 are saved, 32 bytes of shadow space keeps rsp aligned.
+	emit8(e, 0x53); // push rbx
+	emit8(e, 0x56); // push rsi
+	emit8(e, 0x57); // push rdi
+	emit8(e, 0x41); emit8(e, 0x54); // push r12
+	emit8(e, 0x41); emit8(e, 0x55); // push r13
+	emit8(e, 0x41); emit8(e, 0x56); // push r14
+	emit8(e, 0x41); emit8(e, 0x57); // push r15
+	emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x20); // sub rsp, 32
+#ifdef _WIN32
+	emit_mov_rr64(e, HOST_RBX, HOST_RCX);
+#else
+	emit_mov_rr64(e, HOST_RBX, HOST_RDI);
+#endif
+
+	load_guest_registers(e, live);
+
+	for (uint32_t i = 0; i < block->count; ++i) {
+		X86_INSTRUCTION* instr = &block->instr[i];
+		int last = (i == block->count - 1);
+
+		if (instr->handler == jmp_imm_rel) {
+			// always the last instruction.
+			e->pending_eip += instr->length + instr->imm;
+			e->pending_clock += 1;
+			continue;
+		}
+
+		if (emit_native(e, instr)) {
+			e->pending_eip += instr->length;
+			e->pending_clock += 1;
+			continue;
+		}
+
+		emit_handler_call(e, instr, i);
+		handler_called = 1;
+		if (last) {
+			handler_last = 1; // eax is 0 and the guest state is in the cpu.
+			break;
+		}
+
+		// leave if the handler wrote to code; the rest of the block may be stale.
+		emit_cpu_op(e, 0x8B, HOST_RCX, generation_offset); // mov ecx, generation
+		emit8(e, 0x81); emit8(e, 0xF9); emit32(e, block->generation); // cmp ecx, imm32
+		emit_exit_jump(e, 1);
+
+		load_guest_registers(e, live);
+	}
+
+	if (!handler_last) {
+		sync_eip(e);
+		sync_clock(e);
+		store_guest_registers(e, e->dirty);
+		if (handler_called)
+			emit_cpu_mov_i(e, (uint32_t)offsetof(X86_CPU, jit.retired), block->count);
+		emit_alu_rr(e, HOST_ALU_XOR, HOST_RAX, HOST_RAX);
+	}
+
+	// exit; eax holds the result.
+	for (uint32_t i = 0; i < e->exit_count; ++i) {
+		uint32_t at = e->exit_fixups[i];
+		uint32_t rel = e->pos - (at + 4);
+		if (e->code != NULL && at + 4 <= e->size)
+			memcpy(e->code + at, &rel, 4);
+	}
+	emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x20); // add rsp, 32
+	emit8(e, 0x41); emit8(e, 0x5F); // pop r15
+	emit8(e, 0x41); emit8(e, 0x5E); // pop r14
+	emit8(e, 0x41); emit8(e, 0x5D); // pop r13
+	emit8(e, 0x41); emit8(e, 0x5C); // pop r12
+	emit8(e, 0x5F); // pop rdi
+	emit8(e, 0x5E); // pop rsi
+	emit8(e, 0x5B); // pop rbx
+	emit8(e, 0xC3); // ret
+}
+
+static void* alloc_code(uint32_t size)
+{
+	// never writable and executable at once; protect_code switches it around each translation.
+#ifdef _WIN32
+	return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (ptr == MAP_FAILED) ? NULL : ptr;
+#endif
+}
+static int protect_code(void* ptr, uint32_t size, int executable)
+{
+	// returns 0 on success
+#ifdef _WIN32
+	DWORD previous;
+	if (!VirtualProtect(ptr, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous))
+		return 1;
+	if (executable)
+		FlushInstructionCache(GetCurrentProcess(), ptr, size);
+	return 0;
+#else
+	return mprotect(ptr, size, executable ? (PROT_READ | PROT_EXEC) : (PROT_READ | PROT_WRITE)) != 0;
+#endif
+}
+static void free_code(void* ptr, uint32_t size)
+{
+#ifdef _WIN32
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, size);
+#endif
+}
+
+int x86InitJit(X86_CPU* cpu)
+{
+	X86_JIT* jit = &cpu->jit;
+
+	jit->code = NULL;
+	jit->size = 0;
+	jit->used = 0;
+	jit->retired = 0;
+	jit->enabled = 0;
+
+	jit->code = (uint8_t*)alloc_code(X86_JIT_CODE_SIZE);
+	if (jit->code == NULL)
+		return 0; // interpreter only.
+
+	jit->size = X86_JIT_CODE_SIZE;
+	jit->enabled = 1;
+	return 0;
+}
+void x86FreeJit(X86_CPU* cpu)
+{
+	X86_JIT* jit = &cpu->jit;
+
+	if (jit->code != NULL) {
+		free_code(jit->code, jit->size);
+		jit->code = NULL;
+	}
+	jit->size = 0;
+	jit->used = 0;
+	jit->enabled = 0;
+}
+void x86JitFlush(X86_CPU* cpu)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+
+	cpu->jit.used = 0;
+
+	if (cache->blocks == NULL)
+		return;
+
+	for (uint32_t i = 0; i < X86_BLOCK_CACHE_SIZE; ++i) {
+		cache->blocks[i].native = NULL;
+	}
+}
+X86_JIT_BLOCK x86JitCompile(X86_CPU* cpu, X86_BLOCK* block)
+{
+	X86_JIT* jit = &cpu->jit;
+	JIT_EMITTER e;
+
+	if (!jit->enabled || block->key != X86_CODE_KEY_PROT32)
+		return NULL; // 32bit protected mode code only.
+
+	// analysis pass; find the guest registers used natively and the worst case code size.
+	memset(&e, 0, sizeof(e));
+	emit_block(&e, block, 0xFF);
+	uint8_t live = e.live;
+	uint32_t size = e.pos;
+
+	if (jit->used + size > jit->size) {
+		x86JitFlush(cpu);
+		if (size > jit->size)
+			return NULL;
+	}
+
+	if (protect_code(jit->code, jit->size, 0) != 0)
+		return NULL;
+
+	memset(&e, 0, sizeof(e));
+	e.code = jit->code + jit->used;
+	e.size = jit->size - jit->used;
+	emit_block(&e, block, live);
+
+	if (protect_code(jit->code, jit->size, 1) != 0) {
+		jit->enabled = 0; // the translated blocks can not run; interpreter only.
+		x86JitFlush(cpu);
+		return NULL;
+	}
+
+	jit->used += (e.pos + 15) & ~15;
+	return (X86_JIT_BLOCK)(void*)e.code;
+}
+
+#else
+
+int x86InitJit(X86_CPU* cpu)
+{
+	// no jit for this host; interpreter only.
+	cpu->jit.code = NULL;
+	cpu->jit.size = 0;
+	cpu->jit.used = 0;
+	cpu->jit.retired = 0;
+	cpu->jit.enabled = 0;
+	return 0;
+}
+void x86FreeJit(X86_CPU* cpu)
+{
+}
+void x86JitFlush(X86_CPU* cpu)
+{
+}
+X86_JIT_BLOCK x86JitCompile(X86_CPU* cpu, X86_BLOCK* block)
+{
+	return NULL;
+}
+
+#endif
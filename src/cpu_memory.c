@@ -8,36 +8,175 @@
 
 #include "cpu.h"
 #include "cpu_memory.h"
+#include "cpu_cache.h"
+#include "cpu_tlb.h"
+#include "cpu_bus.h"
+#include "cpu_trace.h"
 
 #include "type_defs.h"
 #include "mem_tracking.h"
 
+uint32_t x86GetLinearAddress(X86_CPU* cpu, uint32_t segment, uint32_t offset)
+{
+	// base and mask are cached when the segment is loaded and by x86CPUUpdateMode for the cpu mode.
+	X86_SEGMENT_DESCRIPTOR* descriptor = &cpu->segment_descriptors[segment];
+	if (descriptor->flat)
+		return offset;
+	return descriptor->base + (offset & descriptor->mask);
+}
 uint32_t x86GetEffectiveAddress(X86_CPU* cpu, uint32_t address)
 {
-	if (cpu->mode == CPU_REAL_MODE) {
-		// In real mode, use segmented addressing
-		uint32_t base_address = cpu->segment_descriptors[SEG_CS].base << 4;
-		return cpu->mem.rom_end - 0xFFFFF | base_address | (address & 0xFFFF);
-	}
-	else {
-		// In protected mode, use the base address from the segment descriptor
-		uint32_t base_address = cpu->segment_descriptors[SEG_CS].base;
-		return base_address | address;
-	}
+	return x86GetLinearAddress(cpu, SEG_CS, address);
 }
 
 /* READ MEMORY */
-void* x86GetCPUMemoryPtr(X86_CPU* cpu, uint32_t address)
+static void* get_read_ptr(X86_CPU* cpu, uint32_t address)
+{
+	// host pointer to a linear address, or NULL if the read has to go through the bus.
+	X86_TLB_ENTRY* entry = &cpu->tlb.read[X86_TLB_INDEX(address)];
+	if (entry->tag == X86_TLB_TAG(address))
+		return (BYTE*)(entry->addend + address);
+	return x86TlbFill(cpu, address, X86_TLB_READ);
+}
+const void* x86GetCPUMemoryPtr(X86_CPU* cpu, uint32_t address)
 {
 	address = x86GetEffectiveAddress(cpu, address);
-	if (address >= cpu->mem.ram_base && address <= cpu->mem.ram_end) {
-		return (cpu->mem.ram + address - cpu->mem.ram_base);
-	}
-	if (address >= cpu->mem.rom_base && address <= cpu->mem.rom_end) {
-		return cpu->mem.rom + address - cpu->mem.rom_base;
+	void* ptr = get_read_ptr(cpu, address);
+	if (ptr != NULL)
+		return ptr;
+
+	// mmio or unmapped; point at the zero page every such address shares. the device does not see the access.
+	return cpu->mem.open_read + (address & (X86_BUS_PAGE_SIZE - 1));
+}
+static int crosses_page(uint32_t address, uint32_t size)
+{
+	return (address & (X86_TLB_PAGE_SIZE - 1)) > X86_TLB_PAGE_SIZE - size;
+}
+void* x86GetCPUMemoryWritePtr(X86_CPU* cpu, uint32_t address, uint32_t size)
+{
+	// the bytes in the next page may be mmio, rom or unmapped; the caller splits the write.
+	if (crosses_page(address, size))
+		return NULL;
+
+	X86_TLB_ENTRY* entry = &cpu->tlb.write[X86_TLB_INDEX(address)];
+	if (entry->tag == X86_TLB_TAG(address))
+		return (BYTE*)(entry->addend + address);
+
+	// miss; the write may hit decoded code.
+	void* ptr = x86TlbFill(cpu, address, X86_TLB_WRITE);
+	if (ptr != NULL)
+		x86CPUInvalidateCode(cpu, address, size);
+	return ptr;
+}
+static void* fill_fetch_window(X86_CPU* cpu, uint32_t offset)
+{
+	// point the window at the tlb page that holds cs:offset, stopping where the offset wraps.
+	X86_FETCH_WINDOW* window = &cpu->fetch_window;
+	uint32_t mask = cpu->segment_descriptors[SEG_CS].mask;
+	uint32_t address = x86GetEffectiveAddress(cpu, offset);
+	X86_TLB_ENTRY* entry = &cpu->tlb.fetch[X86_TLB_INDEX(address)];
+	BYTE* ptr;
+	uint32_t below;
+	uint32_t above;
+
+	if (entry->tag == X86_TLB_TAG(address))
+		ptr = (BYTE*)(entry->addend + address);
+	else
+		ptr = (BYTE*)x86TlbFill(cpu, address, X86_TLB_FETCH);
+
+	if (ptr == NULL) {
+		window->size = 0;
+		return NULL;
 	}
+
+	below = address & (X86_TLB_PAGE_SIZE - 1);
+	above = (X86_TLB_PAGE_SIZE - 1) - below;
+	if (below > (offset & mask))
+		below = offset & mask;
+	if (above > mask - (offset & mask))
+		above = mask - (offset & mask);
+
+	window->addend = (uintptr_t)ptr - offset;
+	window->start = offset - below;
+	window->size = below + above + 1;
+	return ptr;
+}
+static void* get_fetch_ptr(X86_CPU* cpu, uint32_t offset, uint32_t size)
+{
+	// host pointer to size instruction bytes at cs:offset, or NULL if they are not all in one window.
+	X86_FETCH_WINDOW* window = &cpu->fetch_window;
+	uint32_t index = offset - window->start;
+	if (index < window->size && window->size - index >= size)
+		return (BYTE*)(window->addend + offset);
+
+	if (fill_fetch_window(cpu, offset) == NULL)
+		return NULL;
+	index = offset - window->start;
+	if (window->size - index >= size)
+		return (BYTE*)(window->addend + offset);
 	return NULL;
 }
+static uint32_t fetch_split(X86_CPU* cpu, uint32_t offset, uint32_t size)
+{
+	// the bytes are not all in the window; they may cross a page or wrap the offset. fetch them one at a time. bytes that are not host memory read as 0.
+	uint32_t value = 0;
+	uint32_t i;
+	for (i = 0; i < size; ++i) {
+		BYTE* ptr = (BYTE*)get_fetch_ptr(cpu, offset + i, 1);
+		if (ptr != NULL)
+			value |= (uint32_t)*ptr << (i * 8);
+	}
+	return value;
+}
+void* x86GetCPUFetchPtr(X86_CPU* cpu, uint32_t address)
+{
+	return get_fetch_ptr(cpu, address, 1);
+}
+void* x86GetCPUMemorySpan(X86_CPU* cpu, uint32_t segment, uint32_t offset, int down, int write, uint32_t* size)
+{
+	uint32_t mask = cpu->segment_descriptors[segment].mask;
+	uint32_t effective;
+	X86_BUS_REGION* region;
+	uint32_t first;
+	uint32_t last;
+	BYTE* page;
+
+	offset &= mask;
+	effective = x86GetLinearAddress(cpu, segment, offset);
+	*size = 0;
+
+	region = x86BusGetRegion(cpu, effective);
+	page = x86BusGetHostPage(cpu, effective, write ? X86_BUS_WRITE : X86_BUS_READ);
+	if (page == NULL)
+		return NULL;
+
+	// stop where the offset wraps, at the end of a ram or rom region, or at the end of the page if the host range may not
+	// go on past it; other regions cover part of the region, or it is a mirror or unmapped space.
+	if (region->split || (region->type != X86_BUS_RAM && region->type != X86_BUS_ROM)) {
+		first = effective & ~(X86_BUS_PAGE_SIZE - 1);
+		last = effective | (X86_BUS_PAGE_SIZE - 1);
+	}
+	else {
+		first = region->base;
+		last = region->end;
+	}
+	if (down) {
+		*size = (offset < effective - first ? offset : effective - first) + 1;
+	}
+	else {
+		*size = (mask - offset < last - effective ? mask - offset : last - effective) + 1;
+	}
+	return page + (effective & (X86_BUS_PAGE_SIZE - 1));
+}
+static uint32_t read_split(X86_CPU* cpu, uint32_t address, uint32_t size)
+{
+	// an access that crosses a page; each byte goes to the region of its own page.
+	uint32_t value = 0;
+	for (uint32_t i = 0; i < size; ++i) {
+		value |= (uint32_t)x86CPUReadByte(cpu, address + i) << (i * 8);
+	}
+	return value;
+}
 uint32_t x86CPUReadMemory(X86_CPU* cpu, uint32_t address, uint32_t operand_size)
 {
 	switch (operand_size) {
@@ -52,44 +191,75 @@ uint32_t x86CPUReadMemory(X86_CPU* cpu, uint32_t address, uint32_t operand_size)
 }
 BYTE x86CPUReadByte(X86_CPU* cpu, uint32_t address)
 {
-	BYTE* ptr = (BYTE*)x86GetCPUMemoryPtr(cpu, address);
+	BYTE* ptr = (BYTE*)get_read_ptr(cpu, address);
 	if (ptr != NULL)
 		return *ptr;
-	return 0;
+	return (BYTE)x86BusRead(cpu, address, 1);
 }
 WORD x86CPUReadWord(X86_CPU* cpu, uint32_t address)
 {
-	WORD* ptr = (WORD*)x86GetCPUMemoryPtr(cpu, address);
+	if (crosses_page(address, 2))
+		return (WORD)read_split(cpu, address, 2);
+	WORD* ptr = (WORD*)get_read_ptr(cpu, address);
 	if (ptr != NULL)
 		return *ptr;
-	return 0;
+	return (WORD)x86BusRead(cpu, address, 2);
 }
 DWORD x86CPUReadDword(X86_CPU* cpu, uint32_t address)
 {
-	DWORD* ptr = (DWORD*)x86GetCPUMemoryPtr(cpu, address);
+	if (crosses_page(address, 4))
+		return (DWORD)read_split(cpu, address, 4);
+	DWORD* ptr = (DWORD*)get_read_ptr(cpu, address);
 	if (ptr != NULL)
 		return *ptr;
-	return 0;
+	return (DWORD)x86BusRead(cpu, address, 4);
 }
 
 /* WRITE MEMORY */
+static void write_bus(X86_CPU* cpu, uint32_t address, uint32_t size, uint32_t value)
+{
+	// a write with no host pointer; one that crosses a page goes a byte at a time to the region of each page.
+	if (!crosses_page(address, size)) {
+		x86BusWrite(cpu, address, size, value);
+		return;
+	}
+	for (uint32_t i = 0; i < size; ++i) {
+		BYTE* ptr = (BYTE*)x86GetCPUMemoryWritePtr(cpu, address + i, 1);
+		if (ptr != NULL)
+			*ptr = (BYTE)(value >> (i * 8));
+		else
+			x86BusWrite(cpu, address + i, 1, (BYTE)(value >> (i * 8)));
+	}
+}
 void x86CPUWriteByte(X86_CPU* cpu, uint32_t address, BYTE value)
 {
-	BYTE* ptr = (BYTE*)x86GetCPUMemoryPtr(cpu, address);
+	BYTE* ptr = (BYTE*)x86GetCPUMemoryWritePtr(cpu, address, 1);
+	if (cpu->trace.record != NULL)
+		x86TraceWrite(cpu, address, 1, value);
 	if (ptr != NULL)
 		*ptr = value;
+	else
+		x86BusWrite(cpu, address, 1, value);
 }
 void x86CPUWriteWord(X86_CPU* cpu, uint32_t address, WORD value)
 {
-	WORD* ptr = (WORD*)x86GetCPUMemoryPtr(cpu, address);
+	WORD* ptr = (WORD*)x86GetCPUMemoryWritePtr(cpu, address, 2);
+	if (cpu->trace.record != NULL)
+		x86TraceWrite(cpu, address, 2, value);
 	if (ptr != NULL)
 		*ptr = value;
+	else
+		write_bus(cpu, address, 2, value);
 }
 void x86CPUWriteDword(X86_CPU* cpu, uint32_t address, DWORD value)
 {
-	DWORD* ptr = (DWORD*)x86GetCPUMemoryPtr(cpu, address);
+	DWORD* ptr = (DWORD*)x86GetCPUMemoryWritePtr(cpu, address, 4);
+	if (cpu->trace.record != NULL)
+		x86TraceWrite(cpu, address, 4, value);
 	if (ptr != NULL)
 		*ptr = value;
+	else
+		write_bus(cpu, address, 4, value);
 }
 
 /* FETCH MEMORY AT EIP */
@@ -105,41 +275,42 @@ uint32_t x86CPUFetchMemory(X86_CPU* cpu, uint32_t operand_size, uint32_t* counte
 	}
 	return 0;
 }
+int32_t x86CPUFetchMemorySigned(X86_CPU* cpu, uint32_t operand_size, uint32_t* counter)
+{
+	switch (operand_size) {
+		case 1:
+			return (signed char)x86CPUFetchByte(cpu, counter);
+		case 2:
+			return (short)x86CPUFetchWord(cpu, counter);
+		case 4:
+			return (int)x86CPUFetchDword(cpu, counter);
+	}
+	return 0;
+}
 BYTE x86CPUFetchByte(X86_CPU* cpu, uint32_t* counter)
 {
-	BYTE* ptr = (BYTE*)x86GetCPUMemoryPtr(cpu, cpu->eip + *counter);
+	uint32_t offset = cpu->eip + *counter;
+	X86_FETCH_WINDOW* window = &cpu->fetch_window;
 	*counter += 1;
-	if (ptr != NULL)
-		return *ptr;
-	return 0;
+	if (offset - window->start < window->size)
+		return *(BYTE*)(window->addend + offset);
+	return (BYTE)fetch_split(cpu, offset, 1);
 }
 WORD x86CPUFetchWord(X86_CPU* cpu, uint32_t* counter)
 {
-	WORD* ptr = (WORD*)x86GetCPUMemoryPtr(cpu, cpu->eip + *counter);
+	uint32_t offset = cpu->eip + *counter;
+	X86_FETCH_WINDOW* window = &cpu->fetch_window;
 	*counter += 2;
-	if (ptr != NULL)
-		return *ptr;
-	return 0;
+	if (window->size > 1 && offset - window->start < window->size - 1)
+		return *(WORD*)(window->addend + offset);
+	return (WORD)fetch_split(cpu, offset, 2);
 }
 DWORD x86CPUFetchDword(X86_CPU* cpu, uint32_t* counter)
 {
-	DWORD* ptr = (DWORD*)x86GetCPUMemoryPtr(cpu, cpu->eip + *counter);
+	uint32_t offset = cpu->eip + *counter;
+	X86_FETCH_WINDOW* window = &cpu->fetch_window;
 	*counter += 4;
-	if (ptr != NULL)
-		return *ptr;
-	return 0;
-}
-
-/* IO read / write */
-BYTE x86CPUGetIOByte(X86_CPU* cpu, uint32_t address) {
-	switch (address) {
-		case 0xC000:
-			return 0x10;
-		case 0x0cfc:
-			return 0x10;
-	}
-	return 0;
-}
-void x86CPUSetIOByte(X86_CPU* cpu, uint32_t operand_size, uint32_t address, uint32_t value) {
-
+	if (window->size > 3 && offset - window->start < window->size - 3)
+		return *(DWORD*)(window->addend + offset);
+	return (DWORD)fetch_split(cpu, offset, 4);
 }
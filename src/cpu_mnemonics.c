@@ -8,6 +8,7 @@
 
 #include "cpu.h"
 #include "cpu_mnemonics.h"
+#include "cpu_memory.h"
 
 #undef MNEMONIC_STR
 #undef MNEMONIC_REG
@@ -105,27 +106,15 @@ void get_16bit_indirect_mnemonic(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t d
 
 BYTE fetch_byte(X86_CPU* cpu, uint32_t* counter)
 {
-	BYTE* ptr = (BYTE*)(cpu->eip_ptr + *counter);
-	*counter += 1;
-	if (ptr != NULL)
-		return *ptr;
-	return 0;
+	return x86CPUFetchByte(cpu, counter);
 }
 WORD fetch_word(X86_CPU* cpu, uint32_t* counter)
 {
-	WORD* ptr = (WORD*)(cpu->eip_ptr + *counter);
-	*counter += 2;
-	if (ptr != NULL)
-		return *ptr;
-	return 0;
+	return x86CPUFetchWord(cpu, counter);
 }
 DWORD fetch_dword(X86_CPU* cpu, uint32_t* counter)
 {
-	DWORD* ptr = (DWORD*)(cpu->eip_ptr + *counter);
-	*counter += 4;
-	if (ptr != NULL)
-		return *ptr;
-	return 0;
+	return x86CPUFetchDword(cpu, counter);
 }
 uint32_t fetch_memory(X86_CPU* cpu, uint32_t operand_size, uint32_t* counter)
 {
@@ -412,6 +401,31 @@ int jmp_far_mnemonic(X86_CPU* cpu, uint32_t counter)
 	X86_MNEMONIC_STR((cpu->output_str, "jmp 0x%04x:0x%08x", selector, address));
 	return 0;
 }
+int call_rel_mnemonic(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+{
+	int offset = 0;
+	switch (operand_size) {
+		case 2:
+			offset = (short)fetch_word(cpu, &counter);
+			break;
+		case 4:
+			offset = (int)fetch_dword(cpu, &counter);
+			break;
+	}
+	X86_MNEMONIC_STR((cpu->output_str, "call %d", offset));
+	return 0;
+}
+int ret_near_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t counter)
+{
+	if (opcode == 0xC2) {
+		uint16_t imm = fetch_word(cpu, &counter);
+		X86_MNEMONIC_STR((cpu->output_str, "ret 0x%x", imm));
+	}
+	else {
+		X86_MNEMONIC_STR((cpu->output_str, "ret"));
+	}
+	return 0;
+}
 int jcc_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, uint32_t counter)
 {
 	// jump condition
@@ -648,57 +662,33 @@ int nop_mnemonic(X86_CPU* cpu, uint32_t counter)
 	X86_MNEMONIC_STR((cpu->output_str, "nop"));
 	return 0;
 }
-int movs_mnemonic(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int string_mnemonic(X86_CPU* cpu, const char* rep, const char* name, uint32_t operand_size)
 {
-	// Move Data From String to String - MOVS r8/r16/r32
-	// move byte/word/dword from address ds:si/esi to es:di/edi.
-	
+	// String instructions - MOVS, CMPS, STOS, LODS, SCAS
 	switch (operand_size) {
 		case 4:
-			X86_MNEMONIC_STR((cpu->output_str, "movsd"));
+			X86_MNEMONIC_STR((cpu->output_str, "%s%sd", rep, name));
 			break;
 		case 2:
-			X86_MNEMONIC_STR((cpu->output_str, "movsw"));
+			X86_MNEMONIC_STR((cpu->output_str, "%s%sw", rep, name));
 			break;
 		case 1:
-			X86_MNEMONIC_STR((cpu->output_str, "movsb"));
+			X86_MNEMONIC_STR((cpu->output_str, "%s%sb", rep, name));
 			break;
 	}
 
 	return 0;
 }
-int stos_mnemonic(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int movs_mnemonic(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
 {
-	// Store String - STOS r8/m16/m32
-	switch (operand_size) {
-		case 4:
-			X86_MNEMONIC_STR((cpu->output_str, "stosd"));
-			break;
-		case 2:
-			X86_MNEMONIC_STR((cpu->output_str, "stosw"));
-			break;
-		case 1:
-			X86_MNEMONIC_STR((cpu->output_str, "stosb"));
-			break;
-	}
-
-	return 0;
+	// Move Data From String to String - MOVS r8/r16/r32
+	// move byte/word/dword from address ds:si/esi to es:di/edi.
+	return string_mnemonic(cpu, "", "movs", operand_size);
 }
-int rep_movs_mnemonic(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
+int stos_mnemonic(X86_CPU* cpu, uint32_t operand_size, uint32_t counter)
 {
-	switch (operand_size) {
-		case 4:
-			X86_MNEMONIC_STR((cpu->output_str, "rep movsd"));
-			break;
-		case 2:
-			X86_MNEMONIC_STR((cpu->output_str, "rep movsw"));
-			break;
-		case 1:
-			X86_MNEMONIC_STR((cpu->output_str, "rep movsb"));
-			break;
-	}
-
-	return 0;
+	// Store String - STOS r8/m16/m32
+	return string_mnemonic(cpu, "", "stos", operand_size);
 }
 int loop_mnemonic(X86_CPU* cpu, uint32_t counter)
 {
@@ -739,16 +729,38 @@ int xchg_reg_mnemonic(X86_CPU* cpu, BYTE reg1, BYTE reg2, uint32_t operand_size,
 	return 0;
 }
 
-int opcode_f3_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, uint32_t counter)
+int opcode_rep_mnemonic(X86_CPU* cpu, BYTE opcode, BYTE repne, uint32_t operand_size, uint32_t counter)
 {
+	// F3 xx = rep / repe, F2 xx = repne
+	if ((opcode & 1) == 0) // A4, A6, AA, AC, AE = BYTE
+		operand_size = 1;
+
 	switch (opcode) {
-		case 0xA5: // MOV WORD or DWORD
-			rep_movs_mnemonic(cpu, operand_size, counter);
-			return X86_CPU_ERROR_SUCCESS;
+		case 0xA4:
+		case 0xA5:
+			if (repne)
+				break;
+			return string_mnemonic(cpu, "rep ", "movs", operand_size);
 
-		case 0xA4: // MOV BYTE
-			rep_movs_mnemonic(cpu, 1, counter);
-			return X86_CPU_ERROR_SUCCESS;
+		case 0xA6:
+		case 0xA7:
+			return string_mnemonic(cpu, repne ? "repne " : "repe ", "cmps", operand_size);
+
+		case 0xAA:
+		case 0xAB:
+			if (repne)
+				break;
+			return string_mnemonic(cpu, "rep ", "stos", operand_size);
+
+		case 0xAC:
+		case 0xAD:
+			if (repne)
+				break;
+			return string_mnemonic(cpu, "rep ", "lods", operand_size);
+
+		case 0xAE:
+		case 0xAF:
+			return string_mnemonic(cpu, repne ? "repne " : "repe ", "scas", operand_size);
 	}
 
 	return X86_CPU_ERROR_UD;
@@ -759,7 +771,7 @@ int opcode_0f_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t address_size, uint32_
 
 	switch (opcode) { // 0F xx
 		case 0x00: // LLDT
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			if (mode.bits.reg == 0b010) { // 0f 00 /2 = LLDT r/m
 				if (mode.bits.mod == 0b11) {
 					return lldt_reg_mnemonic(cpu, mode.bits.rm, counter);
@@ -770,7 +782,7 @@ int opcode_0f_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t address_size, uint32_
 			} break;
 
 		case 0x01: // LGDT / LIDT
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			if (mode.bits.reg == 0b010) { // 0f 01 /2 = LGDT m
 				return lgdt_mnemonic(cpu, &mode.bits, address_size, operand_size, segment_override_byte, counter);
 			}
@@ -785,11 +797,11 @@ int opcode_0f_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t address_size, uint32_
 			return wbinvd_mnemonic(cpu, counter);
 
 		case 0x20: //mov r32, cr0-7
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			return mov_r32_cr_mnemonic(cpu, &mode.bits, counter);
 
 		case 0x22: //mov cr0-7, r32
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			return mov_cr_r32_mnemonic(cpu, &mode.bits, counter);
 
 		case 0x30: // WRMSR
@@ -814,19 +826,19 @@ int opcode_0f_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t address_size, uint32_
 			return jcc_mnemonic(cpu, opcode, operand_size, counter);
 
 		case 0xB6: // MOVZX r16/r32, r/m8
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			return movzx_mnemonic(cpu, &mode.bits, 1, operand_size, counter);
 
 		case 0xB7: // MOVZX r32, r/m16
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			return movzx_mnemonic(cpu, &mode.bits, 2, 4, counter);
 
 		case 0xBE: // MOVSX r16/r32, r/m8
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			return movsx_mnemonic(cpu, &mode.bits, 1, operand_size, counter);
 
 		case 0xBF: // MOVSX r32, r/m16
-			mode.byte = cpu->eip_ptr[counter++];
+			mode.byte = x86CPUFetchByte(cpu, &counter);
 			return movsx_mnemonic(cpu, &mode.bits, 2, 4, counter);
 	}
 
@@ -921,7 +933,7 @@ int opcode_one_byte_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, u
 
 		case 0x8E: {
 			X86_MOD_RM b;
-			b.byte = cpu->eip_ptr[counter++];
+			b.byte = x86CPUFetchByte(cpu, &counter);
 			return mov_seg_r32_mnemonic(cpu, &b.bits, counter);
 		}
 
@@ -947,11 +959,26 @@ int opcode_one_byte_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, u
 		case 0xA5:
 			return movs_mnemonic(cpu, operand_size, counter);
 
+		case 0xA6:
+			return string_mnemonic(cpu, "", "cmps", 1);
+		case 0xA7:
+			return string_mnemonic(cpu, "", "cmps", operand_size);
+
 		case 0xAA:
 			return stos_mnemonic(cpu, 1, counter);
 		case 0xAB:
 			return stos_mnemonic(cpu, operand_size, counter);
 
+		case 0xAC:
+			return string_mnemonic(cpu, "", "lods", 1);
+		case 0xAD:
+			return string_mnemonic(cpu, "", "lods", operand_size);
+
+		case 0xAE:
+			return string_mnemonic(cpu, "", "scas", 1);
+		case 0xAF:
+			return string_mnemonic(cpu, "", "scas", operand_size);
+
 		case 0xB0:
 		case 0xB1:
 		case 0xB2:
@@ -972,6 +999,10 @@ int opcode_one_byte_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, u
 		case 0xBF: // MOV 16/32bit
 			return move_imm_reg_mnemonic(cpu, (opcode & 0b111), operand_size, counter);
 
+		case 0xC2:
+		case 0xC3:
+			return ret_near_mnemonic(cpu, opcode, counter);
+
 		case 0xE0:
 			return loopne_mnemonic(cpu, counter);
 		case 0xE1:
@@ -988,6 +1019,8 @@ int opcode_one_byte_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, u
 		case 0xE7:
 			return out_byte_imm_mnemonic(cpu, operand_size, counter);
 
+		case 0xE8:
+			return call_rel_mnemonic(cpu, operand_size, counter);
 		case 0xE9:
 			return jmp_imm_rel_mnemonic(cpu, operand_size, counter);
 		case 0xEA:
@@ -1017,7 +1050,7 @@ int opcode_one_byte_mnemonic(X86_CPU* cpu, BYTE opcode, uint32_t operand_size, u
 
 		case 0xFE: {
 			X86_MOD_RM b;
-			b.byte = cpu->eip_ptr[counter++];
+			b.byte = x86CPUFetchByte(cpu, &counter);
 			if (b.bits.mod == 0b11) {
 				switch (b.bits.reg) {
 					case 0b000: // INC
@@ -1168,8 +1201,8 @@ int x86CPUGetMnemonic(X86_CPU* cpu, char* str)
 	if (prefix.byte_0f) {
 		return opcode_0f_mnemonic(cpu, opcode.byte, address_size, operand_size, prefix.segment_override, counter);
 	}
-	else if (prefix.byte_f3) {
-		return opcode_f3_mnemonic(cpu, opcode.byte, operand_size, counter);
+	else if (prefix.byte_f3 || prefix.byte_f2) {
+		return opcode_rep_mnemonic(cpu, opcode.byte, prefix.byte_f2, operand_size, counter);
 	}
 	else {
 		result = opcode_one_byte_mnemonic(cpu, opcode.byte, operand_size, counter);
@@ -1183,7 +1216,7 @@ int x86CPUGetMnemonic(X86_CPU* cpu, char* str)
 
 	// assume mod r/m byte
 	X86_MOD_RM mode = { 0 };
-	mode.byte = cpu->eip_ptr[counter++];
+	mode.byte = x86CPUFetchByte(cpu, &counter);
 
 	if (opcode.byte == 0xC0) {
 		// C0 = Eb, ib (operand1 = 8 regardless of operand_size) (operand2 = imm8)
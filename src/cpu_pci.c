@@ -0,0 +1,281 @@
+// cpu_pci.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_pci.h"
+#include "cpu_bus.h"
+#include "cpu_io.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* PCI config space
+
+	Software reaches config space with type 1 config cycles: a dword write of
+	the bus, device, function and register to 0xCF8, then an access to
+	0xCFC-0xCFF. Bits 23:8 of the config address index the function table and
+	the register bits index the function's config array, so a config access is
+	a table load and a few byte moves.
+
+	Memory bars are bus regions. Writing a bar or the command register puts
+	the bar's region at the decoded address, or takes it off the bus when
+	memory space is disabled. */
+
+#define FUNCTION_INDEX(address) (((address) >> 8) & ((X86_PCI_BUS_COUNT << 8) - 1))
+#define BAR_REG(index) (X86_PCI_BAR0 + (index) * 4)
+
+static void set_config(X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size, uint32_t value)
+{
+	uint32_t i;
+	for (i = 0; i < size; ++i) {
+		function->config[reg + i] = (uint8_t)(value >> (i * 8));
+	}
+}
+static uint32_t get_config(X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size)
+{
+	uint32_t value = 0;
+	uint32_t i;
+	for (i = 0; i < size; ++i) {
+		value |= (uint32_t)function->config[reg + i] << (i * 8);
+	}
+	return value;
+}
+static void set_write_mask(X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size, uint32_t mask)
+{
+	uint32_t i;
+	for (i = 0; i < size; ++i) {
+		function->write_mask[reg + i] = (uint8_t)(mask >> (i * 8));
+	}
+}
+static uint32_t bar_count(X86_PCI_FUNCTION* function)
+{
+	return (function->config[X86_PCI_HEADER_TYPE] & ~X86_PCI_HEADER_MULTI_FUNCTION) == X86_PCI_HEADER_BRIDGE ? 2 : X86_PCI_BAR_COUNT;
+}
+
+static void map_bar(X86_PCI* pci, X86_PCI_FUNCTION* function, uint32_t index)
+{
+	X86_CPU* cpu = pci->cpu;
+	X86_PCI_BAR* bar = &function->bars[index];
+	uint32_t base;
+	uint32_t end;
+
+	if (bar->size == 0 || (bar->type & X86_PCI_BAR_IO))
+		return;
+
+	base = get_config(function, BAR_REG(index), 4) & ~(bar->size - 1);
+	end = base + (bar->size - 1);
+
+	// an unassigned bar or one that wraps the top of memory decodes nothing.
+	if ((function->config[X86_PCI_COMMAND] & X86_PCI_COMMAND_MEMORY) == 0 || base == 0 || end < base) {
+		x86BusUnmapRegion(cpu, bar->region);
+		return;
+	}
+
+	if (bar->region == 0) {
+		uint32_t region = cpu->bus.region_count;
+		if (x86BusAddMmio(cpu, base, end, bar->read, bar->write, bar->device) == 0)
+			bar->region = region;
+		return;
+	}
+
+	x86BusMapRegion(cpu, bar->region, base, end);
+}
+
+static uint32_t address_read(void* device, uint16_t port)
+{
+	return ((X86_PCI*)device)->address;
+}
+static void address_write(void* device, uint16_t port, uint32_t value)
+{
+	((X86_PCI*)device)->address = value & X86_PCI_ADDRESS_MASK;
+}
+static uint32_t data_read(X86_PCI* pci, uint16_t port, uint32_t size)
+{
+	X86_PCI_FUNCTION* function = x86PciGetFunction(pci, pci->address);
+	if (function == NULL)
+		return 0xFFFFFFFF; // master abort
+	return x86PciConfigRead(pci, function, (pci->address & 0xFC) | (port & 3), size);
+}
+static void data_write(X86_PCI* pci, uint16_t port, uint32_t size, uint32_t value)
+{
+	X86_PCI_FUNCTION* function = x86PciGetFunction(pci, pci->address);
+	if (function != NULL)
+		x86PciConfigWrite(pci, function, (pci->address & 0xFC) | (port & 3), size, value);
+}
+static uint32_t data_read_byte(void* device, uint16_t port)
+{
+	return data_read((X86_PCI*)device, port, 1);
+}
+static uint32_t data_read_word(void* device, uint16_t port)
+{
+	return data_read((X86_PCI*)device, port, 2);
+}
+static uint32_t data_read_dword(void* device, uint16_t port)
+{
+	return data_read((X86_PCI*)device, port, 4);
+}
+static void data_write_byte(void* device, uint16_t port, uint32_t value)
+{
+	data_write((X86_PCI*)device, port, 1, value);
+}
+static void data_write_word(void* device, uint16_t port, uint32_t value)
+{
+	data_write((X86_PCI*)device, port, 2, value);
+}
+static void data_write_dword(void* device, uint16_t port, uint32_t value)
+{
+	data_write((X86_PCI*)device, port, 4, value);
+}
+
+int x86InitPci(X86_PCI* pci, X86_CPU* cpu)
+{
+	// the address register only latches dword accesses; narrower ones split into bytes no handler takes.
+	const X86_IO_READ_HANDLER address_reads[3] = { NULL, NULL, address_read };
+	const X86_IO_WRITE_HANDLER address_writes[3] = { NULL, NULL, address_write };
+	const X86_IO_READ_HANDLER data_reads[3] = { data_read_byte, data_read_word, data_read_dword };
+	const X86_IO_WRITE_HANDLER data_writes[3] = { data_write_byte, data_write_word, data_write_dword };
+
+	memset(pci, 0, sizeof(X86_PCI));
+	pci->cpu = cpu;
+
+	if (x86IoAddDevice(cpu, X86_PCI_CONFIG_ADDRESS, X86_PCI_CONFIG_ADDRESS + 3, address_reads, address_writes, pci) != 0)
+		return 1;
+	if (x86IoAddDevice(cpu, X86_PCI_CONFIG_DATA, X86_PCI_CONFIG_DATA + 3, data_reads, data_writes, pci) != 0)
+		return 1;
+
+	return 0;
+}
+void x86FreePci(X86_PCI* pci)
+{
+	uint32_t i;
+	for (i = 0; i < (X86_PCI_BUS_COUNT << 8); ++i) {
+		if (pci->functions[i] != NULL) {
+			free(pci->functions[i]);
+			pci->functions[i] = NULL;
+		}
+	}
+}
+
+X86_PCI_FUNCTION* x86PciAddFunction(X86_PCI* pci, uint8_t bus, uint8_t device, uint8_t function, uint16_t vendor_id, uint16_t device_id, uint32_t class_code, uint8_t header_type)
+{
+	uint32_t index = FUNCTION_INDEX(X86_PCI_ADDRESS(bus, device, function, 0));
+	X86_PCI_FUNCTION* entry;
+	X86_PCI_FUNCTION* first;
+
+	if (bus >= X86_PCI_BUS_COUNT || device > 31 || function > 7 || header_type > X86_PCI_HEADER_BRIDGE || pci->functions[index] != NULL)
+		return NULL;
+
+	entry = (X86_PCI_FUNCTION*)malloc(sizeof(X86_PCI_FUNCTION));
+	if (entry == NULL)
+		return NULL;
+
+	memset(entry, 0, sizeof(X86_PCI_FUNCTION));
+	entry->bus = bus;
+	entry->device = device;
+	entry->function = function;
+
+	set_config(entry, X86_PCI_VENDOR_ID, 2, vendor_id);
+	set_config(entry, X86_PCI_DEVICE_ID, 2, device_id);
+	set_config(entry, X86_PCI_CLASS_CODE, 3, class_code);
+	entry->config[X86_PCI_HEADER_TYPE] = header_type;
+
+	set_write_mask(entry, X86_PCI_COMMAND, 2, X86_PCI_COMMAND_IO | X86_PCI_COMMAND_MEMORY | X86_PCI_COMMAND_MASTER);
+	set_write_mask(entry, X86_PCI_CACHE_LINE_SIZE, 2, 0xFFFF);
+	set_write_mask(entry, X86_PCI_INTERRUPT_LINE, 1, 0xFF);
+	if (header_type == X86_PCI_HEADER_BRIDGE) {
+		set_write_mask(entry, X86_PCI_PRIMARY_BUS, 4, 0xFFFFFFFF); // primary, secondary and subordinate bus, secondary latency
+		set_write_mask(entry, 0x1C, 2, 0xF0F0); // io base and limit
+		set_write_mask(entry, 0x20, 4, 0xFFF0FFF0); // memory base and limit
+		set_write_mask(entry, 0x24, 4, 0xFFF0FFF0); // prefetchable memory base and limit
+		set_write_mask(entry, 0x3E, 2, 0xFFFF); // bridge control
+	}
+	// device specific registers; chipset setup writes them and reads them back.
+	memset(entry->write_mask + 0x40, 0xFF, X86_PCI_CONFIG_SIZE - 0x40);
+
+	pci->functions[index] = entry;
+
+	// function 0 tells software to look for the other functions of the device.
+	first = pci->functions[index & ~7];
+	if (function != 0 && first != NULL)
+		first->config[X86_PCI_HEADER_TYPE] |= X86_PCI_HEADER_MULTI_FUNCTION;
+	if (function == 0) {
+		uint32_t i;
+		for (i = 1; i < 8; ++i) {
+			if (pci->functions[index + i] != NULL)
+				entry->config[X86_PCI_HEADER_TYPE] |= X86_PCI_HEADER_MULTI_FUNCTION;
+		}
+	}
+
+	return entry;
+}
+
+X86_PCI_FUNCTION* x86PciGetFunction(X86_PCI* pci, uint32_t address)
+{
+	if ((address & X86_PCI_ADDRESS_ENABLE) == 0 || ((address >> 16) & 0xFF) >= X86_PCI_BUS_COUNT)
+		return NULL;
+	return pci->functions[FUNCTION_INDEX(address)];
+}
+
+int x86PciSetBar(X86_PCI_FUNCTION* function, uint32_t index, uint32_t type, uint32_t size, X86_BUS_READ_HANDLER read, X86_BUS_WRITE_HANDLER write, void* device)
+{
+	X86_PCI_BAR* bar;
+	uint32_t low_bits;
+
+	if (index >= bar_count(function) || size == 0 || (size & (size - 1)) != 0)
+		return 1;
+
+	if (type & X86_PCI_BAR_IO) {
+		low_bits = 3;
+		if (size < 4 || size > 0x10000)
+			return 1;
+	}
+	else {
+		low_bits = 0xF;
+		if (size < X86_BUS_PAGE_SIZE)
+			return 1;
+	}
+
+	bar = &function->bars[index];
+	bar->type = type;
+	bar->size = size;
+	bar->read = read;
+	bar->write = write;
+	bar->device = device;
+
+	// the address bits below the size read back as 0; that is how software sizes the bar.
+	set_config(function, BAR_REG(index), 4, type & low_bits);
+	set_write_mask(function, BAR_REG(index), 4, ~(size - 1) & ~low_bits);
+	return 0;
+}
+
+uint32_t x86PciConfigRead(X86_PCI* pci, X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size)
+{
+	if (reg + size > X86_PCI_CONFIG_SIZE)
+		size = X86_PCI_CONFIG_SIZE - reg;
+	return get_config(function, reg, size);
+}
+void x86PciConfigWrite(X86_PCI* pci, X86_PCI_FUNCTION* function, uint32_t reg, uint32_t size, uint32_t value)
+{
+	uint32_t i;
+	uint8_t mask;
+
+	if (reg + size > X86_PCI_CONFIG_SIZE)
+		size = X86_PCI_CONFIG_SIZE - reg;
+
+	for (i = 0; i < size; ++i) {
+		mask = function->write_mask[reg + i];
+		function->config[reg + i] = (function->config[reg + i] & ~mask) | ((uint8_t)(value >> (i * 8)) & mask);
+	}
+
+	// the command register or a bar changed; decode the bars again.
+	if (reg < BAR_REG(X86_PCI_BAR_COUNT) && reg + size > X86_PCI_COMMAND) {
+		for (i = 0; i < bar_count(function); ++i) {
+			map_bar(pci, function, i);
+		}
+	}
+}
@@ -0,0 +1,361 @@
+// cpu_profile.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpu_profile.h"
+#include "cpu_memory.h"
+#include "cpu_event.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Sampling profiler
+
+	A sample is an event posted every period instructions of virtual time, so
+	the run loop stops on the exact instruction and the profile of a run is the
+	same every time. The event adds the linear address of eip to one table
+	and the start of the block eip is in to another. The execution loops keep
+	the block start current: a block that runs to its end and a branch taken
+	outside a block both leave eip at the start of the next one.
+
+	When the clock passes several sample times at once, across a halt or a
+	skipped poll loop, eip was at the same instruction the whole time and the
+	sample counts for each of them.
+
+	A sample never wakes the cpu, so it must not keep a halted run going; when
+	the cpu is halted and no other event is posted to wake it, sampling ends. */
+
+#define PROFILE_TABLE_SIZE 0x1000 // entries a table starts with
+
+static X86_PROFILE_ENTRY* find_entry(X86_PROFILE_ENTRY* table, uint32_t capacity, uint32_t address)
+{
+	uint32_t hash = address * 0x9E3779B1;
+	uint32_t i = (hash ^ (hash >> 16)) & (capacity - 1);
+	while (table[i].count != 0 && table[i].address != address) {
+		i = (i + 1) & (capacity - 1);
+	}
+	return &table[i];
+}
+static int grow_table(X86_PROFILE_ENTRY** table, uint32_t* capacity)
+{
+	uint32_t new_capacity = *capacity == 0 ? PROFILE_TABLE_SIZE : *capacity * 2;
+	X86_PROFILE_ENTRY* entries = (X86_PROFILE_ENTRY*)malloc(new_capacity * sizeof(X86_PROFILE_ENTRY));
+	uint32_t i;
+
+	if (entries == NULL)
+		return 1;
+	memset(entries, 0, new_capacity * sizeof(X86_PROFILE_ENTRY));
+
+	for (i = 0; i < *capacity; ++i) {
+		if ((*table)[i].count != 0)
+			*find_entry(entries, new_capacity, (*table)[i].address) = (*table)[i];
+	}
+
+	if (*table != NULL)
+		free(*table);
+	*table = entries;
+	*capacity = new_capacity;
+	return 0;
+}
+static int add_sample(X86_PROFILE_ENTRY** table, uint32_t* capacity, uint32_t* count, uint32_t address, uint32_t weight)
+{
+	X86_PROFILE_ENTRY* entry;
+
+	// keep the table at most half full.
+	if ((*count + 1) * 2 > *capacity && grow_table(table, capacity) != 0)
+		return 1;
+
+	entry = find_entry(*table, *capacity, address);
+	if (entry->count == 0) {
+		entry->address = address;
+		*count += 1;
+	}
+	entry->count += weight;
+	return 0;
+}
+static void free_samples(X86_PROFILE* profile)
+{
+	if (profile->addresses != NULL) {
+		free(profile->addresses);
+		profile->addresses = NULL;
+	}
+	if (profile->blocks != NULL) {
+		free(profile->blocks);
+		profile->blocks = NULL;
+	}
+	profile->address_capacity = 0;
+	profile->address_count = 0;
+	profile->block_capacity = 0;
+	profile->block_count = 0;
+	profile->samples = 0;
+	profile->error = 0;
+}
+
+static void sample_event(X86_CPU* cpu, void* device, uint64_t time)
+{
+	X86_PROFILE* profile = &cpu->profile;
+	uint64_t weight = 1 + (cpu->clock - time) / profile->period;
+	uint32_t address = x86GetEffectiveAddress(cpu, cpu->eip);
+	uint32_t block = x86GetEffectiveAddress(cpu, profile->block);
+
+	if (!profile->error) {
+		if (add_sample(&profile->addresses, &profile->address_capacity, &profile->address_count, address, (uint32_t)weight) != 0 ||
+			add_sample(&profile->blocks, &profile->block_capacity, &profile->block_count, block, (uint32_t)weight) != 0)
+			profile->error = 1;
+		else
+			profile->samples += weight;
+	}
+
+	// the event is off the queue; anything left on it can still wake a halted cpu.
+	if (cpu->hlt && cpu->events.count == 0) {
+		profile->event = 0;
+		return;
+	}
+
+	profile->event = x86EventPost(cpu, time + weight * profile->period, sample_event, NULL);
+}
+
+int x86ProfileStart(X86_CPU* cpu, uint64_t period)
+{
+	X86_PROFILE* profile = &cpu->profile;
+
+	x86ProfileStop(cpu);
+	free_samples(profile);
+
+	if (period == 0)
+		return 1;
+
+	profile->period = period;
+	profile->block = cpu->eip;
+	profile->event = x86EventPost(cpu, cpu->clock + period, sample_event, NULL);
+	return profile->event == 0;
+}
+void x86ProfileStop(X86_CPU* cpu)
+{
+	X86_PROFILE* profile = &cpu->profile;
+	if (profile->event == 0)
+		return;
+	x86EventCancel(cpu, profile->event);
+	profile->event = 0;
+}
+void x86FreeProfile(X86_CPU* cpu)
+{
+	X86_PROFILE* profile = &cpu->profile;
+
+	x86ProfileStop(cpu);
+	free_samples(profile);
+
+	if (profile->symbols != NULL) {
+		free(profile->symbols);
+		profile->symbols = NULL;
+	}
+	profile->symbol_count = 0;
+	profile->symbol_capacity = 0;
+}
+
+int x86ProfileAddSymbol(X86_CPU* cpu, uint32_t address, const char* name)
+{
+	X86_PROFILE* profile = &cpu->profile;
+	X86_PROFILE_SYMBOL* symbol;
+
+	if (profile->symbol_count == profile->symbol_capacity) {
+		uint32_t capacity = profile->symbol_capacity == 0 ? 0x100 : profile->symbol_capacity * 2;
+		X86_PROFILE_SYMBOL* symbols = (X86_PROFILE_SYMBOL*)realloc(profile->symbols, capacity * sizeof(X86_PROFILE_SYMBOL));
+		if (symbols == NULL)
+			return 1;
+		profile->symbols = symbols;
+		profile->symbol_capacity = capacity;
+	}
+
+	symbol = &profile->symbols[profile->symbol_count++];
+	symbol->address = address;
+	profile->symbols_sorted = 0;
+	strncpy(symbol->name, name, X86_PROFILE_NAME_SIZE - 1);
+	symbol->name[X86_PROFILE_NAME_SIZE - 1] = '\0';
+	return 0;
+}
+int x86ProfileLoadSymbols(X86_CPU* cpu, const char* filename)
+{
+	FILE* file = fopen(filename, "r");
+	char line[256];
+	int result = 0;
+
+	if (file == NULL)
+		return 1;
+
+	while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+		char* name;
+		uint32_t address = (uint32_t)strtoul(line, &name, 16);
+		size_t length;
+
+		if (name == line || line[0] == '#' || line[0] == ';')
+			continue;
+
+		while (*name == ' ' || *name == '\t')
+			name++;
+		length = strlen(name);
+		while (length != 0 && (name[length - 1] == '\n' || name[length - 1] == '\r' || name[length - 1] == ' '))
+			name[--length] = '\0';
+		if (length == 0)
+			continue;
+
+		result = x86ProfileAddSymbol(cpu, address, name);
+	}
+
+	fclose(file);
+	return result;
+}
+
+/* REPORT */
+static int compare_symbols(const void* a, const void* b)
+{
+	uint32_t address_a = ((const X86_PROFILE_SYMBOL*)a)->address;
+	uint32_t address_b = ((const X86_PROFILE_SYMBOL*)b)->address;
+	return address_a < address_b ? -1 : (address_a > address_b ? 1 : 0);
+}
+static int compare_entries(const void* a, const void* b)
+{
+	uint32_t count_a = ((const X86_PROFILE_ENTRY*)a)->count;
+	uint32_t count_b = ((const X86_PROFILE_ENTRY*)b)->count;
+	return count_a < count_b ? 1 : (count_a > count_b ? -1 : 0);
+}
+static void sort_symbols(X86_PROFILE* profile)
+{
+	if (profile->symbols_sorted)
+		return;
+	if (profile->symbol_count != 0)
+		qsort(profile->symbols, profile->symbol_count, sizeof(X86_PROFILE_SYMBOL), compare_symbols);
+	profile->symbols_sorted = 1;
+}
+static int find_symbol(X86_PROFILE* profile, uint32_t address)
+{
+	// the last symbol at or below address; -1 if there is none. symbols are sorted.
+	int first = 0;
+	int last = (int)profile->symbol_count - 1;
+	int found = -1;
+	while (first <= last) {
+		int middle = (first + last) / 2;
+		if (profile->symbols[middle].address <= address) {
+			found = middle;
+			first = middle + 1;
+		}
+		else {
+			last = middle - 1;
+		}
+	}
+	return found;
+}
+static void get_symbol_name(X86_PROFILE* profile, uint32_t address, char* buf, size_t size)
+{
+	int symbol = find_symbol(profile, address);
+	if (symbol < 0)
+		snprintf(buf, size, "?");
+	else if (profile->symbols[symbol].address == address)
+		snprintf(buf, size, "%s", profile->symbols[symbol].name);
+	else
+		snprintf(buf, size, "%s+0x%x", profile->symbols[symbol].name, address - profile->symbols[symbol].address);
+}
+const char* x86ProfileGetSymbol(X86_CPU* cpu, uint32_t address)
+{
+	X86_PROFILE* profile = &cpu->profile;
+	int symbol;
+
+	sort_symbols(profile);
+	symbol = find_symbol(profile, address);
+	if (symbol < 0 || profile->symbols[symbol].address != address)
+		return NULL;
+	return profile->symbols[symbol].name;
+}
+static X86_PROFILE_ENTRY* sort_table(X86_PROFILE_ENTRY* table, uint32_t capacity, uint32_t count)
+{
+	// copy the used entries out, hottest first.
+	X86_PROFILE_ENTRY* entries = (X86_PROFILE_ENTRY*)malloc((count + 1) * sizeof(X86_PROFILE_ENTRY));
+	uint32_t n = 0;
+	uint32_t i;
+
+	if (entries == NULL)
+		return NULL;
+	for (i = 0; i < capacity; ++i) {
+		if (table[i].count != 0)
+			entries[n++] = table[i];
+	}
+	qsort(entries, n, sizeof(X86_PROFILE_ENTRY), compare_entries);
+	return entries;
+}
+static void write_entries(X86_PROFILE* profile, FILE* file, const char* title, X86_PROFILE_ENTRY* entries, uint32_t count, uint32_t max_entries)
+{
+	char name[X86_PROFILE_NAME_SIZE + 16];
+	uint32_t i;
+
+	fprintf(file, "\n%s\n", title);
+	for (i = 0; i < count && i < max_entries; ++i) {
+		get_symbol_name(profile, entries[i].address, name, sizeof(name));
+		fprintf(file, "  %6.2f%% %10u  %08x  %s\n", entries[i].count * 100.0 / profile->samples, entries[i].count, entries[i].address, name);
+	}
+}
+int x86ProfileWriteReport(X86_CPU* cpu, const char* filename, uint32_t max_entries)
+{
+	X86_PROFILE* profile = &cpu->profile;
+	X86_PROFILE_ENTRY* addresses;
+	X86_PROFILE_ENTRY* blocks;
+	X86_PROFILE_ENTRY* functions;
+	uint32_t function_count = 0;
+	uint32_t i;
+	FILE* file;
+
+	sort_symbols(profile);
+
+	addresses = sort_table(profile->addresses, profile->address_capacity, profile->address_count);
+	blocks = sort_table(profile->blocks, profile->block_capacity, profile->block_count);
+	functions = (X86_PROFILE_ENTRY*)malloc((profile->symbol_count + 1) * sizeof(X86_PROFILE_ENTRY));
+	file = fopen(filename, "w");
+	if (addresses == NULL || blocks == NULL || functions == NULL || file == NULL) {
+		if (addresses != NULL)
+			free(addresses);
+		if (blocks != NULL)
+			free(blocks);
+		if (functions != NULL)
+			free(functions);
+		if (file != NULL)
+			fclose(file);
+		return 1;
+	}
+
+	// each instruction's samples go to the symbol it is in; the code below the first symbol goes to address 0, shown as ?.
+	for (i = 0; i < profile->address_count; ++i) {
+		int symbol = find_symbol(profile, addresses[i].address);
+		uint32_t start = symbol < 0 ? 0 : profile->symbols[symbol].address;
+		uint32_t j;
+		for (j = 0; j < function_count; ++j) {
+			if (functions[j].address == start)
+				break;
+		}
+		if (j == function_count) {
+			functions[function_count].address = start;
+			functions[function_count].count = 0;
+			function_count += 1;
+		}
+		functions[j].count += addresses[i].count;
+	}
+	qsort(functions, function_count, sizeof(X86_PROFILE_ENTRY), compare_entries);
+
+	fprintf(file, "%llu samples, one every %llu instructions\n", (unsigned long long)profile->samples, (unsigned long long)profile->period);
+	if (profile->error)
+		fprintf(file, "out of memory; samples after the first %llu were dropped\n", (unsigned long long)profile->samples);
+
+	write_entries(profile, file, "symbols", functions, function_count, max_entries);
+	write_entries(profile, file, "blocks", blocks, profile->block_count, max_entries);
+	write_entries(profile, file, "instructions", addresses, profile->address_count, max_entries);
+
+	free(addresses);
+	free(blocks);
+	free(functions);
+	return fclose(file) != 0;
+}
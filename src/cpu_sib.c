@@ -57,275 +57,277 @@ uint32_t get_sib_scale(BYTE scale)
 	return 1;
 }
 
-int addressing_mode_reg(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
+int addressing_mode_reg(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
 	// 8/16/32 reg
 	if (state != NULL) {
-		state->value = x86CPUGetRegister(cpu, mode->rm, operand_size);
+		state->value = x86CPUGetRegister(cpu, instr->mode.bits.rm, operand_size);
 		state->type = INSTRUCTION_RM_REGISTER;
 	}
 	return 0;
 }
-int addressing_mode_disp(X86_CPU* cpu, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
+int addressing_mode_disp16(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
-	// disp16/32 - displacement only addressing mode
-	uint32_t disp = x86CPUFetchMemory(cpu, operand_size, counter);
+	// disp16 - displacement only addressing mode
+	uint32_t disp = instr->disp;
 
 	if (state != NULL) {
-		state->address = disp;
-		state->value = x86CPUReadMemory(cpu, disp, operand_size);
+		state->address = x86GetLinearAddress(cpu, instr->segment, disp);
+		state->value = x86CPUReadMemory(cpu, state->address, 2);
 		state->type = INSTRUCTION_RM_INDIRECT;
 	}
 	return 0;
 }
-int addressing_mode_32bit(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
+int addressing_mode_disp32(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
+{
+	// disp32 - displacement only addressing mode
+	uint32_t disp = instr->disp;
+
+	if (state != NULL) {
+		state->address = x86GetLinearAddress(cpu, instr->segment, disp);
+		state->value = x86CPUReadMemory(cpu, state->address, 4);
+		state->type = INSTRUCTION_RM_INDIRECT;
+	}
+	return 0;
+}
+int addressing_mode_32bit(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
 	// [reg]
-	uint32_t addr = x86CPUGetRegister(cpu, mode->rm, 4);
+	uint32_t addr = x86CPUGetRegister(cpu, instr->mode.bits.rm, 4);
 
 	if (state != NULL) {
-		state->address = addr;
-		state->value = x86CPUReadMemory(cpu, addr, operand_size);
+		state->address = x86GetLinearAddress(cpu, instr->segment, addr);
+		state->value = x86CPUReadMemory(cpu, state->address, 4);
 		state->type = INSTRUCTION_RM_INDIRECT;
 	}
 	return 0;
 }
-int addressing_mode_32bit_disp(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t displacement_size, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
+int addressing_mode_32bit_disp(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
 	// [reg32 + disp8/32]
-	uint32_t reg = mode->rm;
-	uint32_t reg_v = x86CPUGetRegister(cpu, reg, 4);
-	uint32_t displacement = x86CPUFetchMemory(cpu, displacement_size, counter);
-	uint32_t addr = reg_v + displacement;
+	uint32_t reg_v = x86CPUGetRegister(cpu, instr->mode.bits.rm, 4);
+	uint32_t addr = reg_v + instr->disp;
 
 	if (state != NULL) {
-		state->address = addr;
-		state->value = x86CPUReadMemory(cpu, addr, operand_size);
+		state->address = x86GetLinearAddress(cpu, instr->segment, addr);
+		state->value = x86CPUReadMemory(cpu, state->address, operand_size);
 		state->type = INSTRUCTION_RM_INDIRECT;
 	}
 	return 0;
 }
-int addressing_mode_16bit(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
+int addressing_mode_16bit(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
 	// [reg16 + reg16]
 
-	uint32_t addr = get_16bit_indirect_address(cpu, mode);
+	uint32_t addr = get_16bit_indirect_address(cpu, &instr->mode.bits);
 
 	if (state != NULL) {
-		state->address = addr;
-		state->value = x86CPUReadMemory(cpu, addr, operand_size);
+		state->address = x86GetLinearAddress(cpu, instr->segment, addr);
+		state->value = x86CPUReadMemory(cpu, state->address, 4);
 		state->type = INSTRUCTION_RM_INDIRECT;
 	}
 	return 0;
 }
-int addressing_mode_16bit_disp(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t displacement_size, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
+int addressing_mode_16bit_disp(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
 	// [reg16 + reg16 + disp8/16]
-	uint32_t displacement = x86CPUFetchMemory(cpu, displacement_size, counter);
-	uint32_t addr = get_16bit_indirect_address(cpu, mode);
-	addr += displacement;
+	uint32_t addr = get_16bit_indirect_address(cpu, &instr->mode.bits);
+	addr += instr->disp;
 	
 	if (state != NULL) {
-		state->address = addr;
-		state->value = x86CPUReadMemory(cpu, addr, operand_size);
+		state->address = x86GetLinearAddress(cpu, instr->segment, addr);
+		state->value = x86CPUReadMemory(cpu, state->address, operand_size);
 		state->type = INSTRUCTION_RM_INDIRECT;
 	}
 	return 0;
 }
-int addressing_mode_sib_disp8(X86_CPU* cpu, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
+int addressing_mode_sib_disp(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
-	// SIB + disp8
+	// SIB + disp8/32
 
-	BYTE byte = x86CPUFetchByte(cpu, counter);
-	X86_SIB* sib = (X86_SIB*)&byte;
+	X86_SIB* sib = (X86_SIB*)&instr->sib;
 	uint32_t base = x86CPUGetRegister(cpu, sib->base, 4);
-	signed char displacement = (int8_t)x86CPUFetchByte(cpu, counter);
+	uint32_t addr;
 
 	if (sib->index == 0b100) {
-		// SIB + disp8 -> [ base + disp8 ]
-		uint32_t addr = base + displacement;
-		if (state != NULL) {
-			state->address = addr;
-			state->value = x86CPUReadMemory(cpu, addr, operand_size);
-			state->type = INSTRUCTION_RM_INDIRECT;
-		}
+		// SIB + disp8/32 -> [ base + disp8/32 ]
+		addr = base + instr->disp;
 	}
 	else {
-		// SIB + disp8 -> [ base + (index * n) + disp8 ]
+		// SIB + disp8/32 -> [ base + (index * n) + disp8/32 ]
 		uint32_t scale = get_sib_scale(sib->scale);
 		uint32_t index = x86CPUGetRegister(cpu, sib->index, 4);
-		uint32_t addr = base + (index * scale) + displacement;
-		if (state != NULL) {
-			state->address = addr;
-			state->value = x86CPUReadMemory(cpu, addr, operand_size);
-			state->type = INSTRUCTION_RM_INDIRECT;
-		}
+		addr = base + (index * scale) + instr->disp;
 	}
-	return 0;
-}
-int addressing_mode_sib_disp32(X86_CPU* cpu, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
-{
-	// SIB + disp32
 
-	BYTE byte = x86CPUFetchByte(cpu, counter);
-	X86_SIB* sib = (X86_SIB*)&byte;
-	uint32_t base = x86CPUGetRegister(cpu, sib->base, 4);
-	int displacement = (int)x86CPUFetchDword(cpu, counter);
-
-	if (sib->index == 0b100) {
-		// SIB + disp32 -> [ base + disp32 ]
-		uint32_t addr = base + displacement;
-		if (state != NULL) {
-			state->address = addr;
-			state->value = x86CPUReadMemory(cpu, addr, operand_size);
-			state->type = INSTRUCTION_RM_INDIRECT;
-		}
-	}
-	else {
-		// SIB + disp32 -> [ base + (index * n) + disp32 ]
-		uint32_t scale = get_sib_scale(sib->scale);
-		uint32_t index = x86CPUGetRegister(cpu, sib->index, 4);
-		uint32_t addr = base + (index * scale) + displacement;
-		if (state != NULL) {
-			state->address = addr;
-			state->value = x86CPUReadMemory(cpu, addr, operand_size);
-			state->type = INSTRUCTION_RM_INDIRECT;
-		}
+	if (state != NULL) {
+		state->address = x86GetLinearAddress(cpu, instr->segment, addr);
+		state->value = x86CPUReadMemory(cpu, state->address, operand_size);
+		state->type = INSTRUCTION_RM_INDIRECT;
 	}
 	return 0;
 }
-int addressing_mode_sib(X86_CPU* cpu, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
+int addressing_mode_sib(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
 {
 	// SIB mode
 
-	BYTE byte = x86CPUFetchByte(cpu, counter);
-	X86_SIB* sib = (X86_SIB*)&byte;
+	X86_SIB* sib = (X86_SIB*)&instr->sib;
 	BYTE scale = get_sib_scale(sib->scale);
 	uint32_t index = x86CPUGetRegister(cpu, sib->index, 4);
+	uint32_t addr;
 
 	if (sib->index == 0b100) {
 		if (sib->base == 0b101) {
 			// [ disp32 ]
-			DWORD disp32 = x86CPUFetchDword(cpu, counter);
-			uint32_t addr = disp32;
-
-			if (state != NULL) {
-				state->address = addr;
-				state->value = x86CPUReadMemory(cpu, addr, operand_size);
-				state->type = INSTRUCTION_RM_INDIRECT;
-			}
+			addr = instr->disp;
 		}
 		else {
 			// [ base ]
-			uint32_t base = x86CPUGetRegister(cpu, sib->base, 4);
-			uint32_t addr = base;
-
-			if (state != NULL) {
-				state->address = addr;
-				state->value = x86CPUReadMemory(cpu, addr, operand_size);
-				state->type = INSTRUCTION_RM_INDIRECT;
-			}
+			addr = x86CPUGetRegister(cpu, sib->base, 4);
 		}
 	}
 	else {
 		if (sib->base == 0b101) {
 			// [ (index * n) + disp32 ]
-			DWORD disp32 = x86CPUFetchDword(cpu, counter);
-			uint32_t addr = (index * scale) + disp32;
-
-			if (state != NULL) {
-				state->address = addr;
-				state->value = x86CPUReadMemory(cpu, addr, operand_size);
-				state->type = INSTRUCTION_RM_INDIRECT;
-			}
+			addr = (index * scale) + instr->disp;
 		}
 		else {
 			// [ base + (index * n) ]
 			uint32_t base = x86CPUGetRegister(cpu, sib->base, 4);
-			uint32_t addr = base + (index * scale);
-
-			if (state != NULL) {
-				state->address = addr;
-				state->value = x86CPUReadMemory(cpu, addr, operand_size);
-				state->type = INSTRUCTION_RM_INDIRECT;
-			}
+			addr = base + (index * scale);
 		}
 	}
 
+	if (state != NULL) {
+		state->address = x86GetLinearAddress(cpu, instr->segment, addr);
+		state->value = x86CPUReadMemory(cpu, state->address, operand_size);
+		state->type = INSTRUCTION_RM_INDIRECT;
+	}
 	return 0;
 }
 
-int get_addressing_mode(X86_CPU* cpu, X86_MOD_RM_BITS* mode, uint32_t address_size, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state, uint32_t* counter)
+int get_addressing_mode(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t operand_size, ADDRESSING_MODE_FIELD_STRUCT* state)
+{
+	// resolve the addressing mode picked at decode time.
+	return instr->addressing(cpu, instr, operand_size, state);
+}
+
+static BYTE default_segment(X86_INSTRUCTION* instr)
+{
+	// operands based on bp, ebp or esp are in ss; the rest are in ds.
+	X86_MOD_RM_BITS* mode = &instr->mode.bits;
+	X86_SIB* sib = (X86_SIB*)&instr->sib;
+
+	if (mode->mod == 0b11)
+		return SEG_DS;
+
+	if (instr->address_size == 2) {
+		if (mode->rm == 0b010 || mode->rm == 0b011 || (mode->rm == 0b110 && mode->mod != 0b00))
+			return SEG_SS;
+		return SEG_DS;
+	}
+
+	if (mode->rm == 0b100) {
+		if (sib->base == 0b100 || (sib->base == 0b101 && mode->mod != 0b00))
+			return SEG_SS;
+		return SEG_DS;
+	}
+	if (mode->rm == 0b101 && mode->mod != 0b00)
+		return SEG_SS;
+	return SEG_DS;
+}
+
+int decode_addressing_mode(X86_CPU* cpu, X86_INSTRUCTION* instr, uint32_t* counter)
 {
-	// figure out the addressing mode.
+	// figure out the addressing mode; fetch the sib byte and displacement.
+
+	X86_MOD_RM_BITS* mode = &instr->mode.bits;
+	X86_SIB* sib = (X86_SIB*)&instr->sib;
 
 	switch (mode->mod) {
 
 		case 0b00: {
-			if (address_size == 4) {
+			if (instr->address_size == 4) {
 				if (mode->rm == 0b100) {
 					// [ SIB ]
-					addressing_mode_sib(cpu, operand_size, state, counter);
+					instr->sib = x86CPUFetchByte(cpu, counter);
+					if (sib->base == 0b101) {
+						instr->disp = x86CPUFetchDword(cpu, counter);
+					}
+					instr->addressing = addressing_mode_sib;
 				}
 				else if (mode->rm == 0b101) {
 					// [ disp32 ]
-					addressing_mode_disp(cpu, 4, state, counter);
+					instr->disp = x86CPUFetchDword(cpu, counter);
+					instr->addressing = addressing_mode_disp32;
 				}
 				else {
 					// [ reg32 ]
-					addressing_mode_32bit(cpu, mode, 4, state);
+					instr->addressing = addressing_mode_32bit;
 				}
 			}
 			else {
 				if (mode->rm == 0b110) {
 					// [ disp16 ]
-					addressing_mode_disp(cpu, 2, state, counter);
+					instr->disp = x86CPUFetchWord(cpu, counter);
+					instr->addressing = addressing_mode_disp16;
 				}
 				else {
 					// [ reg16 + reg16 ]
-					addressing_mode_16bit(cpu, mode, 4, state);
+					instr->addressing = addressing_mode_16bit;
 				}
 			}
 		} break;
 
 		case 0b01: {
-			if (address_size == 4) {
+			if (instr->address_size == 4) {
 				if (mode->rm == 0b100) {
 					// [ SIB + disp8 ]
-					addressing_mode_sib_disp8(cpu, operand_size, state, counter);
+					instr->sib = x86CPUFetchByte(cpu, counter);
+					instr->disp = (int8_t)x86CPUFetchByte(cpu, counter);
+					instr->addressing = addressing_mode_sib_disp;
 				}
 				else {
 					// [ reg32 + disp8 ]
-					addressing_mode_32bit_disp(cpu, mode, 1, operand_size, state, counter);
+					instr->disp = x86CPUFetchByte(cpu, counter);
+					instr->addressing = addressing_mode_32bit_disp;
 				}
 			}
 			else {
 				// [ reg16 + reg16 + disp8 ]
-				addressing_mode_16bit_disp(cpu, mode, 1, operand_size, state, counter);
+				instr->disp = x86CPUFetchByte(cpu, counter);
+				instr->addressing = addressing_mode_16bit_disp;
 			}
 		} break;
 
 		case 0b10: {
-			if (address_size == 4) {
+			if (instr->address_size == 4) {
 				if (mode->rm == 0b100) {
 					// [ SIB + disp32 ]
-					addressing_mode_sib_disp32(cpu, operand_size, state, counter);
+					instr->sib = x86CPUFetchByte(cpu, counter);
+					instr->disp = x86CPUFetchDword(cpu, counter);
+					instr->addressing = addressing_mode_sib_disp;
 				}
 				else {
 					// [ reg32 + disp32 ]
-					addressing_mode_32bit_disp(cpu, mode, 4, operand_size, state, counter);
+					instr->disp = x86CPUFetchDword(cpu, counter);
+					instr->addressing = addressing_mode_32bit_disp;
 				}
 			}
 			else {
 				// [ reg16 + reg16 + disp16 ]
-				addressing_mode_16bit_disp(cpu, mode, 2, operand_size, state, counter);
+				instr->disp = x86CPUFetchWord(cpu, counter);
+				instr->addressing = addressing_mode_16bit_disp;
 			}
 		} break;
 
 		case 0b11: {
 			// reg
-			addressing_mode_reg(cpu, mode, operand_size, state);
+			instr->addressing = addressing_mode_reg;
 		} break;
 	}
+
+	// a segment override prefix replaces this after the decode.
+	instr->segment = default_segment(instr);
 	return 0;
 }
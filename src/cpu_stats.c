@@ -0,0 +1,206 @@
+// cpu_stats.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "cpu.h"
+#include "cpu_stats.h"
+#include "cpu_cache.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Opcode histogram
+
+	Decode stores the histogram index of the instruction, built from its opcode
+	map, opcode byte and, for group opcodes, the mod r/m reg field. Counting an
+	interpreted instruction is then one increment. A translated block only
+	counts its runs; they are added to its instructions when the block is
+	rebuilt and by x86StatsCollect.
+
+	Cycle sampling reads the host timestamp counter before and after each
+	interpreted handler. It is off by default and costs two reads per
+	instruction when on. */
+
+typedef struct _STATS_ENTRY {
+	uint64_t count;
+	uint32_t index;
+} STATS_ENTRY;
+
+static int is_group(uint32_t map, uint8_t opcode)
+{
+	// opcodes whose mod r/m reg field selects the operation.
+	if (map == X86_STATS_MAP_0F)
+		return opcode == 0x00 || opcode == 0x01 || opcode == 0xBA || opcode == 0xC7;
+	if (map != X86_STATS_MAP_ONE_BYTE)
+		return 0;
+	return (opcode >= 0x80 && opcode <= 0x83) || opcode == 0x8F || opcode == 0xC0 || opcode == 0xC1 ||
+		opcode == 0xC6 || opcode == 0xC7 || (opcode >= 0xD0 && opcode <= 0xD3) || opcode == 0xF6 ||
+		opcode == 0xF7 || opcode == 0xFE || opcode == 0xFF;
+}
+static int compare_entries(const void* a, const void* b)
+{
+	uint64_t count_a = ((const STATS_ENTRY*)a)->count;
+	uint64_t count_b = ((const STATS_ENTRY*)b)->count;
+	return count_a < count_b ? 1 : (count_a > count_b ? -1 : 0);
+}
+
+int x86InitStats(X86_CPU* cpu)
+{
+	X86_STATS* stats = &cpu->stats;
+
+	stats->count = (uint64_t*)malloc(X86_STATS_SIZE * sizeof(uint64_t));
+	stats->cycles = (uint64_t*)malloc(X86_STATS_SIZE * sizeof(uint64_t));
+	stats->samples = (uint64_t*)malloc(X86_STATS_SIZE * sizeof(uint64_t));
+	if (stats->count == NULL || stats->cycles == NULL || stats->samples == NULL)
+		return 1;
+
+	stats->sample_cycles = 0;
+	x86StatsReset(cpu);
+	return 0;
+}
+void x86FreeStats(X86_CPU* cpu)
+{
+	X86_STATS* stats = &cpu->stats;
+	if (stats->count != NULL) {
+		free(stats->count);
+		stats->count = NULL;
+	}
+	if (stats->cycles != NULL) {
+		free(stats->cycles);
+		stats->cycles = NULL;
+	}
+	if (stats->samples != NULL) {
+		free(stats->samples);
+		stats->samples = NULL;
+	}
+}
+
+void x86StatsReset(X86_CPU* cpu)
+{
+	X86_STATS* stats = &cpu->stats;
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	uint32_t i;
+
+	memset(stats->count, 0, X86_STATS_SIZE * sizeof(uint64_t));
+	memset(stats->cycles, 0, X86_STATS_SIZE * sizeof(uint64_t));
+	memset(stats->samples, 0, X86_STATS_SIZE * sizeof(uint64_t));
+
+	if (cache->blocks != NULL) {
+		for (i = 0; i < X86_BLOCK_CACHE_SIZE; ++i) {
+			cache->blocks[i].runs = 0;
+		}
+	}
+}
+void x86StatsSampleCycles(X86_CPU* cpu, int enable)
+{
+	cpu->stats.sample_cycles = enable;
+}
+
+uint16_t x86StatsGetIndex(X86_INSTRUCTION* instr)
+{
+	uint32_t map = X86_STATS_MAP_ONE_BYTE;
+	uint32_t reg = 0;
+
+	// the same order x86CPUDecode picks the decode table in.
+	if (instr->prefix.byte_0f)
+		map = X86_STATS_MAP_0F;
+	else if (instr->prefix.byte_f3)
+		map = X86_STATS_MAP_F3;
+	else if (instr->prefix.byte_f2)
+		map = X86_STATS_MAP_F2;
+
+	if (is_group(map, instr->opcode.byte))
+		reg = instr->mode.bits.reg;
+
+	return (uint16_t)X86_STATS_INDEX(map, instr->opcode.byte, reg);
+}
+
+void x86StatsAddBlock(X86_CPU* cpu, X86_BLOCK* block)
+{
+	uint32_t i;
+	if (block->runs == 0)
+		return;
+	for (i = 0; i < block->count; ++i) {
+		cpu->stats.count[block->instr[i].stats] += block->runs;
+	}
+	block->runs = 0;
+}
+void x86StatsCollect(X86_CPU* cpu)
+{
+	X86_DECODE_CACHE* cache = &cpu->decode_cache;
+	uint32_t i;
+
+	if (cache->blocks == NULL)
+		return;
+
+	for (i = 0; i < X86_BLOCK_CACHE_SIZE; ++i) {
+		x86StatsAddBlock(cpu, &cache->blocks[i]);
+	}
+}
+
+uint64_t x86StatsReadTsc()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+void x86StatsDump(X86_CPU* cpu, uint32_t max_entries)
+{
+	X86_STATS* stats = &cpu->stats;
+	STATS_ENTRY* entries;
+	uint64_t total = 0;
+	uint32_t count = 0;
+	uint32_t i;
+
+	x86StatsCollect(cpu);
+
+	entries = (STATS_ENTRY*)malloc(X86_STATS_SIZE * sizeof(STATS_ENTRY));
+	if (entries == NULL)
+		return;
+
+	for (i = 0; i < X86_STATS_SIZE; ++i) {
+		if (stats->count[i] == 0)
+			continue;
+		entries[count].count = stats->count[i];
+		entries[count].index = i;
+		total += stats->count[i];
+		count += 1;
+	}
+	qsort(entries, count, sizeof(STATS_ENTRY), compare_entries);
+
+	printf("\n\t%llu instructions, %u opcodes\n", (unsigned long long)total, count);
+	for (i = 0; i < count && i < max_entries; ++i) {
+		static const char* maps[] = { "", "0F ", "F3 ", "F2 " };
+		uint32_t index = entries[i].index;
+		uint32_t map = index >> 11;
+		uint32_t opcode = (index >> 3) & 0xFF;
+		char name[16];
+
+		if (is_group(map, (uint8_t)opcode))
+			sprintf(name, "%s%02X /%u", maps[map], opcode, index & 7);
+		else
+			sprintf(name, "%s%02X", maps[map], opcode);
+
+		printf("\t%-10s %12llu %6.2f%%", name, (unsigned long long)entries[i].count, entries[i].count * 100.0 / total);
+		if (stats->samples[index] != 0)
+			printf(" %8.1f cycles", (double)stats->cycles[index] / stats->samples[index]);
+		printf("\n");
+	}
+
+	free(entries);
+}
@@ -0,0 +1,83 @@
+// cpu_tlb.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "cpu_tlb.h"
+#include "cpu_bus.h"
+#include "cpu_cache.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Software TLB
+
+	Direct mapped tables of 4KB linear pages to host memory, one each for reads,
+	writes and instruction fetches. A hit is a shift, a compare and an add. The
+	tables sit after segmentation, so segment loads do not touch them; a change
+	of CR0 or CR3 flushes them for when paging is added. A page goes in when the
+	bus maps it to host memory with the attribute the access needs; mmio, rom
+	writes and unmapped space miss every time and go to the bus. The write table
+	never holds a page with decoded code, so writes that need
+	x86CPUInvalidateCode always miss.
+
+	In front of the fetch table is the fetch window, the one page eip is on
+	kept as a range of cs offsets. Instruction bytes inside it are a compare
+	and a load; it is refilled from the fetch table when eip leaves it and is
+	emptied with the tables and when cs or the cpu mode changes. */
+
+static X86_TLB_ENTRY* get_table(X86_CPU* cpu, X86_TLB_ACCESS access)
+{
+	switch (access) {
+		case X86_TLB_WRITE:
+			return cpu->tlb.write;
+		case X86_TLB_FETCH:
+			return cpu->tlb.fetch;
+		case X86_TLB_READ:
+		default:
+			return cpu->tlb.read;
+	}
+}
+
+void x86TlbFlush(X86_CPU* cpu)
+{
+	int i;
+	for (i = 0; i < X86_TLB_SIZE; ++i) {
+		cpu->tlb.read[i].tag = X86_TLB_INVALID;
+		cpu->tlb.write[i].tag = X86_TLB_INVALID;
+		cpu->tlb.fetch[i].tag = X86_TLB_INVALID;
+	}
+	cpu->fetch_window.size = 0;
+}
+void x86TlbFlushPage(X86_CPU* cpu, uint32_t address)
+{
+	uint32_t index = X86_TLB_INDEX(address);
+	uint32_t tag = X86_TLB_TAG(address);
+
+	if (cpu->tlb.read[index].tag == tag)
+		cpu->tlb.read[index].tag = X86_TLB_INVALID;
+	if (cpu->tlb.write[index].tag == tag)
+		cpu->tlb.write[index].tag = X86_TLB_INVALID;
+	if (cpu->tlb.fetch[index].tag == tag)
+		cpu->tlb.fetch[index].tag = X86_TLB_INVALID;
+}
+void* x86TlbFill(X86_CPU* cpu, uint32_t address, X86_TLB_ACCESS access)
+{
+	static const uint32_t attributes[] = { X86_BUS_READ, X86_BUS_WRITE, X86_BUS_EXECUTE };
+	X86_TLB_ENTRY* entry = &get_table(cpu, access)[X86_TLB_INDEX(address)];
+	uint32_t page = X86_TLB_TAG(address);
+	BYTE* host = x86BusGetHostPage(cpu, address, attributes[access]);
+
+	if (host == NULL)
+		return NULL;
+
+	if (access != X86_TLB_WRITE || !x86CPUIsCodePage(cpu, address)) {
+		entry->tag = page;
+		entry->addend = (uintptr_t)host - page;
+	}
+
+	return host + (address - page);
+}
@@ -0,0 +1,265 @@
+// cpu_trace.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include "cpu.h"
+#include "cpu_trace.h"
+#include "cpu_memory.h"
+
+#include "type_defs.h"
+#include "mem_tracking.h"
+
+/* Execution trace
+
+	Each instruction x86CPUExecute runs fills one fixed size record in a ring:
+	the linear address, the instruction bytes, the registers and eflags after
+	it and its first memory write. The cpu thread only ever moves head and a
+	writer thread only ever moves tail, so neither takes a lock; a record is
+	published by the release store of head and given back by the release store
+	of tail.
+
+	The writer thread fills in which registers changed, against the record
+	before, and writes the records to the file in runs of up to the end of the
+	ring. Nothing is disassembled while the cpu runs; the file is turned into
+	text afterwards. */
+
+#define TRACE_RING_SIZE 0x10000 // records; about 4MB
+#define TRACE_WRITE_MAX 0x1000 // records per fwrite
+
+#ifdef _WIN32
+// msvc gives volatile accesses acquire and release semantics on x86 (/volatile:ms).
+#define LOAD_ACQUIRE(p) (*(volatile uint32_t*)(p))
+#define STORE_RELEASE(p, v) (*(volatile uint32_t*)(p) = (v))
+#else
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+static void trace_wait(int sleep)
+{
+	// the cpu yields while the ring is full; the writer sleeps while it is empty.
+#ifdef _WIN32
+	Sleep(sleep ? 1 : 0);
+#else
+	if (sleep) {
+		struct timespec time = { 0, 1000000 };
+		nanosleep(&time, NULL);
+	}
+	else {
+		sched_yield();
+	}
+#endif
+}
+
+static void mark_changes(X86_TRACE_RECORD* last, X86_TRACE_RECORD* records, uint32_t count)
+{
+	uint32_t i;
+	uint32_t j;
+	for (i = 0; i < count; ++i) {
+		X86_TRACE_RECORD* record = &records[i];
+		record->changed = 0;
+		record->flags = 0;
+		for (j = 0; j < X86_GENERAL_REGISTER_COUNT; ++j) {
+			if (record->registers[j] != last->registers[j])
+				record->changed |= (1 << j);
+		}
+		if (record->eflags != last->eflags)
+			record->flags |= X86_TRACE_EFLAGS_CHANGED;
+		last = record;
+	}
+}
+static void drain(X86_TRACE* trace, X86_TRACE_RECORD* last)
+{
+	uint32_t tail = trace->tail;
+	uint32_t head = LOAD_ACQUIRE(&trace->head);
+
+	while (tail != head) {
+		uint32_t index = tail & (trace->capacity - 1);
+		uint32_t count = head - tail;
+		if (count > trace->capacity - index)
+			count = trace->capacity - index;
+		if (count > TRACE_WRITE_MAX)
+			count = TRACE_WRITE_MAX;
+
+		mark_changes(last, &trace->ring[index], count);
+		*last = trace->ring[index + count - 1];
+
+		if (!trace->error && fwrite(&trace->ring[index], sizeof(X86_TRACE_RECORD), count, (FILE*)trace->file) != count)
+			trace->error = 1;
+
+		tail += count;
+		STORE_RELEASE(&trace->tail, tail);
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI writer_thread(LPVOID param)
+#else
+static void* writer_thread(void* param)
+#endif
+{
+	X86_TRACE* trace = (X86_TRACE*)param;
+	X86_TRACE_RECORD last;
+
+	// the first record shows every register as changed.
+	memset(&last, 0, sizeof(X86_TRACE_RECORD));
+	memset(last.registers, 0xFF, sizeof(last.registers));
+	last.eflags = 0xFFFFFFFF;
+
+	while (LOAD_ACQUIRE(&trace->stop) == 0) {
+		if (LOAD_ACQUIRE(&trace->head) == trace->tail) {
+			trace_wait(1);
+			continue;
+		}
+		drain(trace, &last);
+	}
+
+	// stop is set after the last record is published.
+	drain(trace, &last);
+	return 0;
+}
+
+int x86TraceStart(X86_CPU* cpu, const char* filename)
+{
+	X86_TRACE* trace = &cpu->trace;
+	X86_TRACE_HEADER header;
+	FILE* file;
+
+	x86TraceStop(cpu);
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		return 1;
+
+	header.magic = X86_TRACE_MAGIC;
+	header.version = X86_TRACE_VERSION;
+	header.record_size = sizeof(X86_TRACE_RECORD);
+	if (fwrite(&header, sizeof(X86_TRACE_HEADER), 1, file) != 1) {
+		fclose(file);
+		return 1;
+	}
+
+	trace->ring = (X86_TRACE_RECORD*)malloc(TRACE_RING_SIZE * sizeof(X86_TRACE_RECORD));
+	if (trace->ring == NULL) {
+		fclose(file);
+		return 1;
+	}
+
+	trace->capacity = TRACE_RING_SIZE;
+	trace->head = 0;
+	trace->tail = 0;
+	trace->cached_tail = 0;
+	trace->record = NULL;
+	trace->file = file;
+	trace->stop = 0;
+	trace->error = 0;
+
+#ifdef _WIN32
+	HANDLE thread = CreateThread(NULL, 0, writer_thread, trace, 0, NULL);
+	if (thread == NULL) {
+#else
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, writer_thread, trace) != 0) {
+#endif
+		free(trace->ring);
+		trace->ring = NULL;
+		fclose(file);
+		return 1;
+	}
+
+	trace->thread = (uintptr_t)thread;
+	trace->active = 1;
+	return 0;
+}
+int x86TraceStop(X86_CPU* cpu)
+{
+	X86_TRACE* trace = &cpu->trace;
+	int error;
+
+	if (!trace->active)
+		return 0;
+
+	STORE_RELEASE(&trace->stop, 1);
+#ifdef _WIN32
+	WaitForSingleObject((HANDLE)trace->thread, INFINITE);
+	CloseHandle((HANDLE)trace->thread);
+#else
+	pthread_join((pthread_t)trace->thread, NULL);
+#endif
+
+	error = trace->error;
+	if (fclose((FILE*)trace->file) != 0)
+		error = 1;
+
+	free(trace->ring);
+	memset(trace, 0, sizeof(X86_TRACE));
+	return error;
+}
+
+void x86TraceBegin(X86_CPU* cpu, X86_INSTRUCTION* instr)
+{
+	X86_TRACE* trace = &cpu->trace;
+	X86_TRACE_RECORD* record;
+	uint32_t counter = 0;
+	uint32_t i;
+
+	// a full trace drops nothing; wait for the writer to give back a record.
+	while (trace->head - trace->cached_tail == trace->capacity) {
+		trace->cached_tail = LOAD_ACQUIRE(&trace->tail);
+		if (trace->head - trace->cached_tail == trace->capacity)
+			trace_wait(0);
+	}
+
+	record = &trace->ring[trace->head & (trace->capacity - 1)];
+	record->address = x86GetEffectiveAddress(cpu, cpu->eip);
+	record->length = (uint8_t)instr->length;
+	record->key = cpu->code_key;
+	record->write_size = 0;
+	record->write_address = 0;
+	record->write_value = 0;
+	memset(record->bytes, 0, X86_TRACE_MAX_BYTES);
+	for (i = 0; i < instr->length && i < X86_TRACE_MAX_BYTES; ++i) {
+		record->bytes[i] = x86CPUFetchByte(cpu, &counter);
+	}
+
+	trace->record = record;
+}
+void x86TraceEnd(X86_CPU* cpu, int executed)
+{
+	X86_TRACE* trace = &cpu->trace;
+	X86_TRACE_RECORD* record = trace->record;
+	uint32_t i;
+
+	trace->record = NULL;
+	if (!executed)
+		return;
+
+	for (i = 0; i < X86_GENERAL_REGISTER_COUNT; ++i) {
+		record->registers[i] = cpu->registers[i].r32;
+	}
+	memcpy(&record->eflags, x86CPUGetEflags(cpu), sizeof(uint32_t));
+
+	STORE_RELEASE(&trace->head, trace->head + 1);
+}
+void x86TraceWrite(X86_CPU* cpu, uint32_t address, uint32_t size, uint32_t value)
+{
+	X86_TRACE_RECORD* record = cpu->trace.record;
+	if (record == NULL || record->write_size != 0)
+		return;
+	record->write_address = address;
+	record->write_value = value;
+	record->write_size = (uint8_t)size;
+}
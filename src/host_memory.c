@@ -0,0 +1,191 @@
+// host_memory.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // memfd_create
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment(lib, "onecore.lib") // VirtualAlloc2, MapViewOfFile3
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#endif
+
+#include "host_memory.h"
+
+void* hostAllocMemory(uint32_t size)
+{
+#ifdef _WIN32
+	return VirtualAlloc(NULL, (SIZE_T)size + HOST_MEMORY_TAIL, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* ptr = mmap(NULL, (size_t)size + HOST_MEMORY_TAIL, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (ptr == MAP_FAILED) ? NULL : ptr;
+#endif
+}
+void hostFreeMemory(void* ptr, uint32_t size)
+{
+#ifdef _WIN32
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, (size_t)size + HOST_MEMORY_TAIL);
+#endif
+}
+void hostDiscardMemory(void* ptr, uint32_t size)
+{
+	// the tail is discarded too; a write that straddles the end of guest memory lands in it.
+	size_t length = (size_t)size + HOST_MEMORY_TAIL;
+#ifdef _WIN32
+	VirtualFree(ptr, length, MEM_DECOMMIT);
+	VirtualAlloc(ptr, length, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+	madvise(ptr, length, MADV_DONTNEED); // private anonymous pages read as zero after this
+#else
+	mmap(ptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+}
+
+#ifdef _WIN32
+
+static void restore_memory(uint8_t* ptr, HANDLE mapping, uint32_t image_size, uint32_t size)
+{
+	// put a plain allocation back at ptr, holding the image again.
+	void* view;
+	VirtualAlloc(ptr, (SIZE_T)size + HOST_MEMORY_TAIL, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, image_size);
+	if (view != NULL) {
+		memcpy(ptr, view, image_size);
+		UnmapViewOfFile(view);
+	}
+}
+int hostMapMirrors(void* ptr, uint32_t image_size, uint32_t size, intptr_t* section)
+{
+	MEMORY_BASIC_INFORMATION region;
+	SYSTEM_INFO info;
+	HANDLE mapping;
+	uint8_t* base = (uint8_t*)ptr;
+	void* view;
+	uint32_t offset;
+
+	GetSystemInfo(&info);
+	if (image_size % info.dwAllocationGranularity != 0)
+		return 1; // views must start on the allocation granularity.
+
+	// views can only replace a placeholder; ptr must be an allocation of its own so it can be released and reserved again as one.
+	if (VirtualQuery(base, &region, sizeof(region)) == 0 || region.AllocationBase != base)
+		return 1;
+
+	mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, image_size, NULL);
+	if (mapping == NULL)
+		return 1;
+
+	view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, image_size);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		return 1;
+	}
+	memcpy(view, base, image_size);
+	UnmapViewOfFile(view);
+
+	// swap the allocation for a placeholder over the window and the tail, split it into image sized placeholders and map a view into each.
+	VirtualFree(base, 0, MEM_RELEASE);
+	if (VirtualAlloc2(NULL, base, (SIZE_T)size + info.dwAllocationGranularity, MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0) == NULL) {
+		restore_memory(base, mapping, image_size, size);
+		CloseHandle(mapping);
+		return 1;
+	}
+	for (offset = 0; offset < size; offset += image_size) {
+		VirtualFree(base + offset, image_size, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER);
+	}
+	VirtualAlloc2(NULL, base + size, info.dwAllocationGranularity, MEM_RESERVE | MEM_COMMIT | MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+	for (offset = 0; offset < size; offset += image_size) {
+		ULONG protect = (offset == size - image_size) ? PAGE_WRITECOPY : PAGE_READWRITE;
+		if (MapViewOfFile3(mapping, NULL, base + offset, 0, image_size, MEM_REPLACE_PLACEHOLDER, protect, NULL, 0) == NULL) {
+			// unmap the views made so far, release the placeholders left and put the image back.
+			uint32_t mapped = offset;
+			for (offset = 0; offset < mapped; offset += image_size) {
+				UnmapViewOfFile(base + offset);
+			}
+			for (offset = mapped; offset < size; offset += image_size) {
+				VirtualFree(base + offset, 0, MEM_RELEASE);
+			}
+			VirtualFree(base + size, 0, MEM_RELEASE);
+			restore_memory(base, mapping, image_size, size);
+			CloseHandle(mapping);
+			return 1;
+		}
+	}
+
+	*section = (intptr_t)mapping;
+	return 0;
+}
+void hostUnmapMirrors(void* ptr, uint32_t image_size, uint32_t size, intptr_t section)
+{
+	uint8_t* base = (uint8_t*)ptr;
+	uint32_t offset;
+	for (offset = 0; offset < size; offset += image_size) {
+		UnmapViewOfFile(base + offset);
+	}
+	VirtualFree(base + size, 0, MEM_RELEASE);
+	VirtualAlloc(base, (SIZE_T)size + HOST_MEMORY_TAIL, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	CloseHandle((HANDLE)section);
+}
+
+#else
+
+int hostMapMirrors(void* ptr, uint32_t image_size, uint32_t size, intptr_t* section)
+{
+	uint8_t* base = (uint8_t*)ptr;
+	uint32_t offset;
+	int fd;
+
+	if (image_size % (uint32_t)sysconf(_SC_PAGESIZE) != 0)
+		return 1;
+
+#ifdef __linux__
+	fd = memfd_create("x86rom", MFD_CLOEXEC);
+#else
+	char name[32];
+	snprintf(name, sizeof(name), "/x86rom.%d", (int)getpid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd != -1)
+		shm_unlink(name);
+#endif
+	if (fd == -1)
+		return 1;
+
+	if (ftruncate(fd, image_size) != 0 || pwrite(fd, base, image_size, 0) != (ssize_t)image_size) {
+		close(fd);
+		return 1;
+	}
+
+	// map the section over each image sized slot, top down; the bottom slot still holds the image until it is mapped last.
+	for (offset = size; offset != 0; offset -= image_size) {
+		int flags = (offset == size) ? MAP_PRIVATE : MAP_SHARED;
+		if (mmap(base + offset - image_size, image_size, PROT_READ | PROT_WRITE, flags | MAP_FIXED, fd, 0) == MAP_FAILED) {
+			// put zero pages back over the views mapped so far.
+			if (offset != size)
+				mmap(base + offset, size - offset, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+			close(fd);
+			return 1;
+		}
+	}
+
+	*section = fd;
+	return 0;
+}
+void hostUnmapMirrors(void* ptr, uint32_t image_size, uint32_t size, intptr_t section)
+{
+	mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	close((int)section);
+}
+
+#endif
@@ -0,0 +1,157 @@
+// host_perf.c
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "host_perf.h"
+
+/* Host performance counters
+
+	Each counter is opened on its own rather than as a group, so a counter
+	the host cpu or the kernel does not offer leaves out only itself. When
+	there are more counters than the cpu has registers the kernel takes turns
+	with them; the time a counter was enabled and running is read with it and
+	the count is scaled up to the whole time.
+
+	Only user mode is counted, so the counters open with the default
+	perf_event_paranoid setting. */
+
+static const char* counter_names[HOST_PERF_COUNTER_COUNT] = {
+	"cycles",
+	"instructions",
+	"branch misses",
+	"L1D misses",
+	"LLC misses",
+	"dTLB misses",
+};
+
+#ifdef __linux__
+static int open_counter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	// this thread, any cpu.
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+static uint64_t cache_miss(uint64_t cache)
+{
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
+int hostPerfOpen(HOST_PERF* perf)
+{
+	int i;
+
+	for (i = 0; i < HOST_PERF_COUNTER_COUNT; ++i) {
+		perf->fd[i] = -1;
+		perf->value[i] = 0;
+	}
+	perf->open = 0;
+
+#ifdef __linux__
+	perf->fd[HOST_PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	perf->fd[HOST_PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	perf->fd[HOST_PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	perf->fd[HOST_PERF_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+	perf->fd[HOST_PERF_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	perf->fd[HOST_PERF_DTLB_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+
+	for (i = 0; i < HOST_PERF_COUNTER_COUNT; ++i) {
+		if (perf->fd[i] >= 0)
+			perf->open = 1;
+	}
+#endif
+
+	return !perf->open;
+}
+void hostPerfClose(HOST_PERF* perf)
+{
+	int i;
+
+	if (!perf->open)
+		return;
+
+	for (i = 0; i < HOST_PERF_COUNTER_COUNT; ++i) {
+#ifdef __linux__
+		if (perf->fd[i] >= 0)
+			close(perf->fd[i]);
+#endif
+		perf->fd[i] = -1;
+	}
+	perf->open = 0;
+}
+
+void hostPerfStart(HOST_PERF* perf)
+{
+#ifdef __linux__
+	int i;
+	for (i = 0; i < HOST_PERF_COUNTER_COUNT; ++i) {
+		if (perf->fd[i] < 0)
+			continue;
+		ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+void hostPerfStop(HOST_PERF* perf)
+{
+	int i;
+
+	for (i = 0; i < HOST_PERF_COUNTER_COUNT; ++i) {
+		perf->value[i] = 0;
+#ifdef __linux__
+		if (perf->fd[i] >= 0) {
+			uint64_t data[3]; // value, time enabled, time running
+
+			ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(perf->fd[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+				continue;
+			perf->value[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+		}
+#endif
+	}
+}
+
+void hostPerfPrint(HOST_PERF* perf, uint64_t guest_instructions)
+{
+	int i;
+
+	if (!perf->open)
+		return;
+
+	printf("\n\thost counters over %llu guest instructions\n", (unsigned long long)guest_instructions);
+	for (i = 0; i < HOST_PERF_COUNTER_COUNT; ++i) {
+		if (perf->fd[i] < 0) {
+			printf("\t%-14s %16s\n", counter_names[i], "not available");
+			continue;
+		}
+		printf("\t%-14s %16llu", counter_names[i], (unsigned long long)perf->value[i]);
+		if (guest_instructions != 0)
+			printf(" %10.3f per instruction", (double)perf->value[i] / guest_instructions);
+		printf("\n");
+	}
+
+	if (perf->fd[HOST_PERF_CYCLES] >= 0 && perf->fd[HOST_PERF_INSTRUCTIONS] >= 0 && perf->value[HOST_PERF_CYCLES] != 0)
+		printf("\t%-14s %16.2f\n", "IPC", (double)perf->value[HOST_PERF_INSTRUCTIONS] / perf->value[HOST_PERF_CYCLES]);
+}
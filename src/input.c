@@ -15,13 +15,12 @@
 
 #include "cpu.h"
 #include "cpu_memory.h"
+#include "cpu_cache.h"
 
 #ifdef CPU_INPUT
 extern X86_CPU cpu;
-extern BREAKPOINT* cpu_breakpoint;
-extern uint32_t cpu_breakpoint_index;
-extern uint32_t cpu_breakpoint_count;
 int kb_frames = 0;
+int quit = 0; // '.' pressed
 #endif
 
 #ifdef CPU_INPUT
@@ -83,6 +82,7 @@ int input()
 
 		case '.':
 			cpu.hlt = 1;
+			quit = 1;
 			break;
 
 		case 'z': case 'Z':
@@ -136,8 +136,7 @@ int input()
 			if (rel)
 				address += cpu.eip;
 
-			void* ptr = x86GetCPUMemoryPtr(&cpu, address);
-			*(char*)ptr = (char)value;
+			x86CPUWriteByte(&cpu, x86GetEffectiveAddress(&cpu, address), (BYTE)value);
 
 			printf("\t%08x: ", cpu.eip);
 		} break;
@@ -159,11 +158,10 @@ int input()
 			if (rel)
 				address += cpu.eip;
 
-			cpu_breakpoint[cpu_breakpoint_index].set = true;
-			cpu_breakpoint[cpu_breakpoint_index].address = address;
-			printf("Breakpoint ON %08x\n", cpu_breakpoint[cpu_breakpoint_index].address);
-			cpu_breakpoint_index++;
-
+			if (x86CPUAddBreakpoint(&cpu, address, true) < 0)
+				printf("Breakpoint table full\n");
+			else
+				printf("Breakpoint ON %08x\n", address);
 
 			printf("\t%08x: ", cpu.eip);
 		} break;
@@ -179,21 +177,10 @@ int input_loop()
 	do {
 		if (input() != 0)
 			break;
-
-		if (cpu.eflags.TF == 0) {
-			for (uint32_t i = 0; i < cpu_breakpoint_index; ++i) {
-				if (cpu_breakpoint[i].set) {
-					uint32_t address = x86GetEffectiveAddress(&cpu, cpu.eip);
-					if (cpu_breakpoint[i].address == address) {
-						cpu.eflags.TF = 1;
-						printf("Breakpoint hit\n\t%08x: ", address);
-					}
-				}
-			}
-		}
 	} while (cpu.eflags.TF == 1 && cpu.hlt == 0);
 
-	return cpu.hlt;
+	// a halted cpu is not the end of the run; an event can still wake it.
+	return quit;
 #else
 	return 0;
 #endif
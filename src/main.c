@@ -10,46 +10,53 @@
 #include "cpu.h"
 #include "cpu_instruction.h"
 #include "cpu_memory.h"
+#include "cpu_bus.h"
+#include "cpu_io.h"
+#include "cpu_pci.h"
+#include "cpu_event.h"
+#include "cpu_trace.h"
+#include "cpu_stats.h"
+#include "cpu_profile.h"
+#include "cpu_callstack.h"
 #include "cpu_mnemonics.h"
+#include "host_perf.h"
 #include "input.h"
 
 #include "type_defs.h"
 #include "mem_tracking.h"
 #include "file.h"
 
+#define CPU_RUN_BATCH 0x1000 // instructions executed between input polls when free running
+#define STATS_DUMP_ENTRIES 40 // opcodes listed at exit
+#define PROFILE_PERIOD 0x100 // instructions between profile samples
+#define PROFILE_REPORT_ENTRIES 40 // lines in each section of the profile
+#define CALL_STACK_DUMP_ENTRIES 20 // call paths listed at exit
+
 X86_CPU cpu;
-BREAKPOINT* cpu_breakpoint = NULL;
-uint32_t cpu_breakpoint_index = 0;
-uint32_t cpu_breakpoint_count = 0;
+X86_PCI pci;
+HOST_PERF perf; // -perf
+const char* io_trace_file = NULL; // -record <file>
+const char* profile_file = NULL; // -profile <file>
+const char* call_stack_file = NULL; // -callstack <file>
 
 void load_rom(const uint32_t ROM_BASE, const uint32_t ROM_END);
-int replicate_buffer(uint32_t from, uint32_t to, uint8_t* buffer, uint32_t buffersize);
+void load_devices();
+void add_pci_mmio(uint8_t bus, uint8_t device, uint16_t device_id, uint32_t class_code, uint32_t bar, uint32_t size, uint32_t address);
+uint32_t io_status_read(void* device, uint16_t port);
+int start_io_trace(int argc, char* argv[]);
+void save_io_trace();
+int start_trace(int argc, char* argv[]);
+int dump_trace(const char* filename);
+void start_stats(int argc, char* argv[]);
+void load_symbols();
+int start_profile(int argc, char* argv[]);
+void save_profile();
+int start_call_stack(int argc, char* argv[]);
+void save_call_stack();
+void start_perf(int argc, char* argv[]);
 int output_cpu_mnemonic();
 int main(int argc, char* argv[]);
 
-int replicate_buffer(uint32_t from, uint32_t to, uint8_t* buffer, uint32_t buffersize)
-{
-	// replicate buffer based
-
-	uint32_t offset = 0;
-	uint32_t new_size = 0;
-
-	if (from >= to || buffersize < to)
-		return 1;
-
-	offset = from;
-	while (offset < to) {
-		new_size = offset * 2;
-		if (offset < new_size && to >= new_size) {
-			memcpy(buffer + offset, buffer, offset);
-		}
-
-		offset = new_size;
-	}
-
-	return 0;
-}
-
 void load_rom(const uint32_t ROM_BASE, const uint32_t ROM_END)
 {
 	/*int code_offset = 0x1000;
@@ -75,10 +82,9 @@ void load_rom(const uint32_t ROM_BASE, const uint32_t ROM_END)
 	//filename = "chihiro_xbox_bios.bin";
 	if (readFileIntoBuffer(filename, (cpu.mem.rom), cpu.mem.rom_size, &file_size, 0) == 0) {
 		printf("loaded %s into ROM at 0x%x\n", filename, ROM_BASE);
-	}
-	// replicate bios across space
-	if (file_size < cpu.mem.rom_size) {
-		replicate_buffer(file_size, cpu.mem.rom_size, cpu.mem.rom, cpu.mem.rom_size);
+
+		// mirror bios across space
+		x86CPUMirrorRom(&cpu, file_size);
 	}
 
 	filename = "mcpx_1.0.bin";
@@ -99,6 +105,270 @@ void load_rom(const uint32_t ROM_BASE, const uint32_t ROM_END)
 #endif
 }
 
+void load_devices()
+{
+	const X86_IO_READ_HANDLER status_read[3] = { io_status_read, NULL, NULL };
+	X86_PCI_FUNCTION* function;
+
+	// xbox pci devices. no device models yet; bar reads are 0 and writes are dropped.
+	x86InitPci(&pci, &cpu);
+	x86PciAddFunction(&pci, 0, 0x00, 0, 0x10de, 0x02a5, 0x060000, X86_PCI_HEADER_DEVICE); // host bridge
+	x86PciAddFunction(&pci, 0, 0x01, 0, 0x10de, 0x01b2, 0x060100, X86_PCI_HEADER_DEVICE); // lpc bridge
+	function = x86PciAddFunction(&pci, 0, 0x01, 1, 0x10de, 0x01b4, 0x0c0500, X86_PCI_HEADER_DEVICE); // smbus
+	if (function != NULL)
+		x86PciSetBar(function, 1, X86_PCI_BAR_IO, 0x10, NULL, NULL, NULL);
+	add_pci_mmio(0, 0x02, 0x01c2, 0x0c0310, 0, 0x00001000, 0xfed00000); // usb0
+	add_pci_mmio(0, 0x03, 0x01c2, 0x0c0310, 0, 0x00001000, 0xfed08000); // usb1
+	add_pci_mmio(0, 0x04, 0x01c3, 0x020000, 0, 0x00001000, 0xfef00000); // nic; the bar is 1KB, rounded up to a page
+	add_pci_mmio(0, 0x05, 0x01b0, 0x040100, 0, 0x00080000, 0xfe800000); // apu
+	add_pci_mmio(0, 0x06, 0x01b1, 0x040100, 2, 0x00001000, 0xfec00000); // aci
+	x86PciAddFunction(&pci, 0, 0x09, 0, 0x10de, 0x01bc, 0x01018a, X86_PCI_HEADER_DEVICE); // ide
+	x86PciAddFunction(&pci, 0, 0x1e, 0, 0x10de, 0x01b8, 0x060400, X86_PCI_HEADER_BRIDGE); // agp bridge
+	add_pci_mmio(1, 0x00, 0x02a0, 0x030000, 0, 0x01000000, 0xfd000000); // nv2a
+
+	// the bios polls the smbus for a done bit. stand-in until the smbus is modelled.
+	x86IoAddDevice(&cpu, 0xc000, 0xc000, status_read, NULL, NULL); // smbus status
+}
+void add_pci_mmio(uint8_t bus, uint8_t device, uint16_t device_id, uint32_t class_code, uint32_t bar, uint32_t size, uint32_t address)
+{
+	// a memory bar at the address the xbox decodes it, with memory space enabled.
+	X86_PCI_FUNCTION* function = x86PciAddFunction(&pci, bus, device, 0, 0x10de, device_id, class_code, X86_PCI_HEADER_DEVICE);
+	if (function == NULL || x86PciSetBar(function, bar, X86_PCI_BAR_MEMORY, size, NULL, NULL, NULL) != 0)
+		return;
+	x86PciConfigWrite(&pci, function, X86_PCI_BAR0 + bar * 4, 4, address);
+	x86PciConfigWrite(&pci, function, X86_PCI_COMMAND, 2, X86_PCI_COMMAND_MEMORY);
+}
+uint32_t io_status_read(void* device, uint16_t port)
+{
+	return 0x10;
+}
+
+int start_io_trace(int argc, char* argv[])
+{
+	// -record <file>: log every in / out of the run to file.
+	// -replay <file>: feed a log back in place of the devices; the run must start the way the recording did.
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], "-record") == 0) {
+			io_trace_file = argv[i + 1];
+			x86IoTraceRecord(&cpu);
+			printf("recording I/O to %s\n", io_trace_file);
+			return 0;
+		}
+		if (strcmp(argv[i], "-replay") == 0) {
+			uint32_t size = 0;
+			uint8_t* log = readFileAllocBuffer(argv[i + 1], &size, 0);
+			if (log == NULL)
+				return 1;
+			int result = x86IoTraceReplay(&cpu, log, size);
+			free(log);
+			if (result != 0) {
+				printf("error: %s is not an I/O trace\n", argv[i + 1]);
+				return 1;
+			}
+			printf("replaying %u I/O accesses from %s\n", cpu.io.trace.count, argv[i + 1]);
+			return 0;
+		}
+	}
+	return 0;
+}
+void save_io_trace()
+{
+	X86_IO_TRACE* trace = &cpu.io.trace;
+	uint8_t* log;
+	uint32_t size = 0;
+
+	if (io_trace_file == NULL) {
+		if (trace->error)
+			printf("I/O replay left the trace at access %u of %u\n", trace->position, trace->count);
+		return;
+	}
+
+	log = x86IoTraceSave(&cpu, &size);
+	if (log == NULL)
+		return;
+	if (writeFile(io_trace_file, log, size) == 0)
+		printf("recorded %u I/O accesses to %s\n", trace->count, io_trace_file);
+	free(log);
+}
+
+int start_trace(int argc, char* argv[])
+{
+	// -trace <file>: free run and write a record of every instruction to file instead of printing it.
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], "-trace") == 0) {
+			if (x86TraceStart(&cpu, argv[i + 1]) != 0) {
+				printf("error: could not start a trace to %s\n", argv[i + 1]);
+				return 1;
+			}
+			cpu.eflags.TF = 0;
+			printf("tracing to %s\n", argv[i + 1]);
+			return 0;
+		}
+	}
+	return 0;
+}
+int dump_trace(const char* filename)
+{
+	// -dumptrace <file>: print a trace as text. each instruction is disassembled from the bytes in its record.
+	X86_TRACE_HEADER header;
+	X86_TRACE_RECORD record;
+	X86_SEGMENT_DESCRIPTOR* cs = &cpu.segment_descriptors[SEG_CS];
+	char name[8];
+	uint64_t count = 0;
+
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		printf("error: could not open %s\n", filename);
+		return 1;
+	}
+	if (fread(&header, sizeof(X86_TRACE_HEADER), 1, file) != 1 || header.magic != X86_TRACE_MAGIC ||
+		header.version != X86_TRACE_VERSION || header.record_size != sizeof(X86_TRACE_RECORD)) {
+		printf("error: %s is not an instruction trace\n", filename);
+		fclose(file);
+		return 1;
+	}
+
+	// decode at cs:0 with base 0; mnemonics do not depend on where the instruction was.
+	cs->base = 0;
+	cpu.eip = 0;
+
+	while (fread(&record, sizeof(X86_TRACE_RECORD), 1, file) == 1) {
+		cpu.mode = record.key >> 1;
+		cs->default_size = record.key & 1;
+		x86CPUUpdateMode(&cpu);
+		for (uint32_t i = 0; i < X86_TRACE_MAX_BYTES; ++i) {
+			x86CPUWriteByte(&cpu, i, record.bytes[i]);
+		}
+		cpu.eip_ptr = x86GetCPUFetchPtr(&cpu, 0);
+
+		memset(cpu.output_str, 0, sizeof(cpu.output_str));
+		x86CPUGetMnemonic(&cpu, NULL);
+		printf("%08x: %-32s", record.address, cpu.output_str);
+
+		for (uint32_t i = 0; i < X86_GENERAL_REGISTER_COUNT; ++i) {
+			if (record.changed & (1 << i)) {
+				x86CPUGetRegisterMnemonic(name, "%s", i, 4);
+				printf(" %s=%08x", name, record.registers[i]);
+			}
+		}
+		if (record.flags & X86_TRACE_EFLAGS_CHANGED)
+			printf(" eflags=%08x", record.eflags);
+		if (record.write_size != 0)
+			printf(" [%08x]=%0*x", record.write_address, record.write_size * 2, record.write_value);
+		printf("\n");
+		count += 1;
+	}
+
+	fclose(file);
+	printf("%llu instructions\n", (unsigned long long)count);
+	return 0;
+}
+
+void start_stats(int argc, char* argv[])
+{
+	// -cycles: time every interpreted handler with the host timestamp counter.
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-cycles") == 0) {
+			x86StatsSampleCycles(&cpu, 1);
+			printf("sampling handler cycles\n");
+		}
+	}
+}
+
+void load_symbols()
+{
+	// the code load_breakpoints marks.
+	x86ProfileAddSymbol(&cpu, 0xfffffe4a, "PCI_WRITE xcode");
+	x86ProfileAddSymbol(&cpu, 0xfffffebc, "end of xcode interpreter");
+	x86ProfileAddSymbol(&cpu, 0xfffffed2, "wrmsr loop");
+	x86ProfileAddSymbol(&cpu, 0xfffffedd, "rc4_key init");
+	x86ProfileAddSymbol(&cpu, 0xfffffefb, "rc4_key init key");
+	x86ProfileAddSymbol(&cpu, 0xffffff3c, "rc4");
+	x86ProfileAddSymbol(&cpu, 0xffffff7f, "decryption loop");
+}
+int start_profile(int argc, char* argv[])
+{
+	// -profile <file>: sample eip every PROFILE_PERIOD instructions and write the hot spots to file at exit.
+	// -symbols <file>: name the hot spots from a map file of "<hex address> <name>" lines.
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], "-profile") == 0) {
+			profile_file = argv[i + 1];
+		}
+		if (strcmp(argv[i], "-symbols") == 0) {
+			if (x86ProfileLoadSymbols(&cpu, argv[i + 1]) != 0) {
+				printf("error: could not load symbols from %s\n", argv[i + 1]);
+				return 1;
+			}
+			printf("loaded %u symbols from %s\n", cpu.profile.symbol_count, argv[i + 1]);
+		}
+	}
+
+	if (profile_file == NULL)
+		return 0;
+
+	if (x86ProfileStart(&cpu, PROFILE_PERIOD) != 0) {
+		printf("error: could not start the profiler\n");
+		return 1;
+	}
+	printf("profiling to %s\n", profile_file);
+	return 0;
+}
+void save_profile()
+{
+	if (profile_file == NULL)
+		return;
+
+	x86ProfileStop(&cpu);
+	if (x86ProfileWriteReport(&cpu, profile_file, PROFILE_REPORT_ENTRIES) != 0) {
+		printf("error: could not write the profile to %s\n", profile_file);
+		return;
+	}
+	printf("wrote %llu samples to %s\n", (unsigned long long)cpu.profile.samples, profile_file);
+}
+int start_call_stack(int argc, char* argv[])
+{
+	// -callstack <file>: follow calls and returns and write the instructions of each call path to file at exit,
+	// folded for flame graph tools.
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], "-callstack") == 0) {
+			call_stack_file = argv[i + 1];
+			if (x86CallStackStart(&cpu) != 0) {
+				printf("error: could not start the call stack\n");
+				return 1;
+			}
+			printf("following calls to %s\n", call_stack_file);
+			return 0;
+		}
+	}
+	return 0;
+}
+void save_call_stack()
+{
+	if (call_stack_file == NULL)
+		return;
+
+	x86CallStackStop(&cpu);
+	x86CallStackDump(&cpu, CALL_STACK_DUMP_ENTRIES);
+	if (x86CallStackWriteFolded(&cpu, call_stack_file) != 0) {
+		printf("error: could not write the call stacks to %s\n", call_stack_file);
+		return;
+	}
+	printf("wrote %u call paths to %s\n", cpu.calls.node_count - 1, call_stack_file);
+}
+
+void start_perf(int argc, char* argv[])
+{
+	// -perf: count host cycles, instructions and misses over the run; printed per guest instruction at exit.
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-perf") == 0) {
+			if (hostPerfOpen(&perf) != 0)
+				printf("error: no host performance counters\n");
+			else
+				printf("counting host performance\n");
+		}
+	}
+}
+
 #define OUTPUT_MNEMONIC
 
 int output_cpu_mnemonic()
@@ -120,59 +390,28 @@ int output_cpu_mnemonic()
 	return 0;
 }
 
-int init_breakpoints()
-{
-	cpu_breakpoint_count = 128;
-	cpu_breakpoint_index = 0;
-	cpu_breakpoint = (BREAKPOINT*)malloc(sizeof(BREAKPOINT) * cpu_breakpoint_count);
-	if (cpu_breakpoint == NULL) {
-		return 1;
-	}
-	memset(cpu_breakpoint, 0, sizeof(BREAKPOINT) * cpu_breakpoint_count);
-	return 0;
-}
-void free_breakpoints()
-{
-	if (cpu_breakpoint != NULL) {
-		free(cpu_breakpoint);
-		cpu_breakpoint = NULL;
-		cpu_breakpoint_count = 0;
-		cpu_breakpoint_index = 0;
-	}
-}
 void load_breakpoints()
 {
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xfffffebc;	// end of xcode interpreter
+	//x86CPUAddBreakpoint(&cpu, 0xfffffebc, true);	// end of xcode interpreter
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xfffffed2;	// end of wrmsr loop (enable cache)
+	//x86CPUAddBreakpoint(&cpu, 0xfffffed2, true);	// end of wrmsr loop (enable cache)
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	cpu_breakpoint[cpu_breakpoint_index++].address = 0xfffffedd;	// rc4_key init
+	x86CPUAddBreakpoint(&cpu, 0xfffffedd, false);	// rc4_key init
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	cpu_breakpoint[cpu_breakpoint_index++].address = 0xfffffefb;	// rc4_key init key
+	x86CPUAddBreakpoint(&cpu, 0xfffffefb, false);	// rc4_key init key
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff3c;	// rc4
+	//x86CPUAddBreakpoint(&cpu, 0xffffff3c, true);	// rc4
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff7f;	// 1 decryption loop. (rom->ram)
+	x86CPUAddBreakpoint(&cpu, 0xffffff7f, false);	// 1 decryption loop. (rom->ram)
 
-	cpu_breakpoint[cpu_breakpoint_index].set = true;
-	cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff7f + 2;	// end of decryption . (rom->ram)
+	x86CPUAddBreakpoint(&cpu, 0xffffff7f + 2, true);	// end of decryption . (rom->ram)
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff6c;	// mov encrypted byte from rom
+	//x86CPUAddBreakpoint(&cpu, 0xffffff6c, true);	// mov encrypted byte from rom
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff77;	// mov decrypted byte to ram
+	//x86CPUAddBreakpoint(&cpu, 0xffffff77, true);	// mov decrypted byte to ram
 
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff26;	// invalid addressing mode..  mov [bh+dh*1-1], al
-	//cpu_breakpoint[cpu_breakpoint_index].set = true;
-	//cpu_breakpoint[cpu_breakpoint_index++].address = 0xffffff19;	// invalid addressing mode..  mov al, [ch+cl*1+0]
+	//x86CPUAddBreakpoint(&cpu, 0xffffff26, true);	// invalid addressing mode..  mov [bh+dh*1-1], al
+	//x86CPUAddBreakpoint(&cpu, 0xffffff19, true);	// invalid addressing mode..  mov al, [ch+cl*1+0]
 
 
 	/* PCI_WRITE xcode
@@ -184,8 +423,7 @@ void load_breakpoints()
 		fffffe5c: add dl, 0x4
 		fffffe5f: mov eax, ecx
 		fffffe61: out dx, eax*/
-	cpu_breakpoint[cpu_breakpoint_index].set = true;
-	cpu_breakpoint[cpu_breakpoint_index++].address = 0xfffffe4a;
+	x86CPUAddBreakpoint(&cpu, 0xfffffe4a, true);
 }
 
 int main(int argc, char* argv[])
@@ -194,6 +432,7 @@ int main(int argc, char* argv[])
 	const uint32_t ROM_END = 0xffffffff;
 	const uint32_t MEM_SIZE = 0x07ffffff;
 	int result = 0;
+	uint64_t guest_instructions = 0; // instructions run while the host counters count; time skipped while halted or idle is not counted
 
 	result = x86InitCPU(&cpu, ROM_BASE, ROM_END, 0, MEM_SIZE);
 	if (result != 0) {
@@ -201,10 +440,11 @@ int main(int argc, char* argv[])
 		goto Cleanup;
 	}
 
-	result = init_breakpoints();
-	if (result != 0) {
-		printf("error: Out of Memory\n");
-		goto Cleanup;
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], "-dumptrace") == 0) {
+			result = dump_trace(argv[i + 1]);
+			goto Cleanup;
+		}
 	}
 
 	// enable TRAP FLAG; single step program.
@@ -212,10 +452,67 @@ int main(int argc, char* argv[])
 
 	load_rom(ROM_BASE, ROM_END);
 
+	load_devices();
+
 	load_breakpoints();
-		
+
+	load_symbols();
+
+	result = start_io_trace(argc, argv);
+	if (result == 0)
+		result = start_trace(argc, argv);
+	if (result == 0)
+		result = start_profile(argc, argv);
+	if (result == 0)
+		result = start_call_stack(argc, argv);
+
+	start_stats(argc, argv);
+	start_perf(argc, argv);
+
+	hostPerfStart(&perf);
+
 	while (result == 0) {
 
+		if (cpu.eflags.TF == 0) {
+			// free running; execute a batch of instructions at a time.
+			result = input_loop();
+			if (result != 0)
+				break;
+
+			switch (x86CPURun(&cpu, CPU_RUN_BATCH, X86_CPU_STOP_BREAKPOINT)) {
+				case X86_CPU_EXIT_BREAKPOINT:
+					cpu.eflags.TF = 1;
+					printf("Breakpoint hit\n\t%08x: ", cpu.exit.address);
+					break;
+				case X86_CPU_EXIT_HLT:
+					// keep running while an event can still wake the cpu.
+					if (cpu.events.count == 0)
+						result = X86_CPU_ERROR_HLT;
+					break;
+				case X86_CPU_EXIT_UD:
+				case X86_CPU_EXIT_FATAL:
+					result = cpu.exit.error;
+					break;
+				case X86_CPU_EXIT_IO:
+				case X86_CPU_EXIT_COUNT:
+					// the end of the batch; X86_CPU_STOP_IO is not asked for. keep running.
+					break;
+			}
+			guest_instructions += cpu.exit.instructions;
+			continue;
+		}
+
+		if (cpu.hlt) {
+			// single stepping a halted cpu; skip to the event that wakes it.
+			if (cpu.events.count == 0) {
+				result = X86_CPU_ERROR_HLT;
+				break;
+			}
+			cpu.clock = cpu.events.deadline;
+			x86EventDispatch(&cpu);
+			continue;
+		}
+
 		result = output_cpu_mnemonic();
 		//if (result != 0)
 		//	break;
@@ -224,12 +521,16 @@ int main(int argc, char* argv[])
 		if (result != 0)
 			break;
 		
+		x86EventDispatch(&cpu);
 		result = x86CPUExecute(&cpu);
 		if (result != 0)
 			break;
+		guest_instructions += 1;
 
 	}
 
+	hostPerfStop(&perf);
+
 	switch (result) {
 		case X86_CPU_ERROR_UD: {
 			uint32_t address = x86GetEffectiveAddress(&cpu, cpu.eip);
@@ -241,10 +542,20 @@ int main(int argc, char* argv[])
 	}
 
 	x86CPUDumpRegisters(&cpu);
+	x86StatsDump(&cpu, STATS_DUMP_ENTRIES);
+	hostPerfPrint(&perf, guest_instructions);
+
+	save_io_trace();
+	save_profile();
+	save_call_stack();
+
+	if (cpu.trace.active && x86TraceStop(&cpu) != 0)
+		printf("error: the trace file is incomplete\n");
 
 Cleanup:
+	hostPerfClose(&perf);
+	x86FreePci(&pci);
 	x86FreeCPU(&cpu);	
-	free_breakpoints();
 	memtrack_report();
 
 	return result;